@@ -0,0 +1,110 @@
+#include "BakedTables.h"
+
+
+template<size_t N>
+static constexpr std::array<Mat4f, N> to_floats(const std::array<Mat4, N>& xforms)
+{
+	std::array<Mat4f, N> ret{};
+	for(size_t i = 0; i < N; i++)
+		ret[i] = Mat4f(xforms[i]);
+	return ret;
+}
+
+
+constexpr std::array<Mat4f, 4> pole_xforms = {
+	Mat4f::identity(),
+	Mat4f::axial_rotation(_w, _x, TAU / 4),
+	Mat4f::axial_rotation(_w, _y, TAU / 4),
+	Mat4f::axial_rotation(_w, _z, TAU / 4)
+};
+
+
+static constexpr std::array<Mat4, NUM_HOPF_FIBERS> make_hopf_xforms(bool anti)
+{
+	std::array<Mat4, NUM_HOPF_FIBERS> ret{};
+	for(int i = 0; i < NUM_HOPF_FIBERS; i++)
+	{
+		double theta = (double)i * TAU / (2 * NUM_HOPF_FIBERS);
+		if(anti)
+			ret[i] = Mat4::axial_rotation(_y, _x, theta) * Mat4::axial_rotation(_z, _w, theta) * Mat4::axial_rotation(_x, _z, TAU / 4);
+		else
+			ret[i] = Mat4::axial_rotation(_x, _w, theta) * Mat4::axial_rotation(_y, _z, theta);
+	}
+	return ret;
+}
+
+constexpr std::array<Mat4f, NUM_HOPF_FIBERS> hopf_xforms = to_floats(make_hopf_xforms(false));
+constexpr std::array<Mat4f, NUM_HOPF_FIBERS> antihopf_xforms = to_floats(make_hopf_xforms(true));
+
+
+static constexpr Vec4 tesseract_vertex(int vertex)
+{
+	return Vec4(
+		vertex & 1 ? 1 : -1,
+		vertex & 2 ? 1 : -1,
+		vertex & 4 ? 1 : -1,
+		vertex & 8 ? 1 : -1
+	).normalize();
+}
+
+static constexpr std::array<Mat4, NUM_TESSERACT_EDGES> make_tesseract_edge_xforms()
+{
+	std::array<Mat4, NUM_TESSERACT_EDGES> ret{};
+	int edge_index = 0;
+	for(int vertex = 0; vertex < 16; vertex++)
+		for(int axis = 0; axis < 4; axis++)
+			if(vertex & (1 << axis))
+				ret[edge_index++] = basis_around(tesseract_vertex(vertex), tesseract_vertex(vertex & ~(1 << axis)));
+	return ret;
+}
+
+constexpr std::array<Mat4f, NUM_TESSERACT_EDGES> tesseract_edge_xforms = to_floats(make_tesseract_edge_xforms());
+
+
+//The geodesic model lies in the zw plane, and these rotate it into each of the other five coordinate planes.
+constexpr std::array<Mat4f, NUM_CROSS_EDGE_LOOPS> cross_xforms = to_floats(std::array<Mat4, NUM_CROSS_EDGE_LOOPS>{
+	Mat4::identity(),
+	Mat4::axial_rotation(_x, _w, TAU / 4),
+	Mat4::axial_rotation(_y, _w, TAU / 4),
+	Mat4::axial_rotation(_x, _z, TAU / 4),
+	Mat4::axial_rotation(_y, _z, TAU / 4),
+	Mat4::axial_rotation(_x, _w, TAU / 4) * Mat4::axial_rotation(_y, _z, TAU / 4)
+});
+
+
+static constexpr std::array<Mat4, NUM_ITC_EDGE_LOOPS> make_itc_edge_loop_xforms(bool dual)
+{
+	//Don't ask how I came up with these vectors. You don't want to know.
+	const Vec4 temp[NUM_ITC_EDGE_LOOPS][2] = {
+		{Vec4(0, 1, 1, 0), Vec4(1, 0, 1, 0)},
+		{Vec4(0, 1, 1, 0), Vec4(1, 1, 0, 0)},
+		{Vec4(0, 1, 1, 0), Vec4(0, 0, 1, 1)},
+		{Vec4(0, 1, 1, 0), Vec4(0, 0, 1, -1)},
+		{Vec4(1, 1, 0, 0), Vec4(0, 1, -1, 0)},
+		{Vec4(1, 1, 0, 0), Vec4(0, 1, 0, 1)},
+		{Vec4(1, 1, 0, 0), Vec4(0, 1, 0, -1)},
+		{Vec4(-1, 0, 0, 1), Vec4(0, -1, 0, 1)},
+		{Vec4(-1, 0, 0, 1), Vec4(0, 0, 1, 1)},
+		{Vec4(-1, 0, 0, 1), Vec4(0, 0, -1, 1)},
+		{Vec4(0, 0, 1, -1), Vec4(1, 0, 1, 0)},
+		{Vec4(0, 0, 1, -1), Vec4(0, 1, 0, -1)},
+		{Vec4(0, 1, 0, 1), Vec4(1, 0, 0, 1)},
+		{Vec4(0, 1, 0, 1), Vec4(0, 0, 1, 1)},
+		{Vec4(0, -1, 1, 0), Vec4(1, -1, 0, 0)},
+		{Vec4(1, 0, 0, 1), Vec4(0, 0, 1, 1)}
+	};
+
+	Mat4 dual_rotation = Mat4::axial_rotation(_w, _z, TAU / 8) * Mat4::axial_rotation(_y, _x, TAU / 8);
+
+	std::array<Mat4, NUM_ITC_EDGE_LOOPS> ret{};
+	for(int i = 0; i < NUM_ITC_EDGE_LOOPS; i++)
+	{
+		ret[i] = basis_around(temp[i][0].normalize(), temp[i][1].normalize());
+		if(dual)
+			ret[i] = dual_rotation * ret[i];
+	}
+	return ret;
+}
+
+constexpr std::array<Mat4f, NUM_ITC_EDGE_LOOPS> itc_edge_loop_xforms = to_floats(make_itc_edge_loop_xforms(false));
+constexpr std::array<Mat4f, NUM_ITC_EDGE_LOOPS> dual_itc_edge_loop_xforms = to_floats(make_itc_edge_loop_xforms(true));
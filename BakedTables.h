@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Vector.h"
+#include <array>
+
+
+/*
+	Transforms for the fixed things drawn by the S3 viewer (see Main.cpp). They're all constexpr, so they're 
+	worked out by the compiler and just sit in the binary.
+*/
+
+
+#define NUM_HOPF_FIBERS		(32)
+#define NUM_TESSERACT_EDGES			(32)
+#define NUM_CROSS_EDGE_LOOPS		(6)		//One great circle for each coordinate plane.
+#define NUM_ITC_EDGE_LOOPS			(16)
+
+
+//Move the icosahedron at 1, 0, 0, 0 to each of the four positive poles.
+extern const std::array<Mat4f, 4> pole_xforms;
+
+//Geodesics through every point of the xw great circle, making up a Hopf fibration, and the same for the other handedness.
+extern const std::array<Mat4f, NUM_HOPF_FIBERS> hopf_xforms;
+extern const std::array<Mat4f, NUM_HOPF_FIBERS> antihopf_xforms;
+
+//The edges of the tesseract {4, 3, 3}, each an arc from one vertex to the next.
+extern const std::array<Mat4f, NUM_TESSERACT_EDGES> tesseract_edge_xforms;
+
+//The edges of the 16-cell {3, 3, 4}, which lie on the six coordinate great circles.
+extern const std::array<Mat4f, NUM_CROSS_EDGE_LOOPS> cross_xforms;
+
+//The edges of the icositetrachoron {3, 4, 3}, which lie on 16 great circles, and of the icositetrachoron dual to it.
+extern const std::array<Mat4f, NUM_ITC_EDGE_LOOPS> itc_edge_loop_xforms;
+extern const std::array<Mat4f, NUM_ITC_EDGE_LOOPS> dual_itc_edge_loop_xforms;
@@ -0,0 +1,253 @@
+#include "BatchMath.h"
+
+#include "Vector.h"
+
+
+#define PI_F			(3.14159265358979f)
+#define HALF_PI_F		(1.57079632679490f)
+#define QUARTER_PI_F	(0.785398163397448f)
+#define TWO_OVER_PI_F	(0.636619772367581f)
+
+//pi / 2 split into three parts so that j * (pi / 2) can be subtracted without losing bits (Cody-Waite).
+#define HALF_PI_1	(1.5703125f)
+#define HALF_PI_2	(4.837512969970703125e-4f)
+#define HALF_PI_3	(7.54978995489188216e-8f)
+
+#define TAN_3PI_8	(2.414213562373095f)
+#define TAN_PI_8	(0.4142135623730950f)
+
+
+#ifdef S3_SSE_FLOAT
+
+	static inline __m128 select(__m128 mask, __m128 if_true, __m128 if_false)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, if_true), _mm_andnot_ps(mask, if_false));
+	}
+
+	static inline __m128 abs4(__m128 x)
+	{
+		return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+	}
+
+	//The sign bit of sign applied to the (non-negative) magnitude.
+	static inline __m128 copysign4(__m128 magnitude, __m128 sign)
+	{
+		return _mm_or_ps(magnitude, _mm_and_ps(_mm_set1_ps(-0.0f), sign));
+	}
+
+	//Horner's rule, highest order coefficient first.
+	template<int N>
+	static inline __m128 poly4(__m128 z, const float (&coefficients)[N])
+	{
+		__m128 ret = _mm_set1_ps(coefficients[0]);
+		for(int i = 1; i < N; i++)
+			ret = _mm_add_ps(_mm_mul_ps(ret, z), _mm_set1_ps(coefficients[i]));
+		return ret;
+	}
+
+	static const float sin_coefficients[] = {-1.9515295891e-4f, 8.3321608736e-3f, -1.6666654611e-1f};
+	static const float cos_coefficients[] = {2.443315711809948e-5f, -1.388731625493765e-3f, 4.166664568298827e-2f};
+	static const float asin_coefficients[] = {4.2163199048e-2f, 2.4181311049e-2f, 4.5470025998e-2f, 7.4953002686e-2f, 1.6666752422e-1f};
+	static const float atan_coefficients[] = {8.05374449538e-2f, -1.38776856032e-1f, 1.99777106478e-1f, -3.33329491539e-1f};
+
+	static inline void sincos4(__m128 x, __m128& out_sin, __m128& out_cos)
+	{
+		//x = j * pi / 2 + r, |r| <= pi / 4
+		__m128i j = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(TWO_OVER_PI_F)));
+		__m128 fj = _mm_cvtepi32_ps(j);
+		__m128 r = _mm_sub_ps(x, _mm_mul_ps(fj, _mm_set1_ps(HALF_PI_1)));
+		r = _mm_sub_ps(r, _mm_mul_ps(fj, _mm_set1_ps(HALF_PI_2)));
+		r = _mm_sub_ps(r, _mm_mul_ps(fj, _mm_set1_ps(HALF_PI_3)));
+
+		__m128 r2 = _mm_mul_ps(r, r);
+		__m128 s = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), poly4(r2, sin_coefficients)));
+		__m128 c = _mm_add_ps(
+			_mm_sub_ps(_mm_set1_ps(1), _mm_mul_ps(_mm_set1_ps(0.5f), r2)),
+			_mm_mul_ps(_mm_mul_ps(r2, r2), poly4(r2, cos_coefficients))
+		);
+
+		//Quadrants 1 and 3 swap sin and cos. sin is negated in quadrants 2 and 3, cos in quadrants 1 and 2.
+		__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+		__m128 sin_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), 30));
+		__m128 cos_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+		out_sin = _mm_xor_ps(select(swap, c, s), sin_sign);
+		out_cos = _mm_xor_ps(select(swap, s, c), cos_sign);
+	}
+
+	/*
+		asin(x) for |x| <= 1/2 is x + x^3 P(x^2). Past that, asin(x) = pi / 2 - 2 asin(sqrt((1 - x) / 2)), which 
+		is where acos() comes from too. half_angle is asin(sqrt((1 - |x|) / 2)) for the big ones, so that acos() 
+		can use it without subtracting from pi / 2 and losing the small values.
+	*/
+	static inline void asin_parts4(__m128 x, __m128& out_asin_small, __m128& out_half_angle, __m128& out_is_big)
+	{
+		__m128 a = abs4(_mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-1)), _mm_set1_ps(1)));
+		out_is_big = _mm_cmpgt_ps(a, _mm_set1_ps(0.5f));
+
+		__m128 z_big = _mm_mul_ps(_mm_set1_ps(0.5f), _mm_sub_ps(_mm_set1_ps(1), a));
+		__m128 z = select(out_is_big, z_big, _mm_mul_ps(a, a));
+		__m128 t = select(out_is_big, _mm_sqrt_ps(z_big), a);
+		__m128 p = _mm_add_ps(t, _mm_mul_ps(_mm_mul_ps(t, z), poly4(z, asin_coefficients)));
+
+		out_asin_small = p;
+		out_half_angle = p;
+	}
+
+	static inline __m128 asin4(__m128 x)
+	{
+		__m128 small, half_angle, is_big;
+		asin_parts4(x, small, half_angle, is_big);
+		__m128 magnitude = select(is_big, _mm_sub_ps(_mm_set1_ps(HALF_PI_F), _mm_add_ps(half_angle, half_angle)), small);
+		return copysign4(magnitude, x);
+	}
+
+	static inline __m128 acos4(__m128 x)
+	{
+		__m128 small, half_angle, is_big;
+		asin_parts4(x, small, half_angle, is_big);
+		__m128 negative = _mm_cmplt_ps(x, _mm_setzero_ps());
+		//Big: acos(|x|) = 2 * half_angle, and acos(-|x|) = pi - acos(|x|). Small: acos(x) = pi / 2 - asin(x).
+		__m128 big = _mm_add_ps(half_angle, half_angle);
+		big = select(negative, _mm_sub_ps(_mm_set1_ps(PI_F), big), big);
+		return select(is_big, big, _mm_sub_ps(_mm_set1_ps(HALF_PI_F), copysign4(small, x)));
+	}
+
+	static inline __m128 atan2_4(__m128 y, __m128 x)
+	{
+		__m128 ax = abs4(x), ay = abs4(y);
+		__m128 num = _mm_min_ps(ax, ay), den = _mm_max_ps(ax, ay);
+		__m128 zero_den = _mm_cmpeq_ps(den, _mm_setzero_ps());
+		__m128 t = _mm_div_ps(num, select(zero_den, _mm_set1_ps(1), den));		//0 <= t <= 1
+
+		//Past tan(pi / 8), use atan(t) = pi / 4 + atan((t - 1) / (t + 1)).
+		__m128 reduce = _mm_cmpgt_ps(t, _mm_set1_ps(TAN_PI_8));
+		t = select(reduce, _mm_div_ps(_mm_sub_ps(t, _mm_set1_ps(1)), _mm_add_ps(t, _mm_set1_ps(1))), t);
+		__m128 z = _mm_mul_ps(t, t);
+		__m128 ret = _mm_add_ps(t, _mm_mul_ps(_mm_mul_ps(t, z), poly4(z, atan_coefficients)));
+		ret = _mm_add_ps(ret, _mm_and_ps(reduce, _mm_set1_ps(QUARTER_PI_F)));
+
+		ret = select(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(HALF_PI_F), ret), ret);
+		__m128 x_negative = _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(x), 31));		//Including -0, like libm.
+		ret = select(x_negative, _mm_sub_ps(_mm_set1_ps(PI_F), ret), ret);
+		return copysign4(ret, y);
+	}
+
+	//Near antipodal points, sqrt(chord2) / 2 is close to 1 where asin is steep, so use pi - 2 asin(sqrt(1 - chord2 / 4)) instead. 1 - chord2 / 4 is exact.
+	static inline __m128 geodesic4(__m128 chord2)
+	{
+		__m128 c = _mm_min_ps(_mm_max_ps(chord2, _mm_setzero_ps()), _mm_set1_ps(4));
+		__m128 far = _mm_cmpgt_ps(c, _mm_set1_ps(2));
+		__m128 h2 = _mm_mul_ps(_mm_set1_ps(0.25f), c);
+		__m128 a = asin4(_mm_sqrt_ps(select(far, _mm_sub_ps(_mm_set1_ps(1), h2), h2)));
+		a = _mm_add_ps(a, a);
+		return select(far, _mm_sub_ps(_mm_set1_ps(PI_F), a), a);
+	}
+
+
+	//Run kernel on groups of four, padding the last group out with copies of its first element.
+	template<typename Kernel>
+	static inline void for_each_group(size_t count, Kernel kernel)
+	{
+		size_t i = 0;
+		for(; i + 4 <= count; i += 4)
+			kernel(i, 4);
+		if(i < count)
+			kernel(i, count - i);
+	}
+
+	static inline __m128 load(const float* in, size_t n)
+	{
+		if(n == 4)
+			return _mm_loadu_ps(in);
+		float temp[4] = {in[0], in[0], in[0], in[0]};
+		for(size_t k = 0; k < n; k++)
+			temp[k] = in[k];
+		return _mm_loadu_ps(temp);
+	}
+
+	static inline void store(float* out, __m128 v, size_t n)
+	{
+		if(n == 4)
+		{
+			_mm_storeu_ps(out, v);
+			return;
+		}
+		float temp[4];
+		_mm_storeu_ps(temp, v);
+		for(size_t k = 0; k < n; k++)
+			out[k] = temp[k];
+	}
+
+
+	void batch_sincos(const float* x, float* out_sin, float* out_cos, size_t count)
+	{
+		for_each_group(count, [&](size_t i, size_t n) {
+			__m128 s, c;
+			sincos4(load(x + i, n), s, c);
+			store(out_sin + i, s, n);
+			store(out_cos + i, c, n);
+		});
+	}
+
+	void batch_asin(const float* x, float* out, size_t count)
+	{
+		for_each_group(count, [&](size_t i, size_t n) {store(out + i, asin4(load(x + i, n)), n);});
+	}
+
+	void batch_acos(const float* x, float* out, size_t count)
+	{
+		for_each_group(count, [&](size_t i, size_t n) {store(out + i, acos4(load(x + i, n)), n);});
+	}
+
+	void batch_atan2(const float* y, const float* x, float* out, size_t count)
+	{
+		for_each_group(count, [&](size_t i, size_t n) {store(out + i, atan2_4(load(y + i, n), load(x + i, n)), n);});
+	}
+
+	void batch_geodesic_from_chord2(const float* chord2, float* out, size_t count)
+	{
+		for_each_group(count, [&](size_t i, size_t n) {store(out + i, geodesic4(load(chord2 + i, n)), n);});
+	}
+
+#else
+
+	static inline float clamp(float x, float lo, float hi)
+	{
+		return x < lo ? lo : (x > hi ? hi : x);
+	}
+
+	void batch_sincos(const float* x, float* out_sin, float* out_cos, size_t count)
+	{
+		for(size_t i = 0; i < count; i++)
+		{
+			float temp = x[i];
+			out_sin[i] = sinf(temp);
+			out_cos[i] = cosf(temp);
+		}
+	}
+
+	void batch_asin(const float* x, float* out, size_t count)
+	{
+		for(size_t i = 0; i < count; i++)
+			out[i] = asinf(clamp(x[i], -1, 1));
+	}
+
+	void batch_acos(const float* x, float* out, size_t count)
+	{
+		for(size_t i = 0; i < count; i++)
+			out[i] = acosf(clamp(x[i], -1, 1));
+	}
+
+	void batch_atan2(const float* y, const float* x, float* out, size_t count)
+	{
+		for(size_t i = 0; i < count; i++)
+			out[i] = atan2f(y[i], x[i]);
+	}
+
+	void batch_geodesic_from_chord2(const float* chord2, float* out, size_t count)
+	{
+		for(size_t i = 0; i < count; i++)
+			out[i] = 2 * asinf(0.5f * sqrtf(clamp(chord2[i], 0, 4)));
+	}
+
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+
+
+/*
+	Batched float versions of the libm functions that S3 geometry keeps calling: sincos, acos, asin, atan2, 
+	and the geodesic distance for a chord. They run four at a time with SSE where it's available (see 
+	Vector.h) and fall back to libm otherwise. They're meant for arrays of thousands of vertices or entities. 
+	For one-off values, just use libm.
+
+	The polynomials are the single precision Cephes ones. Measured against double precision libm over their 
+	domains, the absolute errors are within
+		sincos			1e-7 for |x| <= 8192 (the range reduction loses accuracy past that)
+		asin, acos		3e-7 for |x| <= 1 (anything outside is clamped)
+		atan2			3e-7
+		geodesic		4e-7 for 0 <= chord2 <= 4 (clamped)
+	In and out may be the same array, but the outputs of batch_sincos must be different from each other.
+*/
+
+void batch_sincos(const float* x, float* out_sin, float* out_cos, size_t count);
+void batch_asin(const float* x, float* out, size_t count);
+void batch_acos(const float* x, float* out, size_t count);
+void batch_atan2(const float* y, const float* x, float* out, size_t count);
+
+//The S3 (great circle) distance between two points of S3 whose straight line distance squared is chord2, i.e. 2 * asin(sqrt(chord2) / 2).
+void batch_geodesic_from_chord2(const float* chord2, float* out, size_t count);
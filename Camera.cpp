@@ -7,9 +7,9 @@ Camera cam;
 Camera *s_curcam = &cam;
 
 
-Camera::Camera(const Mat4& mat, double aspect_ratio, double vertical_field_of_view, double near)
+Camera::Camera(const Mat4& mat, double aspect_ratio, double vertical_field_of_view, double near) : generation(0)
 {
-	this->mat = mat;
+	set_mat(mat);
 	set_perspective(aspect_ratio, vertical_field_of_view, near);
 }
 
@@ -20,12 +20,22 @@ Camera::Camera(const Mat4& mat, double aspect_ratio, double vertical_field_of_vi
 */
 void Camera::translate(double right, double down, double fwd)
 {
-	mat = mat * Mat4::axial_rotation(_w, _x, right) * Mat4::axial_rotation(_w, _y, down) * Mat4::axial_rotation(_w, _z, fwd);
+	rotor.rotate(_w, _x, right);
+	rotor.rotate(_w, _y, down);
+	rotor.rotate(_w, _z, fwd);
+	rotor.normalize_in_place();
+	mat = rotor.to_mat();
+	generation++;
 }
 
 void Camera::rotate(double pitch, double yaw, double roll)
 {
-	mat = mat * Mat4::axial_rotation(_y, _z, pitch) * Mat4::axial_rotation(_z, _x, yaw) * Mat4::axial_rotation(_x, _y, roll);
+	rotor.rotate(_y, _z, pitch);
+	rotor.rotate(_z, _x, yaw);
+	rotor.rotate(_x, _y, roll);
+	rotor.normalize_in_place();
+	mat = rotor.to_mat();
+	generation++;
 }
 
 
@@ -36,20 +46,47 @@ void Camera::set_perspective(double ar, double vfov, double near)
 	aspect_ratio = ar;
 	double q = tan(0.5 * vfov);
 
-	projection = Mat4(
+	projection = Mat4f(
 		1.0 / (ar * q),		0,				0,								0,
 		0,					-1.0 / q,		0,								0,
 		0,					0,				(FAR + near) / (FAR - near),	2.0 * near * FAR / (near - FAR),
 		0,					0,				1,								0
 	);
+	generation++;
 }
 
 
-const Mat4 s_cube_xforms[6] = {
-	Mat4::axial_rotation(_x, _z, TAU / 4),		//+X
-	Mat4::axial_rotation(_z, _x, TAU / 4),		//-X
-	Mat4::axial_rotation(_y, _z, TAU / 4),		//+Y
-	Mat4::axial_rotation(_z, _y, TAU / 4),		//-Y
-	Mat4::identity(),							//+Z
-	Mat4::axial_rotation(_z, _x, TAU / 2)		//-Z
+constexpr Mat4f s_cube_xforms[6] = {
+	Mat4f::axial_rotation(_x, _z, TAU / 4),		//+X
+	Mat4f::axial_rotation(_z, _x, TAU / 4),		//-X
+	Mat4f::axial_rotation(_y, _z, TAU / 4),		//+Y
+	Mat4f::axial_rotation(_z, _y, TAU / 4),		//-Y
+	Mat4f::identity(),							//+Z
+	Mat4f::axial_rotation(_z, _x, TAU / 2)		//-Z
 };
+
+unsigned cube_faces_touched(const Vec4& center, double radius)
+{
+	const unsigned all_faces = (1u << 6) - 1;
+	double dist = acos(std::min(std::max(center.w, -1.0), 1.0));
+	if(radius >= dist || radius >= TAU / 2 - dist)
+		return all_faces;		//The camera or its antipode is inside the cap.
+	double sin_half_angle = sin(radius) / sin(dist);
+	Vec4 direction = Vec4(center.x, center.y, center.z, 0).normalize();
+
+	unsigned faces = 0;
+	for(int face = 0; face < 6; face++)
+	{
+		Vec4 right(s_cube_xforms[face].get_row(_x)), down(s_cube_xforms[face].get_row(_y)), fwd(s_cube_xforms[face].get_row(_z));
+		Vec4 planes[4] = {fwd + right, fwd - right, fwd + down, fwd - down};
+		for(double image = 1; image >= -1; image -= 2)
+		{
+			bool touched = true;
+			for(auto& plane : planes)
+				touched = touched && image * (plane * direction) >= -sin_half_angle * plane.mag();
+			if(touched)
+				faces |= 1u << face;
+		}
+	}
+	return faces;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Vector.h"
+#include "Rotor.h"
 
 /*
 	How does it work?
@@ -17,20 +18,32 @@
 
 	cam_mat stores the matrix of the view point as an object in the world, so its 
 	inverse is what should be used in rendering.
+
+	The camera's orientation is really stored as a Rotor, and mat is rebuilt from it 
+	whenever it changes. So mat is SO(4) to within rounding error no matter how many 
+	times the camera is moved, and its transpose can be used as its inverse.
 */
 
 
 class Camera
 {
 protected:
-	Mat4 mat;
+	Rotor rotor;
+	Mat4 mat;				//Always rotor.to_mat().
 	double aspect_ratio;
-	Mat4 projection;
+	Mat4f projection;		//Only ever goes to the GPU, so it doesn't need to be double.
+	unsigned generation;	//Goes up every time mat or the projection changes, so uploads can be skipped when it hasn't.
 
 public:
 	Camera(const Mat4& mat = Mat4::identity(), double aspect_ratio = 1, double vertical_field_of_view = TAU / 4, double near = 0.001);
 
-	void set_mat(Mat4& new_mat) {mat = new_mat;}
+	void set_mat(const Mat4& new_mat) {set_rotor(Rotor::from_mat(new_mat));}
+	void set_rotor(const Rotor& new_rotor)
+	{
+		rotor = new_rotor;
+		mat = rotor.to_mat();
+		generation++;
+	}
 
 	//Far clipping plane will always be at TAU.
 	void set_perspective(double new_aspect_ratio, double vertical_field_of_view = TAU / 4, double near = 0.001);
@@ -39,8 +52,10 @@ public:
 	void rotate(double pitch, double yaw, double roll);
 
 	const Mat4& get_mat() const {return mat;}
+	const Rotor& get_rotor() const {return rotor;}
 	double get_aspect_ratio() const {return aspect_ratio;}
-	const Mat4& get_proj() const {return projection;}
+	const Mat4f& get_proj() const {return projection;}
+	unsigned get_generation() const {return generation;}
 };
 
 
@@ -50,4 +65,14 @@ extern Camera* s_curcam;
 
 
 //These go in Camera.h so that Main.cpp / S3 don't have to include Light.h / Light.cpp.
-extern const Mat4 s_cube_xforms[6];
+extern const Mat4f s_cube_xforms[6];
+
+/*
+	Bit mask of the cube faces (in s_cube_xforms order) that a cap of radius around center (in 
+	the view space of the camera at the cube's center) could show up in. From the camera, a cap 
+	of radius r at distance d covers a cone of half angle asin(sin(r) / sin(d)) around the 
+	direction to its center, and the far image covers the same cone around the opposite 
+	direction. A face is out if both cones are entirely behind one of the four planes through 
+	the camera and the face's edges. That's conservative near the corners of a face.
+*/
+unsigned cube_faces_touched(const Vec4& center, double radius);
@@ -0,0 +1,286 @@
+#include "FrameGraph.h"
+
+#include "GLState.h"
+#include <algorithm>
+
+
+static bool contains(const std::vector<int>& v, int x)
+{
+	return std::find(v.begin(), v.end(), x) != v.end();
+}
+
+
+FrameGraph::FrameGraph()
+{
+	compiled = false;
+	executed_pass_count = 0;
+	physical_width = physical_height = 0;
+}
+
+FrameResource FrameGraph::import_resource(const char* name)
+{
+	if(compiled)
+		error("Can't add resource %s to a frame graph that has already been compiled.\n", name);
+	//The spec is never looked at for imported resources.
+	resources.push_back({name, false, TextureSpec(GL_TEXTURE_2D, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_NONE), -1, -1, -1, {}});
+	return resources.size() - 1;
+}
+
+FrameResource FrameGraph::create_texture(const char* name, const TextureSpec& spec)
+{
+	if(compiled)
+		error("Can't add resource %s to a frame graph that has already been compiled.\n", name);
+	resources.push_back({name, true, spec, -1, -1, -1, {}});
+	return resources.size() - 1;
+}
+
+FrameNode FrameGraph::add_pass(const char* name, std::vector<FrameResource> reads, std::vector<FrameResource> writes, std::function<void()> execute, Pass* pass)
+{
+	if(compiled)
+		error("Can't add pass %s to a frame graph that has already been compiled.\n", name);
+
+	FrameNode ret = nodes.size();
+	bool writes_transients = false, writes_imports = false;
+	for(auto r : writes)
+	{
+		if(r < 0 || r >= resources.size())
+			error("Pass %s writes a resource that doesn't exist.\n", name);
+		if(resources[r].transient)
+			writes_transients = true;
+		else
+			writes_imports = true;
+		resources[r].writers.push_back(ret);
+	}
+	for(auto r : reads)
+		if(r < 0 || r >= resources.size())
+			error("Pass %s reads a resource that doesn't exist.\n", name);
+	if(writes_transients && (writes_imports || !pass))
+		error("Pass %s writes transients, so it needs a Pass and can't write anything else.\n", name);
+
+	nodes.push_back({name, reads, writes, execute, pass, -1});
+	return ret;
+}
+
+
+void FrameGraph::compile()
+{
+	sort_nodes();
+	framebuffers.assign(nodes.size(), NULL);
+	compiled = true;
+}
+
+/*
+	Kahn's algorithm, always taking the earliest-added node that's ready, so the result is as
+	close to the order the passes were added in as the dependencies allow.
+*/
+void FrameGraph::sort_nodes()
+{
+	std::vector<std::vector<FrameNode>> successors(nodes.size());
+	std::vector<int> in_degree(nodes.size(), 0);
+	auto add_edge = [&](FrameNode from, FrameNode to) {
+		if(from == to || contains(successors[from], to))
+			return;
+		successors[from].push_back(to);
+		in_degree[to]++;
+	};
+
+	for(auto& r : resources)
+	{
+		//Writers of the same resource happen in the order they were added.
+		for(int i = 1; i < r.writers.size(); i++)
+			add_edge(r.writers[i - 1], r.writers[i]);
+	}
+	for(FrameNode n = 0; n < nodes.size(); n++)
+		for(auto r : nodes[n].reads)
+		{
+			const auto& writers = resources[r].writers;
+			if(contains(nodes[n].writes, r))
+			{
+				//Read-modify-write: depends on the writers added before it.
+				for(auto w : writers)
+				{
+					if(w >= n)
+						break;
+					add_edge(w, n);
+				}
+			}
+			else
+			{
+				for(auto w : writers)
+					add_edge(w, n);
+			}
+		}
+
+	order.clear();
+	std::vector<bool> done(nodes.size(), false);
+	while(order.size() < nodes.size())
+	{
+		FrameNode next = -1;
+		for(FrameNode n = 0; n < nodes.size(); n++)
+			if(!done[n] && !in_degree[n])
+			{
+				next = n;
+				break;
+			}
+		if(next < 0)
+			error("Frame graph has a cycle.\n");
+
+		done[next] = true;
+		nodes[next].position = order.size();
+		order.push_back(next);
+		for(auto s : successors[next])
+			in_degree[s]--;
+	}
+}
+
+/*
+	Greedy interval packing over the passes in needed: each transient goes in the first
+	compatible physical texture that's free by the time it's first written.
+*/
+void FrameGraph::assign_transients()
+{
+	for(auto& res : resources)
+		res.physical = res.first_use = res.last_use = -1;
+
+	for(int position = 0; position < order.size(); position++)
+	{
+		if(!needed[order[position]])
+			continue;
+		const Node& node = nodes[order[position]];
+		for(auto r : node.reads)
+		{
+			Resource& res = resources[r];
+			if(res.first_use < 0 && res.transient)
+				error("Pass %s reads transient %s before anything writes it.\n", node.name, res.name);
+			if(res.first_use < 0)
+				res.first_use = position;
+			res.last_use = position;
+		}
+		for(auto r : node.writes)
+		{
+			Resource& res = resources[r];
+			if(res.first_use < 0)
+				res.first_use = position;
+			res.last_use = position;
+		}
+	}
+
+	std::vector<FrameResource> transients;
+	for(FrameResource r = 0; r < resources.size(); r++)
+		if(resources[r].transient && resources[r].first_use >= 0)
+			transients.push_back(r);
+	std::stable_sort(transients.begin(), transients.end(), [this](FrameResource a, FrameResource b) {
+		return resources[a].first_use < resources[b].first_use;
+	});
+
+	physical_width = window_width;
+	physical_height = window_height;
+
+	std::vector<int> free_after(physical_textures.size(), -1);		//last use of the most recent occupant of each physical texture
+	for(auto r : transients)
+	{
+		Resource& res = resources[r];
+		for(int p = 0; p < physical_textures.size(); p++)
+			if(free_after[p] < res.first_use && resources[physical_specs[p]].spec.same_texture(res.spec))
+			{
+				res.physical = p;
+				break;
+			}
+		if(res.physical < 0)
+		{
+			res.physical = physical_textures.size();
+			physical_textures.push_back(acquire_render_target(res.spec, window_width, window_height));
+			physical_specs.push_back(r);
+			free_after.push_back(-1);
+		}
+		free_after[res.physical] = res.last_use;
+	}
+
+	//The attachment points never change, so existing framebuffers just get their textures swapped.
+	for(FrameNode n = 0; n < nodes.size(); n++)
+	{
+		if(!needed[n])
+			continue;
+		std::vector<ExtraAttachment> attachments;
+		for(auto r : nodes[n].writes)
+			if(resources[r].transient)
+				attachments.push_back({(GLenum)(GL_COLOR_ATTACHMENT0 + attachments.size()), physical_textures[resources[r].physical]});
+		if(attachments.empty())
+			continue;
+
+		if(framebuffers[n])
+		{
+			state_bind_framebuffer(framebuffers[n]->name);
+			for(auto attachment : attachments)
+				glNamedFramebufferTexture(framebuffers[n]->name, attachment.attachment_point, attachment.tex_name, 0);
+		}
+		else
+		{
+			framebuffers[n] = new Screenbuffer(nodes[n].name, {}, attachments, window_width, window_height);
+			nodes[n].pass->framebuffer = framebuffers[n];
+		}
+	}
+
+	assigned_for = needed;
+}
+
+
+GLuint FrameGraph::get_texture(FrameResource resource) const
+{
+	const Resource& res = resources[resource];
+	if(!res.transient || res.physical < 0)
+		error("Frame graph resource %s doesn't have a texture.\n", res.name);
+	return physical_textures[res.physical];
+}
+
+void FrameGraph::execute(const std::vector<FrameNode>& outputs)
+{
+	if(!compiled)
+		compile();
+
+	/*
+		Walk backward from the outputs, marking every pass before each needed pass that wrote 
+		something it reads. Not just the last one: a pass that only lists a resource in writes 
+		may be blending into it rather than replacing it, so the earlier writes can still show.
+	*/
+	needed.assign(nodes.size(), false);
+	for(auto n : outputs)
+		needed[n] = true;
+	for(int position = order.size() - 1; position >= 0; position--)
+	{
+		const Node& node = nodes[order[position]];
+		if(!needed[order[position]])
+			continue;
+		for(auto r : node.reads)
+			for(auto w : resources[r].writers)
+				if(nodes[w].position < position)
+					needed[w] = true;
+	}
+
+	if(needed != assigned_for)
+		assign_transients();
+
+	executed_pass_count = 0;
+	for(auto n : order)
+		if(needed[n])
+		{
+			nodes[n].execute();
+			executed_pass_count++;
+		}
+}
+
+
+void FrameGraph::resize()
+{
+	for(int p = 0; p < physical_textures.size(); p++)
+	{
+		const TextureSpec& spec = resources[physical_specs[p]].spec;
+		release_render_target(spec, physical_width, physical_height, physical_textures[p]);
+		physical_textures[p] = acquire_render_target(spec, window_width, window_height);
+	}
+	physical_width = window_width;
+	physical_height = window_height;
+
+	//Make the next execute() attach the new textures.
+	assigned_for.clear();
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "Framebuffer.h"
+#include <functional>
+#include <vector>
+
+
+/*
+	A frame graph: every pass says which resources it reads and which it writes, and the graph
+	works out the rest.
+
+	- Order comes from the data, not from the order the passes were added in. A pass that only
+	  reads a resource runs after every pass that writes it. Passes that write the same resource
+	  (e.g. the lights accumulating into the A-buffer) run in the order they were added, and a
+	  pass that reads and writes a resource sees the writes added before it.
+	- execute() only runs the passes that the requested outputs actually depend on, so disabled
+	  effects and debug views just don't get asked for. A pass depends on every writer of what
+	  it reads that runs before it, not just the last one, because the graph can't tell a pass
+	  that replaces a resource from one that blends into it. So "Clear A-Buffer" is kept even if
+	  a later pass writes the A-buffer without listing it in reads.
+	- Transient textures (create_texture()) are owned by the graph. Transients whose lifetimes
+	  don't overlap among the passes that actually run share the same physical texture. The
+	  sharing is redone whenever the set of passes changes (e.g. toggling a debug view), and
+	  the pool of physical textures only grows to the most any set of passes has needed.
+
+	Imported resources (shadow maps, the G-buffer, the default framebuffer...) are just names
+	for ordering; the graph doesn't own them.
+*/
+
+
+typedef int FrameResource;
+typedef int FrameNode;
+
+
+class FrameGraph
+{
+public:
+	FrameGraph();
+
+	FrameResource import_resource(const char* name);
+	//A screen-sized texture owned by the graph. spec.attachment_point is ignored.
+	FrameResource create_texture(const char* name, const TextureSpec& spec);
+
+	/*
+		If the pass writes any transients, pass must not be NULL, it must not write anything
+		else, and the graph gives pass a framebuffer with the transients attached as color
+		attachments 0, 1, ... in the order they're listed in writes.
+	*/
+	FrameNode add_pass(
+		const char* name,
+		std::vector<FrameResource> reads,
+		std::vector<FrameResource> writes,
+		std::function<void()> execute,
+		Pass* pass = NULL
+	);
+
+	void compile();		//Called by execute() if necessary. No passes or resources can be added after this.
+	void execute(const std::vector<FrameNode>& outputs);
+
+	GLuint get_texture(FrameResource resource) const;		//Only valid for transients used by the passes being executed.
+	int get_physical_texture_count() const {return physical_textures.size();}
+	int get_executed_pass_count() const {return executed_pass_count;}
+
+	void resize();		//Call when apply_pending_resize() returns true.
+
+private:
+	struct Resource
+	{
+		const char* name;
+		bool transient;
+		TextureSpec spec;
+		int physical;					//index into physical_textures, or -1
+		int first_use, last_use;		//positions in order
+		std::vector<FrameNode> writers;	//in the order they were added
+	};
+
+	struct Node
+	{
+		const char* name;
+		std::vector<FrameResource> reads, writes;
+		std::function<void()> execute;
+		Pass* pass;
+		int position;					//in order
+	};
+
+	std::vector<Resource> resources;
+	std::vector<Node> nodes;
+	std::vector<FrameNode> order;
+	std::vector<GLuint> physical_textures;		//all physical_width x physical_height, from the render target pool
+	GLsizei physical_width, physical_height;
+	std::vector<FrameResource> physical_specs;		//A resource whose spec each physical texture was made from.
+	std::vector<Screenbuffer*> framebuffers;		//one per node, NULL if it doesn't write transients or hasn't run yet
+	std::vector<bool> needed, assigned_for;
+	bool compiled;
+	int executed_pass_count;
+
+	void sort_nodes();
+	void assign_transients();
+};
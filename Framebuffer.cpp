@@ -2,10 +2,13 @@
 
 #include "Vector.h"
 #include "Utils.h"
+#include "GLState.h"
 #include <set>
+#include <algorithm>
 
 
 int window_width = 0, window_height = 0;
+int default_framebuffer_width = 0, default_framebuffer_height = 0;
 
 GLuint fsq_vertex_array = 0;
 
@@ -22,17 +25,42 @@ TextureSpec::TextureSpec(GLenum target, GLenum internal_format, GLenum format, G
 	this->wrap_mode = wrap_mode;
 }
 
-GLuint TextureSpec::make_texture(GLuint framebuffer, GLsizei width, GLsizei height)
+GLuint TextureSpec::make_texture(GLuint framebuffer, GLsizei width, GLsizei height) const
+{
+	GLuint ret = acquire_render_target(*this, width, height);
+
+	//framebuffer has to be bound as GL_FRAMEBUFFER, or glNamedFramebufferTexture() doesn't work (?!)
+	state_bind_framebuffer(framebuffer);
+	glNamedFramebufferTexture(framebuffer, attachment_point, ret, 0);
+
+	check_gl_errors("TextureSpec::make_texture() 3");
+
+	return ret;
+}
+
+GLuint TextureSpec::create_texture(GLsizei width, GLsizei height) const
 {
 	check_gl_errors("TextureSpec::make_texture() 0");
 
 	GLuint ret;
 	glGenTextures(1, &ret);
-	tex_image(ret, width, height, NULL);
+	state_bind_texture(target, ret);
+	switch(target)
+	{
+		case GL_TEXTURE_1D:
+			glTexStorage1D(target, 1, internal_format, width);
+			break;
+		case GL_TEXTURE_2D:
+		case GL_TEXTURE_CUBE_MAP:		//glTexStorage2D() does all six faces.
+			glTexStorage2D(target, 1, internal_format, width, height);
+			break;
+		default:
+			error("Framebuffer textures of type %d are not implemented.", target);
+			break;
+	}
 	
 	check_gl_errors("TextureSpec::make_texture() 1");
 
-	glBindTexture(target, ret);
 	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, min_filter);
 	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, mag_filter);
 	glTexParameteri(target, GL_TEXTURE_WRAP_S, wrap_mode);
@@ -43,43 +71,65 @@ GLuint TextureSpec::make_texture(GLuint framebuffer, GLsizei width, GLsizei heig
 
 	check_gl_errors("TextureSpec::make_texture() 2");
 
-	//framebuffer has to be bound as GL_FRAMEBUFFER, or glNamedFramebufferTexture() doesn't work (?!)
-	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-	glNamedFramebufferTexture(framebuffer, attachment_point, ret, 0);
+	return ret;
+}
 
-	check_gl_errors("TextureSpec::make_texture() 3");
+bool TextureSpec::same_texture(const TextureSpec& other) const
+{
+	return target == other.target
+		&& internal_format == other.internal_format
+		&& format == other.format
+		&& type == other.type
+		&& min_filter == other.min_filter
+		&& mag_filter == other.mag_filter
+		&& wrap_mode == other.wrap_mode;
+}
 
-	return ret;
+
+struct PooledTarget
+{
+	TextureSpec spec;
+	GLsizei width, height;
+	GLuint tex_name;
+};
+
+static std::vector<PooledTarget> free_targets;
+static std::vector<std::pair<GLsizei, GLsizei>> recent_sizes;		//most recent first
+
+GLuint acquire_render_target(const TextureSpec& spec, GLsizei width, GLsizei height)
+{
+	for(int i = 0; i < free_targets.size(); i++)
+	{
+		const PooledTarget& pt = free_targets[i];
+		if(pt.width == width && pt.height == height && pt.spec.same_texture(spec))
+		{
+			GLuint ret = pt.tex_name;
+			free_targets.erase(free_targets.begin() + i);
+			return ret;
+		}
+	}
+	return spec.create_texture(width, height);
 }
 
-void TextureSpec::tex_image(GLuint tex_name, GLsizei width, GLsizei height, void* data)
+void release_render_target(const TextureSpec& spec, GLsizei width, GLsizei height, GLuint tex_name)
 {
-	glBindTexture(target, tex_name);
-	switch(target)
+	if(tex_name)
+		free_targets.push_back({spec, width, height, tex_name});
+}
+
+static void trim_render_target_pool()
+{
+	for(int i = 0; i < free_targets.size();)
 	{
-		case GL_TEXTURE_1D:
-			glTexImage1D(target, 0, internal_format, width, 0, format, type, data);
-			break;
-		case GL_TEXTURE_2D:
-			glTexImage2D(target, 0, internal_format, width, height, 0, format, type, data);
-			break;
-		case GL_TEXTURE_CUBE_MAP:
-			for(int face = 0; face < 6; face++)
-				glTexImage2D(
-					GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
-					0,
-					internal_format,
-					width,
-					height,
-					0,
-					format,
-					type,
-					data
-				);
-			break;
-		default:
-			error("Framebuffer textures of type %d are not implemented.", target);
-			break;
+		std::pair<GLsizei, GLsizei> size(free_targets[i].width, free_targets[i].height);
+		if(std::find(recent_sizes.begin(), recent_sizes.end(), size) == recent_sizes.end())
+		{
+			glDeleteTextures(1, &free_targets[i].tex_name);
+			state_forget_texture(free_targets[i].tex_name);
+			free_targets.erase(free_targets.begin() + i);
+		}
+		else
+			i++;
 	}
 }
 
@@ -92,11 +142,12 @@ Framebuffer::Framebuffer(const char* display_name, std::vector<TextureSpec> text
 	this->display_name = display_name;
 
 	this->texture_specs = texture_specs;
+	this->extra_attachments = extra_attachments;
 
 	check_gl_errors("Framebuffer::Framebuffer() 0");
 
 	glGenFramebuffers(1, &name);
-	glBindFramebuffer(GL_FRAMEBUFFER, name);
+	state_bind_framebuffer(name);
 
 	check_gl_errors("Framebuffer::Framebuffer() 1");
 
@@ -105,7 +156,8 @@ Framebuffer::Framebuffer(const char* display_name, std::vector<TextureSpec> text
 
 	for(auto& spec : texture_specs)
 	{
-		textures.push_back(spec.make_texture(name, width, height));
+		//Screenbuffers start out with no size, so their textures are made in the first post_resize().
+		textures.push_back(width && height ? spec.make_texture(name, width, height) : 0);
 		int color_number = spec.attachment_point - GL_COLOR_ATTACHMENT0;
 		if(color_number >= 0 && color_number <= 15)
 		{
@@ -115,6 +167,17 @@ Framebuffer::Framebuffer(const char* display_name, std::vector<TextureSpec> text
 		}
 	}
 
+	for(auto extra : extra_attachments)
+	{
+		int color_number = extra.attachment_point - GL_COLOR_ATTACHMENT0;
+		if(color_number >= 0 && color_number <= 15)
+		{
+			if(color_number > max_color)
+				max_color = color_number;
+			color_attachments.insert(extra.attachment_point);
+		}
+	}
+
 	check_gl_errors("Framebuffer::Framebuffer() 2");
 
 	if(color_attachments.size())
@@ -142,7 +205,7 @@ Framebuffer::Framebuffer(const char* display_name, std::vector<TextureSpec> text
 		glDrawBuffers(0, NULL);
 
 	for(auto extra : extra_attachments)
-		glNamedFramebufferTexture(name, extra.attachment_point, extra.tex_name, 0);
+		glNamedFramebufferTexture(name, extra.attachment_point, extra.source ? extra.source->textures[extra.source_index] : extra.tex_name, 0);
 
 	check_gl_errors("Framebuffer::Framebuffer() 3");
 
@@ -151,7 +214,7 @@ Framebuffer::Framebuffer(const char* display_name, std::vector<TextureSpec> text
 		with zero-size textures. Wait until they're resized.
 	*/
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	state_bind_framebuffer(0);
 }
 
 void Framebuffer::check_status() const
@@ -161,10 +224,10 @@ void Framebuffer::check_status() const
 		the named framebuffer is currently bound as GL_FRAMEBUFFER. In other words, 
 		glCheckNamedFramebufferStatus() doesn't work, I guess.
 	*/
-	glBindFramebuffer(GL_FRAMEBUFFER, name);
+	state_bind_framebuffer(name);
 	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 		error("%s %d status is 0x%X\n", display_name, name, glCheckFramebufferStatus(GL_FRAMEBUFFER));
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	state_bind_framebuffer(0);
 }
 
 
@@ -176,11 +239,24 @@ Screenbuffer::Screenbuffer(const char* display_name, std::vector<TextureSpec> te
 
 void Screenbuffer::post_resize()
 {
-	width = window_width;
-	height = window_height;
+	if(width == window_width && height == window_height && (textures.empty() || textures[0]))
+		return;
 
+	state_bind_framebuffer(name);
 	for(int i = 0; i < texture_specs.size(); i++)
-		texture_specs[i].tex_image(textures[i], window_width, window_height);
+	{
+		release_render_target(texture_specs[i], width, height, textures[i]);
+		textures[i] = acquire_render_target(texture_specs[i], window_width, window_height);
+		glNamedFramebufferTexture(name, texture_specs[i].attachment_point, textures[i], 0);
+	}
+
+	//Plain extra attachments belong to whoever passed them in. Only the ones borrowed from another Framebuffer are followed here.
+	for(auto extra : extra_attachments)
+		if(extra.source)
+			glNamedFramebufferTexture(name, extra.attachment_point, extra.source->textures[extra.source_index], 0);
+
+	width = window_width;
+	height = window_height;
 }
 
 void Screenbuffer::post_resize_all()
@@ -209,6 +285,7 @@ Pass::Pass(Framebuffer* fb, Pass* copy)
 		blend = copy->blend;
 		cull_face = copy->cull_face;
 		is_shadow_pass = copy->is_shadow_pass;
+		clip_distances = copy->clip_distances;
 	}
 	else
 	{
@@ -217,6 +294,7 @@ Pass::Pass(Framebuffer* fb, Pass* copy)
 		blend = false;
 		cull_face = GL_BACK;
 		is_shadow_pass = false;
+		clip_distances = 0;
 	}
 }
 
@@ -224,24 +302,22 @@ void Pass::start() const
 {
 	if(framebuffer)
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer->name);
-		glViewport(0, 0, framebuffer->width, framebuffer->height);
+		state_bind_framebuffer(framebuffer->name);
+		state_viewport(0, 0, framebuffer->width, framebuffer->height);
 	}
 	else
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glViewport(0, 0, window_width, window_height);
+		state_bind_framebuffer(0);
+		state_viewport(0, 0, default_framebuffer_width, default_framebuffer_height);
 	}
-	depth_test ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST);
-	glDepthMask(depth_mask ? GL_TRUE : GL_FALSE);
+	state_enable(GL_DEPTH_TEST, depth_test);
+	state_depth_mask(depth_mask);
+	state_enable(GL_CULL_FACE, cull_face != 0);
 	if(cull_face)
-	{
-		glEnable(GL_CULL_FACE);
-		glCullFace(cull_face);
-	}
-	else
-		glDisable(GL_CULL_FACE);
-	blend ? glEnable(GL_BLEND) : glDisable(GL_BLEND);
+		state_cull_face(cull_face);
+	state_enable(GL_BLEND, blend);
+	for(int i = 0; i < MAX_PASS_CLIP_DISTANCES; i++)
+		state_enable(GL_CLIP_DISTANCE0 + i, i < clip_distances);
 
 	//glClear has to be called at the end because glDepthMask() affects clearing.
 	if(clear_mask)
@@ -252,7 +328,7 @@ void Pass::start() const
 
 void init_framebuffers()
 {
-	Vec4 fsq_vertices[4 * 7] = {
+	Vec4f fsq_vertices[4 * 7] = {
 		//full-screen quad
 		{1, 1, 0, 1},
 		{-1, 1, 0, 1},
@@ -309,14 +385,14 @@ void init_framebuffers()
 	}
 
 	glGenVertexArrays(1, &fsq_vertex_array);
-	glBindVertexArray(fsq_vertex_array);
+	state_bind_vertex_array(fsq_vertex_array);
 
 	GLuint fsq_vertex_buffer;
 	glGenBuffers(1, &fsq_vertex_buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, fsq_vertex_buffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(fsq_vertices), fsq_vertices, GL_STATIC_DRAW);
 
-	glVertexAttribPointer(0, 4, GL_DOUBLE, GL_FALSE, sizeof(Vec4), (void*)0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Vec4f), (void*)0);
 	glEnableVertexAttribArray(0);
 
 	GLuint fsq_tex_coord_buffer;
@@ -327,14 +403,13 @@ void init_framebuffers()
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(1);
 
-	glBindVertexArray(0);
+	state_bind_vertex_array(0);
 
 	s_gbuffer = new Screenbuffer(
 		"G-Buffer",
 		{
-			{GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT0},
-			{GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT1},
-			{GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT2},
+			{GL_TEXTURE_2D, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT0},
+			{GL_TEXTURE_2D, GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, GL_COLOR_ATTACHMENT1},
 			{GL_TEXTURE_2D, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, GL_DEPTH_ATTACHMENT}
 		},
 		{}
@@ -342,32 +417,62 @@ void init_framebuffers()
 }
 
 
-void resize_screenbuffers(int w, int h)
+static bool resize_pending = false;
+static double resize_request_time;
+
+void request_resize(int w, int h)
+{
+	//A minimized window reports 0 x 0, which isn't a legal texture size. Keep the old size until it comes back.
+	if(w <= 0 || h <= 0)
+		return;
+	default_framebuffer_width = w;
+	default_framebuffer_height = h;
+	resize_pending = true;
+	resize_request_time = current_time();
+}
+
+bool apply_pending_resize()
 {
-	window_width = w;
-	window_height = h;
+	if(!resize_pending)
+		return false;
+	//Nothing has been rendered yet, so there's nothing to stretch in the meantime.
+	if(window_width && current_time() - resize_request_time < RESIZE_DEBOUNCE_TIME)
+		return false;
+	resize_pending = false;
+	if(window_width == default_framebuffer_width && window_height == default_framebuffer_height)
+		return false;
+
+	window_width = default_framebuffer_width;
+	window_height = default_framebuffer_height;
+
+	std::pair<GLsizei, GLsizei> size(window_width, window_height);
+	auto it = std::find(recent_sizes.begin(), recent_sizes.end(), size);
+	if(it != recent_sizes.end())
+		recent_sizes.erase(it);
+	recent_sizes.insert(recent_sizes.begin(), size);
+	if(recent_sizes.size() > MAX_POOLED_SIZES)
+		recent_sizes.resize(MAX_POOLED_SIZES);
 
 	Screenbuffer::post_resize_all();
+	trim_render_target_pool();
+	return true;
 }
 
 
 void draw_fsq()
 {
-	glBindVertexArray(fsq_vertex_array);
+	state_bind_vertex_array(fsq_vertex_array);
 	glDrawArrays(GL_QUADS, 0, 4);
-	glBindVertexArray(0);
 }
 
 void draw_hsq(int i)
 {
-	glBindVertexArray(fsq_vertex_array);
+	state_bind_vertex_array(fsq_vertex_array);
 	glDrawArrays(GL_QUADS, 4 + 4 * i, 4);
-	glBindVertexArray(0);
 }
 
 void draw_qsq(int i)
 {
-	glBindVertexArray(fsq_vertex_array);
+	state_bind_vertex_array(fsq_vertex_array);
 	glDrawArrays(GL_QUADS, 12 + 4 * i, 4);
-	glBindVertexArray(0);
 }
@@ -7,7 +7,14 @@
 #pragma warning(disable : 4244)		//conversion from double to float
 
 
+/*
+	window_width and window_height are the size the Screenbuffers are rendered at. They only 
+	change once a resize has settled (see request_resize()), so in the middle of dragging a 
+	window corner, the default framebuffer (default_framebuffer_width x default_framebuffer_height) 
+	can be a different size, and the final pass just stretches the picture to fit.
+*/
 extern int window_width, window_height;
+extern int default_framebuffer_width, default_framebuffer_height;
 
 
 struct TextureSpec
@@ -25,16 +32,38 @@ struct TextureSpec
 		GLenum wrap_mode = GL_CLAMP_TO_EDGE
 	);
 
-	GLuint make_texture(GLuint framebuffer, GLsizei width, GLsizei height);
-	
-	//There really isn't a good name for this, 'cuz all it does is call glTexImage*(), and that's not a good name.
-	void tex_image(GLuint tex_name, GLsizei width, GLsizei height, void* data = NULL);
+	GLuint make_texture(GLuint framebuffer, GLsizei width, GLsizei height) const;		//From the render target pool.
+	/*
+		Just the texture, not attached to anything. The storage is immutable (glTexStorage*()), 
+		so a texture can't be resized, only swapped for another one from the render target pool.
+	*/
+	GLuint create_texture(GLsizei width, GLsizei height) const;
+	bool same_texture(const TextureSpec& other) const;		//Everything but the attachment point matches.
 };
 
+
+/*
+	Render targets that aren't in use any more (e.g. the old-sized textures after a resize) 
+	go back into the pool instead of being deleted. acquire_render_target() hands them out 
+	again if the spec and size match, so resizing back to a recent size, or one Screenbuffer 
+	giving up a texture that another one wants, doesn't allocate anything. Free targets of 
+	sizes that haven't been used for the last MAX_POOLED_SIZES resizes are deleted.
+*/
+#define MAX_POOLED_SIZES		4
+
+GLuint acquire_render_target(const TextureSpec& spec, GLsizei width, GLsizei height);
+void release_render_target(const TextureSpec& spec, GLsizei width, GLsizei height, GLuint tex_name);
+
+
+struct Framebuffer;
+
 struct ExtraAttachment
 {
 	GLenum attachment_point;
 	GLuint tex_name;
+	//If source isn't NULL, tex_name is ignored and source->textures[source_index] is attached (again every time source is resized).
+	Framebuffer* source = NULL;
+	int source_index = 0;
 };
 
 
@@ -45,8 +74,9 @@ struct Framebuffer
 
 	const char* display_name;
 
-	std::vector<GLuint> textures;
+	std::vector<GLuint> textures;		//0 until there's a nonzero size
 	std::vector<TextureSpec> texture_specs;
+	std::vector<ExtraAttachment> extra_attachments;
 
 	Framebuffer(
 		const char* display_name,
@@ -74,11 +104,14 @@ struct Screenbuffer : public Framebuffer
 };
 
 extern Screenbuffer* s_gbuffer;
+//12 bytes per pixel. Positions come from depth, see gbuffer_glsl in Shaders.cpp.
 #define s_gbuffer_albedo (s_gbuffer->textures[0])
-#define s_gbuffer_position (s_gbuffer->textures[1])
-#define s_gbuffer_normal (s_gbuffer->textures[2])
-#define s_gbuffer_depth (s_gbuffer->textures[3])
+#define s_gbuffer_normal (s_gbuffer->textures[1])
+#define s_gbuffer_depth (s_gbuffer->textures[2])
+#define S_GBUFFER_DEPTH_INDEX (2)
+
 
+#define MAX_PASS_CLIP_DISTANCES	(3)		//Only octahedral shadow passes use them so far, one per octant plane.
 
 struct Pass
 {
@@ -90,6 +123,7 @@ struct Pass
 	//So far, the only blending we need is GL_FUNC_ADD, GL_ONE, GL_ONE, so we just need a bool:
 	bool blend;						//default false
 	bool is_shadow_pass;			//default false
+	int clip_distances;				//How many of GL_CLIP_DISTANCEi to enable. Default 0
 
 	Pass(Framebuffer* fb, Pass* copy = NULL);		//If copy is NULL, set the defaults above.
 	void start() const;
@@ -99,7 +133,19 @@ struct Pass
 
 
 void init_framebuffers();
-void resize_screenbuffers(int w, int h);
+
+/*
+	Call request_resize() from the reshape callback and apply_pending_resize() at the start of 
+	every frame. The Screenbuffers are only resized once the window size has stopped changing 
+	for RESIZE_DEBOUNCE_TIME seconds (or right away the first time), and a 0 x 0 size from 
+	minimizing the window is ignored. apply_pending_resize() 
+	returns true on the frame they were resized, so the caller can redo anything that depends 
+	on the size (the camera's aspect ratio, ShaderProgram::init_all()...).
+*/
+#define RESIZE_DEBOUNCE_TIME		0.2
+
+void request_resize(int w, int h);
+bool apply_pending_resize();
 inline bool s_is_shadow_pass() {return Pass::current->is_shadow_pass;}
 
 
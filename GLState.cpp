@@ -0,0 +1,196 @@
+#include "GLState.h"
+
+#include <string.h>
+
+
+#define MAX_TRACKED_TEXTURE_UNITS	(32)
+#define NUM_TRACKED_TEXTURE_TARGETS	(6)
+#define NUM_TRACKED_CLIP_DISTANCES	(8)			//The minimum GL_MAX_CLIP_DISTANCES.
+#define UNKNOWN						(0xFFFFFFFF)		//Not a value any of the tracked state can actually have.
+
+
+static struct
+{
+	GLuint framebuffer;
+	GLint viewport[4];
+	GLuint depth_test, cull_face_enabled, blend;
+	GLuint clip_distances[NUM_TRACKED_CLIP_DISTANCES];
+	GLuint depth_mask;
+	GLenum cull_face;
+	GLuint program;
+	GLuint vertex_array;
+	GLuint active_unit;
+	GLuint textures[MAX_TRACKED_TEXTURE_UNITS][NUM_TRACKED_TEXTURE_TARGETS];
+} cache;
+
+static StateStats stats = {0, 0};
+
+static bool initialized = false;
+
+
+void state_invalidate()
+{
+	memset(&cache, 0xFF, sizeof(cache));		//Everything UNKNOWN.
+	initialized = true;
+}
+
+//Returns true if the call has to go to GL, and remembers the new value.
+template<typename T>
+static inline bool changed(T& cached, T value)
+{
+	if(!initialized)
+		state_invalidate();
+	if(cached == value)
+	{
+		stats.elided++;
+		return false;
+	}
+	cached = value;
+	stats.issued++;
+	return true;
+}
+
+
+void state_bind_framebuffer(GLuint framebuffer)
+{
+	if(changed(cache.framebuffer, framebuffer))
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void state_viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	if(!initialized)
+		state_invalidate();
+	if(cache.viewport[0] == x && cache.viewport[1] == y && cache.viewport[2] == width && cache.viewport[3] == height)
+	{
+		stats.elided++;
+		return;
+	}
+	cache.viewport[0] = x;
+	cache.viewport[1] = y;
+	cache.viewport[2] = width;
+	cache.viewport[3] = height;
+	stats.issued++;
+	glViewport(x, y, width, height);
+}
+
+void state_enable(GLenum capability, bool enabled)
+{
+	GLuint* cached;
+	switch(capability)
+	{
+		case GL_DEPTH_TEST:
+			cached = &cache.depth_test;
+			break;
+		case GL_CULL_FACE:
+			cached = &cache.cull_face_enabled;
+			break;
+		case GL_BLEND:
+			cached = &cache.blend;
+			break;
+		default:
+			if(capability >= GL_CLIP_DISTANCE0 && capability < GL_CLIP_DISTANCE0 + NUM_TRACKED_CLIP_DISTANCES)
+			{
+				cached = &cache.clip_distances[capability - GL_CLIP_DISTANCE0];
+				break;
+			}
+			enabled ? glEnable(capability) : glDisable(capability);
+			return;
+	}
+	if(changed(*cached, (GLuint)enabled))
+		enabled ? glEnable(capability) : glDisable(capability);
+}
+
+void state_depth_mask(bool mask)
+{
+	if(changed(cache.depth_mask, (GLuint)mask))
+		glDepthMask(mask ? GL_TRUE : GL_FALSE);
+}
+
+void state_cull_face(GLenum face)
+{
+	if(changed(cache.cull_face, face))
+		glCullFace(face);
+}
+
+void state_use_program(GLuint program)
+{
+	if(changed(cache.program, program))
+		glUseProgram(program);
+}
+
+void state_bind_vertex_array(GLuint vertex_array)
+{
+	if(changed(cache.vertex_array, vertex_array))
+		glBindVertexArray(vertex_array);
+}
+
+//-1 for targets that aren't tracked.
+static int texture_target_index(GLenum target)
+{
+	switch(target)
+	{
+		case GL_TEXTURE_1D:
+			return 0;
+		case GL_TEXTURE_2D:
+			return 1;
+		case GL_TEXTURE_CUBE_MAP:
+			return 2;
+		case GL_TEXTURE_3D:
+			return 3;
+		case GL_TEXTURE_CUBE_MAP_ARRAY:
+			return 4;
+		case GL_TEXTURE_2D_ARRAY:
+			return 5;
+		default:
+			return -1;
+	}
+}
+
+void state_bind_texture(int unit, GLenum target, GLuint texture)
+{
+	int target_index = texture_target_index(target);
+	if(unit < MAX_TRACKED_TEXTURE_UNITS && target_index >= 0 && !changed(cache.textures[unit][target_index], texture))
+		return;
+	if(changed(cache.active_unit, (GLuint)unit))
+		glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(target, texture);
+}
+
+void state_bind_texture(GLenum target, GLuint texture)
+{
+	if(!initialized)
+		state_invalidate();
+	if(cache.active_unit == UNKNOWN)
+		state_bind_texture(0, target, texture);
+	else
+		state_bind_texture(cache.active_unit, target, texture);
+}
+
+
+void state_forget_texture(GLuint texture)
+{
+	if(!initialized || !texture)
+		return;
+	for(int unit = 0; unit < MAX_TRACKED_TEXTURE_UNITS; unit++)
+		for(int target_index = 0; target_index < NUM_TRACKED_TEXTURE_TARGETS; target_index++)
+			if(cache.textures[unit][target_index] == texture)
+				cache.textures[unit][target_index] = 0;
+}
+
+void state_forget_vertex_array(GLuint vertex_array)
+{
+	if(initialized && vertex_array && cache.vertex_array == vertex_array)
+		cache.vertex_array = 0;
+}
+
+
+StateStats state_frame_stats()
+{
+	return stats;
+}
+
+void state_new_frame()
+{
+	stats.issued = stats.elided = 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "GL/glew.h"
+
+
+/*
+	Bindings and switches that get set over and over every frame go through these instead of straight 
+	to GL. Each one remembers what GL currently has and skips the call if nothing would change. That 
+	only works if nothing changes the same state behind its back, so everything that binds framebuffers, 
+	programs, VAOs or textures, or sets the viewport, depth test, depth mask, face culling or blending 
+	should use these. If something has to go around them, call state_invalidate() afterwards.
+
+	Deleting a texture or VAO unbinds it in GL, and its name can come back from the next glCreate*(), 
+	so every delete has to be followed by the matching state_forget_*(), or a later bind of the 
+	recycled name would be skipped.
+
+	The cache starts out knowing nothing, so the first call for each piece of state always goes to GL.
+*/
+
+void state_bind_framebuffer(GLuint framebuffer);		//as GL_FRAMEBUFFER
+void state_viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+void state_enable(GLenum capability, bool enabled);	//GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND and the first few GL_CLIP_DISTANCEi are tracked. Anything else goes straight through.
+void state_depth_mask(bool mask);
+void state_cull_face(GLenum face);
+void state_use_program(GLuint program);
+void state_bind_vertex_array(GLuint vertex_array);
+void state_bind_texture(int unit, GLenum target, GLuint texture);
+void state_bind_texture(GLenum target, GLuint texture);		//on whatever unit is active, e.g. to set up a new texture
+
+void state_invalidate();
+//Call after glDeleteTextures() / glDeleteVertexArrays(). Whatever had it bound now has 0, same as GL.
+void state_forget_texture(GLuint texture);
+void state_forget_vertex_array(GLuint vertex_array);
+
+struct StateStats
+{
+	int issued, elided;
+};
+//Counts since the last state_new_frame().
+StateStats state_frame_stats();
+void state_new_frame();
@@ -2,34 +2,409 @@
 
 #include "Utils.h"
 #include "TorusWorldShaders.h"
+#include "RenderQueue.h"
+#include "GLState.h"
 
-
-#define SHADOW_MAP_SIZE	(4096)
+#include <algorithm>
 
 
 double s_fog_density = 0.1;
 Vec3 s_fog_color(1, 1, 1);
 
+bool s_shadow_map_16_bit = true;
+bool s_octahedral_shadows = false;
+
+
+static GLuint shadow_tier_arrays[NUM_SHADOW_TIERS];
+static int shadow_tier_layers[NUM_SHADOW_TIERS];		//shadow maps, not faces
+static GLenum shadow_map_format = 0;					//that the arrays were made with
+static bool shadow_maps_octahedral = false;				//same
+
+
+bool octahedral_shadow_maps()
+{
+	return shadow_maps_octahedral;
+}
+
+//Width and height of a cube face, or of a whole octahedral map.
+static int shadow_image_size(int tier, bool octahedral)
+{
+	return (octahedral ? 2 : 1) * shadow_tier_size(tier);
+}
+
+static size_t shadow_map_bytes(int tier, GLenum format, bool octahedral)
+{
+	size_t size = shadow_image_size(tier, octahedral);
+	return (octahedral ? 1 : 6) * size * size * (format == GL_DEPTH_COMPONENT16 ? 2 : 4);
+}
+
+/*
+	Set the faces of layer of tier's array to the far plane (nothing in the way). An octahedral 
+	map doesn't have faces, so any faces at all means the whole thing.
+*/
+static void clear_shadow_faces(int tier, int layer, unsigned faces)
+{
+	float far_depth = 1;
+	int size = shadow_image_size(tier, shadow_maps_octahedral);
+	if(shadow_maps_octahedral)
+	{
+		if(faces)
+			glClearTexSubImage(shadow_tier_arrays[tier], 0, 0, 0, layer, size, size, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &far_depth);
+		return;
+	}
+	for(int face = 0; face < 6; face++)
+		if(faces & (1u << face))
+			glClearTexSubImage(shadow_tier_arrays[tier], 0, 0, 0, 6 * layer + face, size, size, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &far_depth);
+}
+
+static void copy_shadow_faces(int tier, int from_layer, int to_layer, unsigned faces)
+{
+	GLuint array = shadow_tier_arrays[tier];
+	int size = shadow_image_size(tier, shadow_maps_octahedral);
+	if(shadow_maps_octahedral)
+	{
+		if(faces)
+			glCopyImageSubData(array, GL_TEXTURE_2D_ARRAY, 0, 0, 0, from_layer, array, GL_TEXTURE_2D_ARRAY, 0, 0, 0, to_layer, size, size, 1);
+		return;
+	}
+	for(int face = 0; face < 6; face++)
+		if(faces & (1u << face))
+			glCopyImageSubData(
+				array, GL_TEXTURE_CUBE_MAP_ARRAY, 0, 0, 0, 6 * from_layer + face,
+				array, GL_TEXTURE_CUBE_MAP_ARRAY, 0, 0, 0, 6 * to_layer + face,
+				size, size, 1
+			);
+}
+
+//Copy a whole shadow map (or static cache) from layer from_layer of one of tier's arrays to to_layer of another.
+static void copy_shadow_map(int tier, GLuint from_array, int from_layer, GLuint to_array, int to_layer)
+{
+	GLenum target = shadow_maps_octahedral ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_CUBE_MAP_ARRAY;
+	int size = shadow_image_size(tier, shadow_maps_octahedral), depth = shadow_maps_octahedral ? 1 : 6;
+	glCopyImageSubData(from_array, target, 0, 0, 0, depth * from_layer, to_array, target, 0, 0, 0, depth * to_layer, size, size, depth);
+}
+
+/*
+	Replace *view with a GL_TEXTURE_CUBE_MAP (or GL_TEXTURE_2D) view of layer of tier's array 
+	(or nothing if layer is -1), and attach it to fb. If clear is set, the layer is cleared, so 
+	until the scheduler gets around to drawing it, it just doesn't cast any shadows.
+*/
+static void make_shadow_map_view(GLuint* view, Framebuffer* fb, int tier, int layer, GLenum format, bool clear)
+{
+	if(*view)
+	{
+		glDeleteTextures(1, view);
+		state_forget_texture(*view);
+	}
+	*view = 0;
+	if(layer >= 0)
+	{
+		glGenTextures(1, view);		//glTextureView() wants a name that has never been bound.
+		if(shadow_maps_octahedral)
+			glTextureView(*view, GL_TEXTURE_2D, shadow_tier_arrays[tier], format, 0, 1, layer, 1);
+		else
+			glTextureView(*view, GL_TEXTURE_CUBE_MAP, shadow_tier_arrays[tier], format, 0, 1, 6 * layer, 6);
+		glTextureParameteri(*view, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(*view, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		if(clear)
+			clear_shadow_faces(tier, layer, ALL_CUBE_FACES);
+	}
+
+	//framebuffer has to be bound as GL_FRAMEBUFFER, or glNamedFramebufferTexture() doesn't work (?!)
+	state_bind_framebuffer(fb->name);
+	glNamedFramebufferTexture(fb->name, GL_DEPTH_ATTACHMENT, *view, 0);
+	fb->extra_attachments.clear();
+	if(*view)
+		fb->extra_attachments.push_back({GL_DEPTH_ATTACHMENT, *view});
+	fb->width = fb->height = layer < 0 ? 0 : shadow_image_size(tier, shadow_maps_octahedral);
+}
+
+/*
+	The octahedral fold turns some triangles over, so octahedral shadow passes can't cull, and 
+	they need the clip distances that keep each copy of a triangle in its own octant.
+*/
+static void set_shadow_pass_mode(Pass* pass, bool octahedral)
+{
+	pass->cull_face = octahedral ? 0 : GL_BACK;
+	pass->clip_distances = octahedral ? MAX_PASS_CLIP_DISTANCES : 0;
+}
+
+/*
+	Each light wants a tier from how important it is compared to the most important light: 
+	half the importance, half the resolution. Then, while the total is over the budget, the 
+	least important light is dropped a tier, all the way to the smallest tier before the next 
+	least important light is touched, and after that the least important lights lose their 
+	shadows entirely.
+
+	A light only leaves its current tier once its importance is SHADOW_TIER_HYSTERESIS past 
+	the tier's range, so a light hovering around a power of two doesn't flip back and forth.
+
+	A light with dynamic shadow casters needs a second layer for its static cache, which 
+	counts against the budget too.
+
+	Changing tiers means a new view and a redraw. Changing how many layers are in a tier, or 
+	which light is in which layer, means reallocating that tier's array. The lights that stay 
+	in a reallocated tier have their shadow maps copied over to the new array, so only the 
+	lights that actually changed tiers go without shadows until the scheduler redraws them. 
+	Nothing is touched unless the tiers actually change.
+*/
+static void assign_shadow_tiers(const std::vector<Light*>& lights)
+{
+	GLenum format = s_shadow_map_16_bit ? GL_DEPTH_COMPONENT16 : GL_DEPTH_COMPONENT32F;
+	bool octahedral = s_octahedral_shadows;
+
+	std::vector<double> importance(lights.size());
+	double top_importance = 0;
+	for(int i = 0; i < lights.size(); i++)
+	{
+		importance[i] = lights[i]->shadow_importance();
+		if(importance[i] < INFINITY)
+			top_importance = std::max(top_importance, importance[i]);
+	}
+
+	auto light_bytes = [&](int i, int tier) {
+		return (lights[i]->has_dynamic_casters ? 2 : 1) * shadow_map_bytes(tier, format, octahedral);
+	};
+
+	std::vector<int> tiers(lights.size());
+	size_t total_bytes = 0;
+	for(int i = 0; i < lights.size(); i++)
+	{
+		if(importance[i] == INFINITY)
+			tiers[i] = 0;
+		else if(importance[i] <= 0)
+			tiers[i] = NUM_SHADOW_TIERS - 1;
+		else
+		{
+			double ideal = log2(top_importance / importance[i]);
+			int current = lights[i]->shadow_tier;
+			if(current >= 0 && ideal > current - SHADOW_TIER_HYSTERESIS && ideal < current + 1 + SHADOW_TIER_HYSTERESIS)
+				tiers[i] = current;
+			else
+				tiers[i] = std::min(std::max((int)floor(ideal), 0), NUM_SHADOW_TIERS - 1);
+		}
+		total_bytes += light_bytes(i, tiers[i]);
+	}
+
+	std::vector<int> order(lights.size());		//least important first
+	for(int i = 0; i < lights.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) {return importance[a] < importance[b];});
+
+	for(int i : order)
+		while(total_bytes > SHADOW_MEMORY_BUDGET && tiers[i] < NUM_SHADOW_TIERS - 1)
+		{
+			total_bytes -= light_bytes(i, tiers[i]) - light_bytes(i, tiers[i] + 1);
+			tiers[i]++;
+		}
+	for(int i : order)
+		if(total_bytes > SHADOW_MEMORY_BUDGET)
+		{
+			total_bytes -= light_bytes(i, tiers[i]);
+			tiers[i] = -1;
+		}
+
+	//Layers in each tier go in the order of lights, each light's static cache right after its shadow map.
+	int layers[NUM_SHADOW_TIERS] = {0};
+	std::vector<int> indices(lights.size()), cache_indices(lights.size());
+	bool new_kind = format != shadow_map_format || octahedral != shadow_maps_octahedral;
+	bool changed = new_kind;
+	for(int i = 0; i < lights.size(); i++)
+	{
+		indices[i] = tiers[i] < 0 ? -1 : layers[tiers[i]]++;
+		cache_indices[i] = tiers[i] < 0 || !lights[i]->has_dynamic_casters ? -1 : layers[tiers[i]]++;
+		changed = changed || tiers[i] != lights[i]->shadow_tier || indices[i] != lights[i]->shadow_index || cache_indices[i] != lights[i]->static_cache_index;
+	}
+	for(int t = 0; t < NUM_SHADOW_TIERS; t++)
+		changed = changed || layers[t] != shadow_tier_layers[t];
+	if(!changed)
+		return;
+
+	check_gl_errors("assign_shadow_tiers() 0");
+
+	//A tier where any light moves to a different layer is reallocated too, so the copies never overlap.
+	bool reallocated[NUM_SHADOW_TIERS];
+	for(int t = 0; t < NUM_SHADOW_TIERS; t++)
+		reallocated[t] = new_kind || layers[t] != shadow_tier_layers[t];
+	for(int i = 0; i < lights.size(); i++)
+		if(tiers[i] >= 0 && (tiers[i] != lights[i]->shadow_tier || indices[i] != lights[i]->shadow_index || cache_indices[i] != lights[i]->static_cache_index))
+			reallocated[tiers[i]] = true;
+
+	GLuint old_arrays[NUM_SHADOW_TIERS];		//deleted once the surviving shadow maps are copied out
+	for(int t = 0; t < NUM_SHADOW_TIERS; t++)
+	{
+		old_arrays[t] = shadow_tier_arrays[t];
+		if(!reallocated[t])
+			continue;
+		shadow_tier_arrays[t] = 0;
+		shadow_tier_layers[t] = layers[t];
+		if(!layers[t])
+			continue;
+		int size = shadow_image_size(t, octahedral);
+		glCreateTextures(octahedral ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_CUBE_MAP_ARRAY, 1, &shadow_tier_arrays[t]);
+		glTextureStorage3D(shadow_tier_arrays[t], 1, format, size, size, (octahedral ? 1 : 6) * layers[t]);
+		glTextureParameteri(shadow_tier_arrays[t], GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(shadow_tier_arrays[t], GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	shadow_map_format = format;
+	shadow_maps_octahedral = octahedral;
+	set_octahedral_shadows(octahedral);
+
+	check_gl_errors("assign_shadow_tiers() 1");
+
+	for(int i = 0; i < lights.size(); i++)
+	{
+		Light* light = lights[i];
+		set_shadow_pass_mode(light->shadow_pass, octahedral);
+		set_shadow_pass_mode(light->static_cache_pass, octahedral);
+		set_shadow_pass_mode(light->dynamic_pass, octahedral);
+		if(tiers[i] == light->shadow_tier && indices[i] == light->shadow_index && cache_indices[i] == light->static_cache_index && (tiers[i] < 0 || !reallocated[tiers[i]]))
+			continue;
+
+		int tier = tiers[i];
+		bool keeps_map = !new_kind && tier >= 0 && tier == light->shadow_tier;
+		bool keeps_cache = keeps_map && light->static_cache_index >= 0 && cache_indices[i] >= 0;
+		if(keeps_map)
+			copy_shadow_map(tier, old_arrays[tier], light->shadow_index, shadow_tier_arrays[tier], indices[i]);
+		if(keeps_cache)
+			copy_shadow_map(tier, old_arrays[tier], light->static_cache_index, shadow_tier_arrays[tier], cache_indices[i]);
 
-Light::Light(Mat4& mat, Vec3& emission, Model* model, bool use_fog, double near_clip)
+		light->shadow_tier = tier;
+		light->shadow_index = indices[i];
+		light->static_cache_index = cache_indices[i];
+		make_shadow_map_view(&light->shadow_map_view, light->shadow_buffer, tier, light->shadow_index, format, !keeps_map);
+		make_shadow_map_view(&light->static_cache_view, light->static_cache_buffer, tier, light->static_cache_index, format, !keeps_cache);
+		if(!keeps_map || (cache_indices[i] >= 0 && !keeps_cache))
+			light->stale_faces = ALL_CUBE_FACES;
+	}
+
+	for(int t = 0; t < NUM_SHADOW_TIERS; t++)
+		if(reallocated[t] && old_arrays[t])
+		{
+			glDeleteTextures(1, &old_arrays[t]);
+			state_forget_texture(old_arrays[t]);
+		}
+
+	check_gl_errors("assign_shadow_tiers() 2");
+}
+
+/*
+	Only SHADOW_FACE_BUDGET cube faces are redrawn per frame, so frame time doesn't depend on 
+	how many lights are dirty at once. Lights go in order of importance times how long they've 
+	been waiting, so a far, dim light can stay stale for a few frames, but not forever. Fog 
+	lights are infinitely important as far as tiers go, but here they get a finite priority 
+	(SHADOW_FOG_PRIORITY), or a couple of moving fog lights would take the whole budget every 
+	frame and everything else would wait forever. Each light goes round robin through its 
+	own stale faces, and all of the faces a light gets in a frame are drawn together.
+
+	An octahedral map can't be drawn a face at a time, so it takes SHADOW_OCTAHEDRAL_COST of 
+	the budget and is drawn whole.
+*/
+void update_shadow_maps(const std::vector<Light*>& lights, DrawFunc draw_static_scene, DrawFunc draw_dynamic_scene)
+{
+	assign_shadow_tiers(lights);
+
+	double top_importance = 0;
+	for(auto light : lights)
+	{
+		double importance = light->shadow_importance();
+		if(importance < INFINITY)
+			top_importance = std::max(top_importance, importance);
+	}
+	double fog_importance = SHADOW_FOG_PRIORITY * (top_importance > 0 ? top_importance : 1);
+
+	std::vector<std::pair<double, Light*>> stale_lights;
+	for(auto light : lights)
+		if(light->shadow_tier >= 0 && (light->stale_faces | light->dynamic_stale_faces))
+		{
+			double importance = light->use_fog ? fog_importance : light->shadow_importance();
+			stale_lights.push_back({importance * (1 + SHADOW_STALENESS_WEIGHT * light->stale_frames), light});
+		}
+	//On a tie, the one that has waited longest goes first.
+	std::stable_sort(stale_lights.begin(), stale_lights.end(), [](const std::pair<double, Light*>& a, const std::pair<double, Light*>& b) {
+		return a.first != b.first ? a.first > b.first : a.second->stale_frames > b.second->stale_frames;
+	});
+
+	int budget = SHADOW_FACE_BUDGET;
+	for(auto& stale : stale_lights)
+	{
+		Light* light = stale.second;
+		unsigned faces = light->stale_faces | light->dynamic_stale_faces, chosen = 0;
+		if(shadow_maps_octahedral && budget > 0)
+		{
+			chosen = ALL_CUBE_FACES;
+			budget -= SHADOW_OCTAHEDRAL_COST;
+		}
+		for(int i = 0; i < 6 && budget > 0 && !shadow_maps_octahedral; i++)
+		{
+			int face = (light->next_face + i) % 6;
+			if(faces & (1u << face))
+			{
+				chosen |= 1u << face;
+				light->next_face = (face + 1) % 6;
+				budget--;
+			}
+		}
+		if(chosen)
+			light->update_shadow_map(draw_static_scene, draw_dynamic_scene, chosen);
+
+		if(light->stale_faces | light->dynamic_stale_faces)
+			light->stale_frames++;
+		else
+			light->stale_frames = 0;
+	}
+}
+
+void invalidate_shadows(const std::vector<Light*>& lights, const Vec4& center, double radius, bool is_static)
+{
+	for(auto light : lights)
+	{
+		unsigned faces = light->shadow_faces_reached(center, radius);
+		if(!faces)
+			continue;
+		if(is_static)
+			light->stale_faces |= faces;
+		else
+		{
+			light->has_dynamic_casters = true;
+			light->dynamic_stale_faces |= faces;
+		}
+	}
+}
+
+void bind_shadow_maps()
+{
+	for(int t = 0; t < NUM_SHADOW_TIERS; t++)
+	{
+		state_bind_texture(SHADOW_MAP_ARRAY_UNIT + t, GL_TEXTURE_CUBE_MAP_ARRAY, shadow_maps_octahedral ? 0 : shadow_tier_arrays[t]);
+		state_bind_texture(OCTAHEDRAL_SHADOW_MAP_UNIT + t, GL_TEXTURE_2D_ARRAY, shadow_maps_octahedral ? shadow_tier_arrays[t] : 0);
+	}
+}
+
+
+Light::Light(const Mat4& mat, const Vec3& emission, Model* model, bool use_fog, double near_clip)
 	: Camera(mat, 1, TAU / 4, near_clip), emission(emission), model(model), use_fog(use_fog)
 {
 	check_gl_errors("Light::Light() 0");
 
-	shadow_buffer = new Framebuffer(
-		"Shadow Buffer",
-		{{GL_TEXTURE_CUBE_MAP, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, GL_DEPTH_ATTACHMENT, GL_LINEAR, GL_LINEAR}},
-		{},
-		SHADOW_MAP_SIZE,
-		SHADOW_MAP_SIZE
-	);
+	//The shadow map and static cache are attached (and the sizes set) in update_shadow_maps().
+	shadow_buffer = new Framebuffer("Shadow Buffer", {}, {});
+	static_cache_buffer = new Framebuffer("Static Shadow Cache", {}, {});
+	shadow_tier = shadow_index = static_cache_index = -1;
+	shadow_map_view = static_cache_view = 0;
+	has_dynamic_casters = false;
 
 	check_gl_errors("Light::Light() 1");
 	
 	shadow_pass = new Pass(shadow_buffer);
-	shadow_pass->clear_mask = GL_DEPTH_BUFFER_BIT;
+	shadow_pass->clear_mask = 0;		//see update_shadow_map()
 	shadow_pass->is_shadow_pass = true;
 
+	static_cache_pass = new Pass(static_cache_buffer, shadow_pass);
+
+	dynamic_pass = new Pass(shadow_buffer, shadow_pass);
+	dynamic_pass->clear_mask = 0;		//on top of the copy of the static cache
+
 	check_gl_errors("Light::Light() 2");
 
 	light_pass = new Pass(s_abuffer);
@@ -39,38 +414,83 @@ Light::Light(Mat4& mat, Vec3& emission, Model* model, bool use_fog, double near_
 	
 	check_gl_errors("Light::Light() 3");
 
-	shadow_map_dirty = true;
+	stale_faces = ALL_CUBE_FACES;
+	dynamic_stale_faces = 0;
+	stale_frames = next_face = 0;
 }
 
-void Light::render(DrawFunc draw_scene)
+static void draw_shadow_casters(Light* light, DrawFunc draw_scene, unsigned faces)
 {
-	if(shadow_map_dirty)
-	{
-		shadow_pass->start();
+	set_shadow_face_mask(faces);
+	use_camera(light);
+	draw_scene();
+	s_render_queue.execute();
+	set_shadow_face_mask(ALL_CUBE_FACES);
+	use_camera(&cam);
+}
 
-		s_curcam = this;
-		draw_scene();
-		s_curcam = &cam;
+/*
+	A light without dynamic shadow casters draws the static scene straight into its shadow map. 
+	Otherwise the static scene goes into the static cache, and whenever either part changes, 
+	the shadow map is a copy of the cache with the dynamic scene drawn on top. The shadow passes 
+	don't clear, because they only draw some of the faces.
+*/
+void Light::update_shadow_map(DrawFunc draw_static_scene, DrawFunc draw_dynamic_scene, unsigned faces)
+{
+	if(shadow_tier < 0)
+		return;
 
-		shadow_map_dirty = false;
+	unsigned static_faces = stale_faces & faces;
+	if(static_cache_index < 0)
+	{
+		if(static_faces)
+		{
+			clear_shadow_faces(shadow_tier, shadow_index, static_faces);
+			shadow_pass->start();
+			draw_shadow_casters(this, draw_static_scene, static_faces);
+		}
+		dynamic_stale_faces &= ~faces;
+	}
+	else
+	{
+		if(static_faces)
+		{
+			clear_shadow_faces(shadow_tier, static_cache_index, static_faces);
+			static_cache_pass->start();
+			draw_shadow_casters(this, draw_static_scene, static_faces);
+			dynamic_stale_faces |= static_faces;
+		}
+		unsigned dynamic_faces = dynamic_stale_faces & faces;
+		if(dynamic_faces)
+		{
+			copy_shadow_faces(shadow_tier, static_cache_index, shadow_index, dynamic_faces);
+			dynamic_pass->start();
+			if(draw_dynamic_scene)
+				draw_shadow_casters(this, draw_dynamic_scene, dynamic_faces);
+		}
+		dynamic_stale_faces &= ~dynamic_faces;
 	}
 
+	stale_faces &= ~static_faces;
+}
+
+void Light::render()
+{
 	light_pass->start();
 
-	std::set<const char*> frag_options;
-	if(use_fog)
-		frag_options.insert(DEFINE_USE_FOG);
 	ShaderProgram* light_program = ShaderProgram::get(
-		Shader::get(vert_screenspace, {}),
+		Shader::get(vert_screenspace, 0),
 		NULL,
-		Shader::get(frag_point_light, frag_options)
+		Shader::get(frag_point_light, use_fog ? OPTION_USE_FOG : 0)
 	);
 
 	light_program->use();
 	light_program->set_matrix("light_xform", ~mat * cam.get_mat());
 	light_program->set_vector("light_pos", ~cam.get_mat() * mat.get_column(_w));
 	light_program->set_vector("light_emission", emission);
-	light_program->set_texture("light_map", 5, shadow_map(), GL_TEXTURE_CUBE_MAP);
+	light_program->set_int("shadow_tier", shadow_tier);
+	light_program->set_int("shadow_index", shadow_index);
+	bind_shadow_maps();
 
 	draw_fsq();
 }
@@ -78,5 +498,109 @@ void Light::render(DrawFunc draw_scene)
 
 void Light::draw()
 {
-	model->draw(mat, 10 * emission);
+	model->draw(mat, Vec4f(Vec3f(10 * emission)));
+}
+
+double Light::shadow_importance()
+{
+	//Fog lights light up the whole screen.
+	if(use_fog)
+		return INFINITY;
+	double brightness = std::max(fabs(emission.x), std::max(fabs(emission.y), fabs(emission.z)));
+	//The camera is at (0, 0, 0, 1) in view space, so this is the sine of the distance to either image of the light.
+	Vec4 view_pos = ~cam.get_mat() * mat.get_column(_w);
+	double sin_distance = sqrt(view_pos.x * view_pos.x + view_pos.y * view_pos.y + view_pos.z * view_pos.z);
+	return brightness / std::max(sin_distance, MIN_SHADOW_IMPORTANCE_SINE);
+}
+
+unsigned Light::shadow_faces_reached(const Vec4& center, double radius)
+{
+	//Shadows are depth, not light, so how bright the light is doesn't cut anything off here.
+	return cube_faces_touched(~mat * center, radius);
+}
+
+double Light::influence_radius()
+{
+	//Fog is lit along the whole view ray, so a fog light can't be culled.
+	//The normal factor is a chord length, which can be up to 2.
+	double brightness = 2 * std::max(fabs(emission.x), std::max(fabs(emission.y), fabs(emission.z)));
+	if(use_fog || brightness >= LIGHT_CUTOFF)
+		return TAU / 4;
+	return asin(sqrt(brightness / LIGHT_CUTOFF));
+}
+
+
+//Upload the lights to the SSBO at LIGHTS_BINDING, and bind the shadow map arrays.
+static void upload_gpu_lights(ShaderProgram* program, const std::vector<Light*>& lights)
+{
+	static GLuint lights_buffer = 0;
+	static std::vector<GPULight> gpu_lights;
+
+	if(lights.size() > MAX_GPU_LIGHTS)
+		error("Got %d lights, but MAX_GPU_LIGHTS is %d.\n", (int)lights.size(), MAX_GPU_LIGHTS);
+
+	Mat4 cam_inverse = ~cam.get_mat();
+	gpu_lights.resize(lights.size());
+	for(int i = 0; i < lights.size(); i++)
+	{
+		Light* light = lights[i];
+
+		GPULight& gpu_light = gpu_lights[i];
+		gpu_light.light_xform = Mat4f(~light->get_mat() * cam.get_mat());
+		gpu_light.position = Vec4f(cam_inverse * light->get_mat().get_column(_w));
+		gpu_light.emission = Vec4f(Vec3f(light->emission), (float)light->influence_radius());
+		gpu_light.shadow_index = light->shadow_index;
+		gpu_light.shadow_tier = light->shadow_tier;
+		gpu_light.use_fog = light->use_fog;
+	}
+
+	if(!lights_buffer)
+		glCreateBuffers(1, &lights_buffer);
+	glNamedBufferData(lights_buffer, gpu_lights.size() * sizeof(GPULight), gpu_lights.data(), GL_STREAM_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHTS_BINDING, lights_buffer);
+
+	program->set_int("light_count", lights.size());
+	bind_shadow_maps();
+}
+
+void render_all_lights(const std::vector<Light*>& lights)
+{
+	static Pass* pass = NULL;
+	if(!pass)
+	{
+		pass = new Pass(s_abuffer);
+		pass->clear_mask = 0;
+		pass->depth_test = pass->depth_mask = false;
+		pass->blend = true;
+	}
+
+	ShaderProgram* program = ShaderProgram::get(
+		Shader::get(vert_screenspace, 0),
+		NULL,
+		Shader::get(frag_all_lights, 0)
+	);
+
+	upload_gpu_lights(program, lights);
+
+	pass->start();
+	program->use();
+	draw_fsq();
+}
+
+void render_clustered_lights(const std::vector<Light*>& lights)
+{
+	ShaderProgram* program = ShaderProgram::get_compute(Shader::get(comp_clustered_lights, 0));
+	upload_gpu_lights(program, lights);
+	program->use();
+
+	glBindImageTexture(0, s_abuffer_color, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+
+	glDispatchCompute(
+		(s_abuffer->width + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE,
+		(s_abuffer->height + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE,
+		1
+	);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+	check_gl_errors("render_clustered_lights()");
 }
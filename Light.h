@@ -5,29 +5,116 @@
 #include "Model.h"
 #include "Framebuffer.h"
 
+#include <vector>
+#include <string.h>
+
+
+/*
+	Shadow maps come from a pool of NUM_SHADOW_TIERS GL_TEXTURE_CUBE_MAP_ARRAYs, one for each 
+	resolution from MAX_SHADOW_MAP_SIZE down. A light's shadow map is one layer (six faces) of 
+	the array for its shadow_tier, at shadow_index. The light renders its shadow map through a 
+	GL_TEXTURE_CUBE_MAP view of its layer, so the shadow pass shaders don't know about the 
+	pool, and the lighting shaders sample every shadow map through light_maps[shadow_tier].
+
+	update_shadow_maps() picks the tiers every frame from how important each light looks from 
+	the camera, and keeps the whole pool under SHADOW_MEMORY_BUDGET. Lights that don't fit 
+	have no shadow map (shadow_tier -1) and are drawn unshadowed.
+
+	Shadow casters are split into a static scene and a dynamic scene. A shadow map is only 
+	redrawn when something changes in its view: the light moves, or the game calls 
+	invalidate_shadows() for an object, which marks just the faces the object could show up 
+	in. Once a dynamic object has been reported in a light's view, the light keeps its static scene in a cache layer next to its shadow map, so a 
+	dynamic change is a copy of the cache plus a redraw of just the dynamic scene.
+
+	Stale shadow maps aren't all redrawn right away. update_shadow_maps() redraws at most 
+	SHADOW_FACE_BUDGET cube faces a frame, most important lights first, see there.
+
+	With s_octahedral_shadows, the tiers are GL_TEXTURE_2D_ARRAYs instead, and each shadow map 
+	is one octahedral map (see octahedral_glsl) of twice the tier size, drawn in a single pass 
+	without the six-way geometry shader fan out. That's 4 instead of 6 times the tier size 
+	squared, with a bit less resolution near the corners. The lighting shaders sample these 
+	through light_oct_maps[shadow_tier]. An octahedral map is always redrawn whole, and costs 
+	SHADOW_OCTAHEDRAL_COST faces of the budget.
+
+	There are three ways to draw the lights into the A-buffer:
+		Light::render() is one fullscreen draw per light.
+		render_all_lights() is one fullscreen draw that loops over every light.
+		render_clustered_lights() is one compute dispatch. Each CLUSTER_TILE_SIZE square tile 
+			of the screen is cut into NUM_DEPTH_SLICES clusters, each with a list of the lights 
+			that can reach it.
+	The last two read the lights from an SSBO of GPULights.
+*/
+#define MAX_SHADOW_MAP_SIZE			(4096)
+#define NUM_SHADOW_TIERS			(5)		//MAX_SHADOW_MAP_SIZE down to MAX_SHADOW_MAP_SIZE / 16
+#define SHADOW_MEMORY_BUDGET		((size_t)512 << 20)
+#define MIN_SHADOW_IMPORTANCE_SINE	(0.05)	//Lights closer to the camera than this (in sin(distance)) aren't any more important.
+#define SHADOW_TIER_HYSTERESIS		(0.25)	//How far (in log2 of importance) past a tier's range a light has to get before it changes tiers
+#define SHADOW_FACE_BUDGET			(12)	//Cube faces redrawn per frame
+#define SHADOW_STALENESS_WEIGHT		(0.5)	//How much more important a light gets for each frame it waits
+#define SHADOW_FOG_PRIORITY			(2.0)	//Fog lights are scheduled as if they were this many times as important as the most important other light.
+#define SHADOW_OCTAHEDRAL_COST		(4)		//Faces of the budget a whole octahedral map counts as. It's 4 faces worth of pixels.
+#define SHADOW_MAP_ARRAY_UNIT		(4)		//First of NUM_SHADOW_TIERS texture units the lighting shaders sample the shadow maps on
+#define OCTAHEDRAL_SHADOW_MAP_UNIT	(SHADOW_MAP_ARRAY_UNIT + NUM_SHADOW_TIERS)		//Same for octahedral shadow maps
+#define LIGHTS_BINDING				(1)		//SSBO binding point of the GPULights
+#define MAX_GPU_LIGHTS				(1024)
+#define CLUSTER_TILE_SIZE			(16)
+#define NUM_DEPTH_SLICES			(32)
+#define MAX_LIGHTS_PER_CLUSTER		(64)	//A cluster with more than this falls back to looping over every light.
+#define LIGHT_CUTOFF				(0.005)	//Light dimmer than this is treated as no light at all.
+
 
 extern double s_fog_density;
 extern Vec3 s_fog_color;
 
+extern bool s_shadow_map_16_bit;		//GL_DEPTH_COMPONENT16 instead of GL_DEPTH_COMPONENT32F. Takes effect in the next update_shadow_maps().
+extern bool s_octahedral_shadows;		//Octahedral shadow maps instead of cube maps. Same.
+
+inline int shadow_tier_size(int tier) {return MAX_SHADOW_MAP_SIZE >> tier;}
+
+
+//std430 layout of a light in the SSBO. Has to match GPULight in light_buffer_glsl.
+struct alignas(16) GPULight
+{
+	Mat4f light_xform;		//view space to the light's space
+	Vec4f position;			//in view space
+	Vec4f emission;			//w is the radius of influence
+	int shadow_index;		//layer of the shadow map array
+	int shadow_tier;		//which shadow map array, or -1 for no shadow
+	int use_fog;
+	int pad;
+};
+
+static_assert(sizeof(GPULight) == 112, "GPULight doesn't match std430.");
+
 
 struct Light : public Camera
 {
 	Vec3 emission;
 	Model* model;
 
-	Framebuffer* shadow_buffer;
-	Pass *shadow_pass, *light_pass;
-	bool shadow_map_dirty;
+	Framebuffer *shadow_buffer, *static_cache_buffer;		//The views are extra attachments.
+	Pass *shadow_pass, *static_cache_pass, *dynamic_pass, *light_pass;
+	int shadow_tier, shadow_index;	//-1 until update_shadow_maps(), or if the light has no shadow map
+	int static_cache_index;			//Layer of the same array, or -1 if there are no dynamic casters.
+	GLuint shadow_map_view;			//GL_TEXTURE_CUBE_MAP (or GL_TEXTURE_2D) view of this light's layer of its tier's array, or 0
+	GLuint static_cache_view;		//Same for the static cache
+	unsigned stale_faces;			//Faces where the static scene has to be redrawn (which implies the dynamic one too)
+	unsigned dynamic_stale_faces;	//Faces where only the dynamic scene has to be redrawn
+	int stale_frames;				//How many frames the light has been waiting for the scheduler
+	int next_face;					//Where the scheduler's round robin picks up
+	bool has_dynamic_casters;		//A dynamic object has been reported in one of the faces, see invalidate_shadows().
 	bool use_fog;
 
-	Light(Mat4& mat, Vec3& emission, Model* model, bool use_fog = false, double near_clip = 0.001);
+	Light(const Mat4& mat, const Vec3& emission, Model* model, bool use_fog = false, double near_clip = 0.001);
 
-	inline GLuint shadow_map() {return shadow_buffer->textures[0];}
+	inline GLuint shadow_map() {return shadow_map_view;}		//As a GL_TEXTURE_CUBE_MAP, or a GL_TEXTURE_2D if octahedral_shadow_maps().
 
-	void set_mat(Mat4& new_mat)
+	void set_mat(const Mat4& new_mat)
 	{
+		Rotor old_rotor = get_rotor();
 		Camera::set_mat(new_mat);
-		shadow_map_dirty = true;
+		if(memcmp(&old_rotor, &get_rotor(), sizeof(Rotor)))
+			stale_faces = ALL_CUBE_FACES;
 	}
 
 	void set_perspective(double new_aspect_ratio, double vertical_field_of_view, double near = 0.001)
@@ -43,14 +130,51 @@ struct Light : public Camera
 	void translate(double right, double down, double fwd)
 	{
 		Camera::translate(right, down, fwd);
-		shadow_map_dirty = true;
+		stale_faces = ALL_CUBE_FACES;
 	}
 	void rotate(double pitch, double yaw, double roll)
 	{
 		Camera::rotate(pitch, yaw, roll);
-		shadow_map_dirty = true;
+		stale_faces = ALL_CUBE_FACES;
 	}
 
-	void render(DrawFunc draw_scene);		//Render the light map with draw_scene(), and then draw the light's effect into abuffer.
+	//Redraw whatever is stale in faces of the light map, if the light has one. draw_dynamic_scene can be NULL.
+	void update_shadow_map(DrawFunc draw_static_scene, DrawFunc draw_dynamic_scene, unsigned faces = ALL_CUBE_FACES);
+	void render();							//Draw the light's effect into abuffer.
 	void draw();							//Draw the light's model.
+
+	//Which faces of the shadow map anything within radius of center (in world space) could show up in.
+	unsigned shadow_faces_reached(const Vec4& center, double radius);
+
+	/*
+		How far from either image of the light its intensity drops below LIGHT_CUTOFF. Intensity 
+		goes as emission / sin^2(distance), which is never less than emission, so for all but 
+		dim lights this is TAU / 4 and the light reaches everywhere.
+	*/
+	double influence_radius();
+
+	//Brightness over sin(distance to the camera), roughly how big the light's effect is on the screen.
+	double shadow_importance();
 };
+
+
+/*
+	Pick every light's shadow tier, reallocate whatever changed, and redraw as many stale faces 
+	as the budget allows. Call once a frame before drawing the lights.
+*/
+void update_shadow_maps(const std::vector<Light*>& lights, DrawFunc draw_static_scene, DrawFunc draw_dynamic_scene = NULL);
+//Bind the shadow map arrays on SHADOW_MAP_ARRAY_UNIT or OCTAHEDRAL_SHADOW_MAP_UNIT and up.
+void bind_shadow_maps();
+//Whether the current shadow maps are octahedral, which lags s_octahedral_shadows until the next update_shadow_maps().
+bool octahedral_shadow_maps();
+
+/*
+	Something within radius of center (in world space) was added, removed or moved, so the 
+	faces of the shadow maps it could show up in are stale. A moving dynamic object should 
+	report where it was as well as where it is.
+*/
+void invalidate_shadows(const std::vector<Light*>& lights, const Vec4& center, double radius, bool is_static);
+
+//These draw all of the lights into abuffer.
+void render_all_lights(const std::vector<Light*>& lights);
+void render_clustered_lights(const std::vector<Light*>& lights);
@@ -3,6 +3,7 @@
 #include <math.h>
 #include "Vector.h"
 #include "Utils.h"
+#include "BatchMath.h"
 
 
 #define CHORD2_LUT_SIZE		(64)
@@ -12,14 +13,17 @@ LookupTable* s_chord2_lut;
 
 void init_luts()
 {
+	float chord2[CHORD2_LUT_SIZE], distance[CHORD2_LUT_SIZE], sines[CHORD2_LUT_SIZE], cosines[CHORD2_LUT_SIZE];
+	for(int i = 0; i < CHORD2_LUT_SIZE; i++)
+		chord2[i] = 4.0 * i / (CHORD2_LUT_SIZE - 1);
+	batch_geodesic_from_chord2(chord2, distance, CHORD2_LUT_SIZE);
+	batch_sincos(distance, sines, cosines, CHORD2_LUT_SIZE);
+
 	float* chord2_data = new float[2 * CHORD2_LUT_SIZE];
 	for(int i = 0; i < CHORD2_LUT_SIZE; i++)
 	{
-		float c = 4.0 * i / (CHORD2_LUT_SIZE - 1);
-		float distance = 2.0 * asin(0.5 * sqrt(c));
-		chord2_data[2 * i] = distance / TAU;
-		float temp = sin(distance);
-		chord2_data[2 * i + 1] = 1.0 / (temp * temp);
+		chord2_data[2 * i] = distance[i] / TAU;
+		chord2_data[2 * i + 1] = 1.0 / (sines[i] * sines[i]);
 	}
 	//1 / sin^2(0) is infinite and my GPU doesn't seem to like infinity.
 	//FLT_MAX is also too big, because it makes for a visible discontinuity at distance = 2 / (CHORD2_LUT_SIZE - 1).
@@ -2,6 +2,7 @@
 
 #include "GL/glew.h"
 #include "Utils.h"
+#include "GLState.h"
 
 #pragma warning(disable : 4244)		//conversion from double to float
 
@@ -42,7 +43,7 @@ public:
 		scale = ((float)tex_size - 1) / (tex_size * domain_size);
 
 		glGenTextures(1, &texture);
-		glBindTexture(target, texture);
+		state_bind_texture(target, texture);
 
 		switch(target)
 		{
@@ -7,6 +7,10 @@
 #include "Model.h"
 #include "Camera.h"
 #include "Framebuffer.h"
+#include "BakedTables.h"
+#include "BatchMath.h"
+#include "GLState.h"
+#include "RenderQueue.h"
 
 #include <stdio.h>
 #include <time.h>
@@ -29,8 +33,6 @@ ShaderCore* frag_fog = new ShaderCore(
 	R"(
 		uniform sampler2D albedo_tex;
 		uniform sampler2D depth_tex;
-
-		uniform float fog_scale;
 			
 		out vec4 frag_color;
 
@@ -42,9 +44,7 @@ ShaderCore* frag_fog = new ShaderCore(
 		}
 	)",
 	NULL,
-	[](ShaderProgram* program) {
-		program->set_float("fog_scale", s_fog_scale);
-	},
+	NULL,
 	[](ShaderProgram* program) {
 		program->set_texture("albedo_tex", 0, s_gbuffer_albedo);
 		program->set_texture("depth_tex", 1, s_gbuffer_depth);
@@ -93,7 +93,6 @@ bool	draw_poles = true,			//colored markers at each of the +x, +y, +z, +w poles
 
 DrawFunc render_poles = NULL;
 
-#define NUM_HOPF_FIBERS		(32)
 DrawFunc render_hopf = NULL, render_antihopf = NULL;
 
 #define TORUS_SUBDIVISIONS NUM_HOPF_FIBERS
@@ -101,13 +100,10 @@ DrawFunc render_hopf = NULL, render_antihopf = NULL;
 #define NUM_SUPERHOPF_FIBERS		(1024)
 DrawFunc render_superhopf = NULL;
 
-#define NUM_TESSERACT_EDGES			(32)
 DrawFunc render_tesseract = NULL;
 
-#define NUM_CROSS_EDGE_LOOPS		(8)
 DrawFunc render_cross = NULL;
 
-#define NUM_ITC_EDGE_LOOPS			(16)
 DrawFunc render_itc = NULL, render_dual_itc = NULL;
 
 
@@ -119,6 +115,7 @@ void init()
 	init_random();
 	init_luts();
 	init_shaders();
+	ShaderProgram::warm_up_from_cache();
 	init_framebuffers();
 
 	gpass = new Pass(s_gbuffer);
@@ -128,16 +125,15 @@ void init()
 	fog_pass->depth_mask = false;
 
 	fog_quad_program = ShaderProgram::get(
-		Shader::get(vert_screenspace, {}),
+		Shader::get(vert_screenspace, 0),
 		NULL,
-		Shader::get(frag_fog, {})
+		Shader::get(frag_fog, 0)
 	);
 
 	int i;
 
-	Vec4* dots = new Vec4[NUM_DOTS];
-	for(i = 0; i < NUM_DOTS; i++)
-		dots[i] = rand_s3();
+	Vec4f* dots = new Vec4f[NUM_DOTS];
+	thread_random().fill_s3(dots, NUM_DOTS);
 	dots_model = new Model(NUM_DOTS, dots);
 	delete[] dots;
 
@@ -148,134 +144,71 @@ void init()
 	torus_model = Model::make_torus(NUM_HOPF_FIBERS, NUM_HOPF_FIBERS, 1, false);
 	torus_model->generate_primitive_colors(0.7);
 
-	Mat4 pole_xforms[4] = {
-		Mat4::identity(),
-		Mat4::axial_rotation(_w, _x, TAU / 4),
-		Mat4::axial_rotation(_w, _y, TAU / 4),
-		Mat4::axial_rotation(_w, _z, TAU / 4)
-	};
-	Vec4 pole_colors[4] = {
+	Vec4f pole_colors[4] = {
 		{0.7, 0.7, 0.7, 1},
 		{0.7, 0, 0, 1},
 		{0, 0.7, 0, 1},
 		{0, 0, 0.7, 1}
 	};
-	render_poles = pole_model->make_draw_func(4, pole_xforms, pole_colors);
+	render_poles = pole_model->make_draw_func(4, pole_xforms.data(), pole_colors);
 
-	Mat4 hopf_xforms[NUM_HOPF_FIBERS];
-	Mat4 antihopf_xforms[NUM_HOPF_FIBERS];
-	for(i = 0; i < NUM_HOPF_FIBERS; i++)
-	{
-		double theta = (double)i * TAU / (2 * NUM_HOPF_FIBERS);
-		hopf_xforms[i] = Mat4::axial_rotation(_x, _w, theta) * Mat4::axial_rotation(_y, _z, theta);
-		antihopf_xforms[i] = Mat4::axial_rotation(_y, _x, theta) * Mat4::axial_rotation(_z, _w, theta) * Mat4::axial_rotation(_x, _z, TAU / 4);
-	}
-	render_hopf = geodesic_model->make_draw_func(NUM_HOPF_FIBERS, hopf_xforms, Vec4(1, 0.5, 0, 1));
-	render_antihopf = geodesic_model->make_draw_func(NUM_HOPF_FIBERS, antihopf_xforms, Vec4(0, 1, 0.5, 1));
+	render_hopf = geodesic_model->make_draw_func(NUM_HOPF_FIBERS, hopf_xforms.data(), Vec4f(1, 0.5, 0, 1));
+	render_antihopf = geodesic_model->make_draw_func(NUM_HOPF_FIBERS, antihopf_xforms.data(), Vec4f(0, 1, 0.5, 1));
 
-	Mat4 superhopf_xforms[NUM_SUPERHOPF_FIBERS];
+	//Fibers over uniformly random points of S2. By Archimedes, the height of such a point is uniform in [-1, 1], and so is its longitude in [0, TAU).
+	Mat4f superhopf_xforms[NUM_SUPERHOPF_FIBERS];
+	float heights[NUM_SUPERHOPF_FIBERS], thetas[NUM_SUPERHOPF_FIBERS], phis[NUM_SUPERHOPF_FIBERS];
+	thread_random().fill_floats(heights, NUM_SUPERHOPF_FIBERS);
+	thread_random().fill_floats(phis, NUM_SUPERHOPF_FIBERS);
+	for(i = 0; i < NUM_SUPERHOPF_FIBERS; i++)
+		heights[i] = 2 * heights[i] - 1;
+	batch_acos(heights, thetas, NUM_SUPERHOPF_FIBERS);
 	for(i = 0; i < NUM_SUPERHOPF_FIBERS; i++)
 	{
-		Vec3 temp = rand_s2();
-		double theta = 0.5 * acos(temp.z), phi = atan2(temp.y, temp.x);
+		double theta = 0.5 * thetas[i], phi = TAU * phis[i];
 
 		superhopf_xforms[i] =
-			Mat4::axial_rotation(_x, _y, phi)
-			* Mat4::axial_rotation(_w, _x, theta)
-			* Mat4::axial_rotation(_y, _z, theta);
-			//* Mat4::axial_rotation(_w, _z, frand() * TAU);		//Random longitudinal displacement so that the stripes on nearby fibers don't line up. It might be more elucidating if they do line up, come to think of it.
+			Mat4f::axial_rotation(_x, _y, phi)
+			* Mat4f::axial_rotation(_w, _x, theta)
+			* Mat4f::axial_rotation(_y, _z, theta);
+			//* Mat4f::axial_rotation(_w, _z, frand() * TAU);		//Random longitudinal displacement so that the stripes on nearby fibers don't line up. It might be more elucidating if they do line up, come to think of it.
 	}
-	render_superhopf = geodesic_model->make_draw_func(NUM_SUPERHOPF_FIBERS, superhopf_xforms, Vec4(0.5, 1, 0.5, 1));
+	render_superhopf = geodesic_model->make_draw_func(NUM_SUPERHOPF_FIBERS, superhopf_xforms, Vec4f(0.5, 1, 0.5, 1));
 
-	Mat4 tesseract_edge_xforms[NUM_TESSERACT_EDGES];
 	tesseract_arc = Model::make_torus_arc(8, 8, acos(0.5), STANDARD_HOLE_RATIO);
 	tesseract_arc->generate_primitive_colors(0.5);
-	int edge_index = 0;
-	for(int vertex = 0; vertex < 16; vertex++)
-	{
-		Vec4 a = Vec4(
-			vertex & 1 ? 1 : -1,
-			vertex & 2 ? 1 : -1,
-			vertex & 4 ? 1 : -1,
-			vertex & 8 ? 1 : -1
-		).normalize();
-		for(int axis = 0; axis < 4; axis++)
-		{
-			if(vertex & (1 << axis))
-			{
-				int other_vertex = vertex & ~(1 << axis);
-				Vec4 b = Vec4(
-					other_vertex & 1 ? 1 : -1,
-					other_vertex & 2 ? 1 : -1,
-					other_vertex & 4 ? 1 : -1,
-					other_vertex & 8 ? 1 : -1
-				).normalize();
-
-				tesseract_edge_xforms[edge_index] = basis_around(a, b);
-				edge_index++;
-			}
-		}
-	}
-	render_tesseract = tesseract_arc->make_draw_func(NUM_TESSERACT_EDGES, tesseract_edge_xforms, Vec4(1, 0, 1, 1));
-
-	Mat4 cross_xforms[NUM_CROSS_EDGE_LOOPS] = {
-		Mat4::identity(),
-		Mat4::axial_rotation(_x, _w, TAU / 4),
-		Mat4::axial_rotation(_y, _w, TAU / 4),
-		Mat4::axial_rotation(_x, _z, TAU / 4),
-		Mat4::axial_rotation(_y, _z, TAU / 4),
-		Mat4::axial_rotation(_x, _w, TAU / 4) * Mat4::axial_rotation(_y, _z, TAU / 4)
-	};
-	render_cross = geodesic_model->make_draw_func(NUM_CROSS_EDGE_LOOPS, cross_xforms, Vec4(1, 0, 0, 1));
-
-	//Don't ask how I came up with these vectors. You don't want to know.
-	Mat4 itc_edge_loop_xforms[NUM_ITC_EDGE_LOOPS];
-	Vec4 temp[NUM_ITC_EDGE_LOOPS][2] = {
-		{Vec4(0, 1, 1, 0), Vec4(1, 0, 1, 0)},
-		{Vec4(0, 1, 1, 0), Vec4(1, 1, 0, 0)},
-		{Vec4(0, 1, 1, 0), Vec4(0, 0, 1, 1)},
-		{Vec4(0, 1, 1, 0), Vec4(0, 0, 1, -1)},
-		{Vec4(1, 1, 0, 0), Vec4(0, 1, -1, 0)},
-		{Vec4(1, 1, 0, 0), Vec4(0, 1, 0, 1)},
-		{Vec4(1, 1, 0, 0), Vec4(0, 1, 0, -1)},
-		{Vec4(-1, 0, 0, 1), Vec4(0, -1, 0, 1)},
-		{Vec4(-1, 0, 0, 1), Vec4(0, 0, 1, 1)},
-		{Vec4(-1, 0, 0, 1), Vec4(0, 0, -1, 1)},
-		{Vec4(0, 0, 1, -1), Vec4(1, 0, 1, 0)},
-		{Vec4(0, 0, 1, -1), Vec4(0, 1, 0, -1)},
-		{Vec4(0, 1, 0, 1), Vec4(1, 0, 0, 1)},
-		{Vec4(0, 1, 0, 1), Vec4(0, 0, 1, 1)},
-		{Vec4(0, -1, 1, 0), Vec4(1, -1, 0, 0)},
-		{Vec4(1, 0, 0, 1), Vec4(0, 0, 1, 1)}
-	};
-	for(i = 0; i < NUM_ITC_EDGE_LOOPS; i++)
-		itc_edge_loop_xforms[i] = basis_around(temp[i][0].normalize(), temp[i][1].normalize());
+	render_tesseract = tesseract_arc->make_draw_func(NUM_TESSERACT_EDGES, tesseract_edge_xforms.data(), Vec4f(1, 0, 1, 1));
+
+	render_cross = geodesic_model->make_draw_func(NUM_CROSS_EDGE_LOOPS, cross_xforms.data(), Vec4f(1, 0, 0, 1));
 
-	render_itc = geodesic_model->make_draw_func(NUM_ITC_EDGE_LOOPS, itc_edge_loop_xforms, Vec4(1, 0, 1, 1));
+	render_itc = geodesic_model->make_draw_func(NUM_ITC_EDGE_LOOPS, itc_edge_loop_xforms.data(), Vec4f(1, 0, 1, 1));
 
-	Mat4 dual_rotation = Mat4::axial_rotation(_w, _z, TAU / 8) * Mat4::axial_rotation(_y, _x, TAU / 8);
-	for(i = 0; i < NUM_ITC_EDGE_LOOPS; i++)
-		itc_edge_loop_xforms[i] = dual_rotation * itc_edge_loop_xforms[i];
-	render_dual_itc = geodesic_model->make_draw_func(NUM_ITC_EDGE_LOOPS, itc_edge_loop_xforms, Vec4(1, 0, 0, 1));
+	render_dual_itc = geodesic_model->make_draw_func(NUM_ITC_EDGE_LOOPS, dual_itc_edge_loop_xforms.data(), Vec4f(1, 0, 0, 1));
 }
 
 
 void reshape(int w, int h)
 {
-	cam.set_perspective((double)w / h);
-	resize_screenbuffers(w, h);
-	ShaderProgram::init_all();
+	request_resize(w, h);
 }
 
 void display()
 {
+	if(apply_pending_resize())
+	{
+		cam.set_perspective((double)window_width / window_height);
+		ShaderProgram::init_all();
+	}
+
 	double dt = current_time() - last_fame_time;
 
 	#ifdef PRINT_FRAME_RATE
 		printf("%f\n", 1.0 / dt);
 		print_matrix(cam.get_mat());
+		printf("GL state changes: %d issued, %d elided\n", state_frame_stats().issued, state_frame_stats().elided);
 		printf("\n");
 	#endif
+	state_new_frame();
 
 	#define CONTROL_SPEED(positive, negative, speed)	(\
 		(positive && !negative) ? speed * dt : \
@@ -296,6 +229,8 @@ void display()
 
 	gpass->start();
 
+	set_fog_uniforms(0, s_fog_scale, Vec3(1, 1, 1));
+	use_camera(&cam);
 	ShaderProgram::frame_all();
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -304,7 +239,7 @@ void display()
 		render_poles();
 
 	if(draw_clutter)
-		dots_model->draw(Mat4::identity(), Vec4(1, 1, 1, 1));
+		dots_model->draw(Mat4::identity(), Vec4f(1, 1, 1, 1));
 
 	if(draw_tesseract)
 		render_tesseract();
@@ -328,16 +263,18 @@ void display()
 
 	if(draw_sun_paths)
 	{
-		geodesic_model->draw(Mat4::axial_rotation(_y, _w, TAU / 8) * Mat4::axial_rotation(_z, _x, TAU / 8), Vec4(1, 0, 0, 1));
-		geodesic_model->draw(Mat4::axial_rotation(_x, _z, TAU / 8) * Mat4::axial_rotation(_w, _y, TAU / 8), Vec4(0, 0, 1, 1));
+		geodesic_model->draw(Mat4::axial_rotation(_y, _w, TAU / 8) * Mat4::axial_rotation(_z, _x, TAU / 8), Vec4f(1, 0, 0, 1));
+		geodesic_model->draw(Mat4::axial_rotation(_x, _z, TAU / 8) * Mat4::axial_rotation(_w, _y, TAU / 8), Vec4f(0, 0, 1, 1));
 	}
 	
 	if(draw_torus)
-		torus_model->draw(Mat4::axial_rotation(_y, _w, TAU / 8) * Mat4::axial_rotation(_z, _x, TAU / 8), Vec4(0.3, 0.3, 0.3, 1));
+		torus_model->draw(Mat4::axial_rotation(_y, _w, TAU / 8) * Mat4::axial_rotation(_z, _x, TAU / 8), Vec4f(0.3, 0.3, 0.3, 1));
 
 	if(draw_superhopf)
 		render_superhopf();
 
+	s_render_queue.execute();
+
 	fog_pass->start();
 	fog_quad_program->use();
 	draw_fsq();
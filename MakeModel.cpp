@@ -1,80 +1,76 @@
 #include "MakeModel.h"
 
 #include "Utils.h"
-#include <map>
+#include "BatchMath.h"
 
 
-std::shared_ptr<Vec4[]> make_torus_verts(int long_segments, int trans_segments, double hole_ratio, double length, bool make_final_ring)
+//sin and cos of i * step for i = 0 through count - 1, worked out all at once.
+struct AngleTable {
+	std::unique_ptr<float[]> angles, sines, cosines;
+
+	AngleTable(int count, double step) : angles(new float[count]), sines(new float[count]), cosines(new float[count])
+	{
+		for(int i = 0; i < count; i++)
+			angles[i] = (float)(i * step);
+		batch_sincos(angles.get(), sines.get(), cosines.get(), count);
+	}
+};
+
+
+std::shared_ptr<Vec4f[]> make_torus_verts(int long_segments, int trans_segments, double hole_ratio, double length, bool make_final_ring)
 {
-	double normalization_factor = 1.0 / sqrt(1.0 + hole_ratio * hole_ratio);
+	float normalization_factor = 1.0 / sqrt(1.0 + hole_ratio * hole_ratio);
+	float scaled_hole_ratio = normalization_factor * hole_ratio;
+
+	AngleTable thetas(long_segments, length / (make_final_ring ? long_segments - 1 : long_segments));
+	AngleTable phis(trans_segments, TAU / trans_segments);
 
-	std::shared_ptr<Vec4[]> ret(new Vec4[long_segments * trans_segments]);
+	std::shared_ptr<Vec4f[]> ret(new Vec4f[long_segments * trans_segments]);
 	for(int i = 0; i < long_segments; i++)
-	{
-		double theta = (double)i * length / (make_final_ring ? long_segments - 1 : long_segments);
 		for(int j = 0; j < trans_segments; j++)
-		{
-			double phi = (double)j * TAU / trans_segments;
-
-			ret[i * trans_segments + j] = normalization_factor * Vec4(
-				hole_ratio * sin(phi),
-				hole_ratio * cos(phi),
-				sin(theta),
-				cos(theta)
+			ret[i * trans_segments + j] = Vec4f(
+				scaled_hole_ratio * phis.sines[j],
+				scaled_hole_ratio * phis.cosines[j],
+				normalization_factor * thetas.sines[i],
+				normalization_factor * thetas.cosines[i]
 			);
-		}
-	}
 
 	return ret;
 }
 
-std::shared_ptr<Vec4[]> make_torus_normals(int long_segments, int trans_segments, double hole_ratio, double length, bool make_final_ring)
+std::shared_ptr<Vec4f[]> make_torus_normals(int long_segments, int trans_segments, double hole_ratio, double length, bool make_final_ring)
 {
-	std::shared_ptr<Vec4[]> ret(new Vec4[long_segments * trans_segments]);
+	AngleTable thetas(long_segments, length / (make_final_ring ? long_segments - 1 : long_segments));
+	AngleTable phis(trans_segments, TAU / trans_segments);
+
+	std::shared_ptr<Vec4f[]> ret(new Vec4f[long_segments * trans_segments]);
 	for(int i = 0; i < long_segments; i++)
-	{
-		double theta = (double)i * length / (make_final_ring ? long_segments - 1 : long_segments);
 		for(int j = 0; j < trans_segments; j++)
-		{
-			double phi = (double)j * TAU / trans_segments;
-
-			ret[i * trans_segments + j] = INV_ROOT_2 * Vec4(
-				sin(phi),
-				cos(phi),
-				-sin(theta),
-				-cos(theta)
+			ret[i * trans_segments + j] = (float)INV_ROOT_2 * Vec4f(
+				phis.sines[j],
+				phis.cosines[j],
+				-thetas.sines[i],
+				-thetas.cosines[i]
 			);
-		}
-	}
 
 	return ret;
 }
 
-std::shared_ptr<Vec4[]> make_bumpy_torus_verts(int long_segments, int trans_segments, double bump_height)
+std::shared_ptr<Vec4f[]> make_bumpy_torus_verts(int long_segments, int trans_segments, double bump_height)
 {
-	std::shared_ptr<Vec4[]> ret(new Vec4[long_segments * trans_segments]);
+	AngleTable thetas(long_segments, TAU / long_segments);
+	AngleTable phis(trans_segments, TAU / trans_segments);
+
+	std::shared_ptr<Vec4f[]> ret(new Vec4f[long_segments * trans_segments]);
+	std::unique_ptr<float[]> bumps(new float[long_segments * trans_segments]);
+	thread_random().fill_floats(bumps.get(), long_segments * trans_segments);
 	for(int i = 0; i < long_segments; i++)
-	{
-		double theta = (double)i * TAU / long_segments;
 		for(int j = 0; j < trans_segments; j++)
 		{
-			double phi = (double)j * TAU / trans_segments;
-
-			Vec4 pos(
-				sin(phi),
-				cos(phi),
-				sin(theta),
-				cos(theta)
-			);
-			Vec4 up(
-				sin(phi),
-				cos(phi),
-				-sin(theta),
-				-cos(theta)
-			);
-			ret[i * trans_segments + j] = (pos + fsrand() * bump_height * up).normalize();
+			Vec4f pos(phis.sines[j], phis.cosines[j], thetas.sines[i], thetas.cosines[i]);
+			Vec4f up(phis.sines[j], phis.cosines[j], -thetas.sines[i], -thetas.cosines[i]);
+			ret[i * trans_segments + j] = (pos + (float)((2.0 * bumps[i * trans_segments + j] - 1) * bump_height) * up).normalize();
 		}
-	}
 
 	return ret;
 }
@@ -150,73 +146,9 @@ void TriangleModel::subdivide(bool normalize)
 		for(int v = 0; v < new_num_verts; v++)
 			new_verts[v] = rand_s2();
 		for(int e = 0; e < 3 * new_num_tris; e++)
-			new_elems[e] = random_raw() % new_num_verts;
+			new_elems[e] = random() % new_num_verts;
 	#else
-		for(int v = 0; v < num_vertices; v++)
-		{
-			new_verts[v] = vertices[v];
-			if(normalize)
-				new_verts[v].normalize_in_place();
-		}
-
-		GLuint next_vert_index = num_vertices;
-		std::map<std::pair<GLuint, GLuint>, GLuint> edge_table;
-
-		for(GLuint t = 0; t < num_triangles; t++)
-		{
-			GLuint old_vert_indices[3] = {
-				elements[3 * t + 0],
-				elements[3 * t + 1],
-				elements[3 * t + 2]
-			};
-			GLuint new_vert_indices[3];
-
-			for(GLuint vi = 0; vi < 3; vi++)
-			{
-				GLuint edge_start = old_vert_indices[vi], edge_end = old_vert_indices[(vi + 1) % 3];
-				if(edge_start > edge_end)
-				{
-					GLuint temp = edge_start;
-					edge_start = edge_end;
-					edge_end = temp;
-				}
-
-				if(edge_table.count({edge_start, edge_end}))
-					new_vert_indices[vi] = edge_table[{edge_start, edge_end}];
-				else
-				{
-					if(next_vert_index >= new_num_verts)
-						error("Out of vertices!\n");
-					new_vert_indices[vi] = next_vert_index;
-					new_verts[next_vert_index] = vertices[edge_start] + vertices[edge_end];
-					if(normalize)
-						new_verts[next_vert_index].normalize_in_place();
-					else
-						new_verts[next_vert_index] = 0.5 * new_verts[next_vert_index];
-					edge_table[{edge_start, edge_end}] = next_vert_index;
-					next_vert_index++;
-				}
-			}
-
-			if(4 * 3 * t + 3 * 3 + 2 >= 3 * new_num_tris)
-				error("Out of elements!\n");
-
-			new_elems[4 * 3 * t + 3 * 0 + 0] = old_vert_indices[0];
-			new_elems[4 * 3 * t + 3 * 0 + 1] = new_vert_indices[0];
-			new_elems[4 * 3 * t + 3 * 0 + 2] = new_vert_indices[2];
-		
-			new_elems[4 * 3 * t + 3 * 1 + 0] = old_vert_indices[1];
-			new_elems[4 * 3 * t + 3 * 1 + 1] = new_vert_indices[1];
-			new_elems[4 * 3 * t + 3 * 1 + 2] = new_vert_indices[0];
-		
-			new_elems[4 * 3 * t + 3 * 2 + 0] = old_vert_indices[2];
-			new_elems[4 * 3 * t + 3 * 2 + 1] = new_vert_indices[2];
-			new_elems[4 * 3 * t + 3 * 2 + 2] = new_vert_indices[1];
-		
-			new_elems[4 * 3 * t + 3 * 3 + 0] = new_vert_indices[0];
-			new_elems[4 * 3 * t + 3 * 3 + 1] = new_vert_indices[1];
-			new_elems[4 * 3 * t + 3 * 3 + 2] = new_vert_indices[2];
-		}
+		subdivide_triangles(num_vertices, num_triangles, vertices.get(), elements.get(), normalize, new_verts, new_elems);
 	#endif
 
 	num_vertices = new_num_verts;
@@ -226,43 +158,28 @@ void TriangleModel::subdivide(bool normalize)
 }
 
 
+template<int level, bool normalize>
+static TriangleModel* copy_icosphere()
+{
+	const auto& mesh = icosphere<level, normalize>;
+	return new TriangleModel(mesh.num_vertices, mesh.num_triangles, mesh.vertices, mesh.elements);
+}
 
-#define A	(0.525731112119133606)
-#define B	(0.850650808352039932)
+TriangleModel* make_icosphere(int subdivisions, bool normalize)
+{
+	static_assert(MAX_BAKED_ICOSPHERE_LEVEL == 4, "make_icosphere() needs a case for every baked level.");
 
-const Vec3 icosahedron_verts[20] = {
-	{-A, 0, B},
-	{A, 0, B},
-	{-A, 0, -B},
-	{A, 0, -B},
-	{0, B, A},
-	{0, B, -A},
-	{0, -B, A},
-	{0, -B, -A},
-	{B, A, 0},
-	{-B, A, 0},
-	{B, -A, 0},
-	{-B, -A, 0}
-};
-const GLuint icosahedron_elements[3 * 20] = {
-	1, 4, 0,
-	4, 9, 0,
-	4, 5, 9,
-	8, 5, 4,
-	1, 8, 4,
-	1, 10, 8,
-	10, 3, 8,
-	8, 3, 5,
-	3, 2, 5,
-	3, 7, 2,
-	3, 10, 7,
-	10, 6, 7,
-	6, 11, 7,
-	6, 0, 11,
-	6, 1, 0,
-	10, 1, 6,
-	11, 0, 9,
-	2, 11, 9,
-	5, 2, 9,
-	11, 2, 7
-};
+	TriangleModel* ret;
+	switch(subdivisions < MAX_BAKED_ICOSPHERE_LEVEL ? subdivisions : MAX_BAKED_ICOSPHERE_LEVEL)
+	{
+		case 0:		ret = copy_icosphere<0, false>();	break;
+		case 1:		ret = normalize ? copy_icosphere<1, true>() : copy_icosphere<1, false>();	break;
+		case 2:		ret = normalize ? copy_icosphere<2, true>() : copy_icosphere<2, false>();	break;
+		case 3:		ret = normalize ? copy_icosphere<3, true>() : copy_icosphere<3, false>();	break;
+		default:	ret = normalize ? copy_icosphere<4, true>() : copy_icosphere<4, false>();	break;
+	}
+
+	for(int i = MAX_BAKED_ICOSPHERE_LEVEL; i < subdivisions; i++)
+		ret->subdivide(normalize);
+	return ret;
+}
@@ -2,6 +2,8 @@
 
 #include "Vector.h"
 #include <memory>
+#include <algorithm>
+#include "Utils.h"
 #include "GL/glew.h"
 
 
@@ -16,11 +18,11 @@
 	: : :   make_final_ring = false
 	Number of vertices/normals generated will be long_segments * 2 * (trans_segments + 1).
 */
-std::shared_ptr<Vec4[]> make_torus_verts(int long_segments, int trans_segments, double hole_ratio, double length = TAU, bool make_final_ring = false);
-std::shared_ptr<Vec4[]> make_torus_normals(int long_segments, int trans_segments, double hole_ratio, double length = TAU, bool make_final_ring = false);
+std::shared_ptr<Vec4f[]> make_torus_verts(int long_segments, int trans_segments, double hole_ratio, double length = TAU, bool make_final_ring = false);
+std::shared_ptr<Vec4f[]> make_torus_normals(int long_segments, int trans_segments, double hole_ratio, double length = TAU, bool make_final_ring = false);
 
 //Assumes hole_ratio = 1, length = TAU and make_final_ring = false.
-std::shared_ptr<Vec4[]> make_bumpy_torus_verts(int long_segments, int trans_segments, double bump_height);
+std::shared_ptr<Vec4f[]> make_bumpy_torus_verts(int long_segments, int trans_segments, double bump_height);
 
 /*
 	Generate elements for the above torus. loop_longitudinally = false corresponds to make_final_ring = true (and normally length < TAU).
@@ -31,6 +33,171 @@ std::shared_ptr<GLuint[]> make_torus_quad_strip_indices(int long_segments, int t
 std::shared_ptr<GLuint[]> make_torus_quad_indices(int long_segments, int trans_segments, bool loop_longitudinally = true);
 
 
+/*
+	Split each triangle into four, with a new vertex in the middle of each edge. verts/elems describe a 
+	closed mesh, so there are 3 * num_tris / 2 edges and new_verts and new_elems need room for 
+	num_verts + 3 * num_tris / 2 vertices and 3 * 4 * num_tris elements. The original vertices keep their 
+	indices and the new vertices are numbered in the order their edges first come up in elems.
+	If normalize is true, all the vertices are projected onto the unit sphere.
+	This is constexpr so that the icospheres below can be made at compile time.
+*/
+constexpr void subdivide_triangles(
+	GLuint num_verts, GLuint num_tris, const Vec3* verts, const GLuint* elems, bool normalize,
+	Vec3* new_verts, GLuint* new_elems
+) {
+	GLuint new_num_verts = num_verts + num_tris * 3 / 2;
+	GLuint num_edge_uses = 3 * num_tris;
+
+	for(GLuint v = 0; v < num_verts; v++)
+		new_verts[v] = normalize ? verts[v].normalize() : verts[v];
+
+	//Each triangle uses three edges, and each edge (hopefully) gets used twice. Sorting the uses brings 
+	//the two together, and the one with the lower position gets to make the new vertex.
+	struct EdgeUse {
+		GLuint lo, hi, pos;
+		constexpr bool operator< (const EdgeUse& other) const
+		{
+			if(lo != other.lo)
+				return lo < other.lo;
+			if(hi != other.hi)
+				return hi < other.hi;
+			return pos < other.pos;
+		}
+	};
+
+	EdgeUse* uses = new EdgeUse[num_edge_uses];
+	GLuint* leader = new GLuint[num_edge_uses];
+	GLuint* new_vert_indices = new GLuint[num_edge_uses];
+
+	for(GLuint pos = 0; pos < num_edge_uses; pos++)
+	{
+		GLuint start = elems[pos], end = elems[pos - pos % 3 + (pos + 1) % 3];
+		uses[pos] = start < end ? EdgeUse{start, end, pos} : EdgeUse{end, start, pos};
+	}
+	std::sort(uses, uses + num_edge_uses);
+	for(GLuint i = 0; i < num_edge_uses; i++)
+		leader[uses[i].pos] = (i > 0 && uses[i].lo == uses[i - 1].lo && uses[i].hi == uses[i - 1].hi) ? leader[uses[i - 1].pos] : uses[i].pos;
+
+	GLuint next_vert_index = num_verts;
+	for(GLuint pos = 0; pos < num_edge_uses; pos++)
+	{
+		if(leader[pos] != pos)
+		{
+			new_vert_indices[pos] = new_vert_indices[leader[pos]];
+			continue;
+		}
+		if(next_vert_index >= new_num_verts)
+			error("Out of vertices!\n");
+		Vec3 midpoint = verts[elems[pos]] + verts[elems[pos - pos % 3 + (pos + 1) % 3]];
+		new_verts[next_vert_index] = normalize ? midpoint.normalize() : 0.5 * midpoint;
+		new_vert_indices[pos] = next_vert_index++;
+	}
+
+	for(GLuint t = 0; t < num_tris; t++)
+	{
+		const GLuint* old_vi = elems + 3 * t;
+		const GLuint* new_vi = new_vert_indices + 3 * t;
+		GLuint* out = new_elems + 4 * 3 * t;
+
+		out[3 * 0 + 0] = old_vi[0];
+		out[3 * 0 + 1] = new_vi[0];
+		out[3 * 0 + 2] = new_vi[2];
+
+		out[3 * 1 + 0] = old_vi[1];
+		out[3 * 1 + 1] = new_vi[1];
+		out[3 * 1 + 2] = new_vi[0];
+
+		out[3 * 2 + 0] = old_vi[2];
+		out[3 * 2 + 1] = new_vi[2];
+		out[3 * 2 + 2] = new_vi[1];
+
+		out[3 * 3 + 0] = new_vi[0];
+		out[3 * 3 + 1] = new_vi[1];
+		out[3 * 3 + 2] = new_vi[2];
+	}
+
+	delete[] uses;
+	delete[] leader;
+	delete[] new_vert_indices;
+}
+
+
+template<GLuint V, GLuint T>
+struct BakedTriangleMesh {
+	static constexpr GLuint num_vertices = V, num_triangles = T;
+	Vec3 vertices[V];
+	GLuint elements[3 * T];
+};
+
+template<GLuint V, GLuint T>
+constexpr BakedTriangleMesh<V + 3 * T / 2, 4 * T> subdivide_baked(const BakedTriangleMesh<V, T>& mesh, bool normalize)
+{
+	BakedTriangleMesh<V + 3 * T / 2, 4 * T> ret{};
+	subdivide_triangles(V, T, mesh.vertices, mesh.elements, normalize, ret.vertices, ret.elements);
+	return ret;
+}
+
+
+#define A	(0.525731112119133606)
+#define B	(0.850650808352039932)
+
+inline constexpr BakedTriangleMesh<12, 20> icosahedron = {
+	{
+		{-A, 0, B},
+		{A, 0, B},
+		{-A, 0, -B},
+		{A, 0, -B},
+		{0, B, A},
+		{0, B, -A},
+		{0, -B, A},
+		{0, -B, -A},
+		{B, A, 0},
+		{-B, A, 0},
+		{B, -A, 0},
+		{-B, -A, 0}
+	},
+	{
+		1, 4, 0,
+		4, 9, 0,
+		4, 5, 9,
+		8, 5, 4,
+		1, 8, 4,
+		1, 10, 8,
+		10, 3, 8,
+		8, 3, 5,
+		3, 2, 5,
+		3, 7, 2,
+		3, 10, 7,
+		10, 6, 7,
+		6, 11, 7,
+		6, 0, 11,
+		6, 1, 0,
+		10, 1, 6,
+		11, 0, 9,
+		2, 11, 9,
+		5, 2, 9,
+		11, 2, 7
+	}
+};
+
+#undef A
+#undef B
+
+
+//The icosahedron subdivided level times, worked out by the compiler. (Level 4 has 2562 vertices.)
+#define MAX_BAKED_ICOSPHERE_LEVEL	4
+
+constexpr GLuint icosphere_num_vertices(int level) {return 10 * (1 << (2 * level)) + 2;}
+constexpr GLuint icosphere_num_triangles(int level) {return 20 * (1 << (2 * level));}
+
+template<int level, bool normalize>
+inline constexpr BakedTriangleMesh<icosphere_num_vertices(level), icosphere_num_triangles(level)> icosphere =
+	subdivide_baked(icosphere<level - 1, normalize>, normalize);
+
+template<bool normalize>
+inline constexpr BakedTriangleMesh<12, 20> icosphere<0, normalize> = icosahedron;
+
+
 class TriangleModel {
 	GLuint num_vertices, num_triangles;
 	std::unique_ptr<Vec3[]> vertices;
@@ -47,5 +214,5 @@ public:
 	void subdivide(bool normalize);
 };
 
-extern const Vec3 icosahedron_verts[20];
-extern const GLuint icosahedron_elements[3 * 20];
+//The icosahedron subdivided subdivisions times. Up to MAX_BAKED_ICOSPHERE_LEVEL, this just copies a baked mesh.
+TriangleModel* make_icosphere(int subdivisions, bool normalize);
@@ -4,9 +4,15 @@
 #include <fcntl.h>
 #include <io.h>
 #include <stdint.h>
+#include <string.h>
 #include <memory>
+#include <vector>
+#include <algorithm>
 #include "Utils.h"
 #include "Framebuffer.h"
+#include "GLState.h"
+#include "RenderQueue.h"
+#include "Rotor.h"
 
 #pragma warning(disable : 4244)		//conversion from double to float
 
@@ -14,9 +20,8 @@
 //#define VERIFY_BUFFER_ASSIGNMENT
 
 
-Model::Model(int num_verts, const Vec4* verts, const Vec4* vert_colors)
+Model::Model(int num_verts, const Vec4f* verts, const Vec4f* vert_colors)
 {
-	int i;
 	primitive = GL_POINTS;
 	num_vertices = num_verts;
 
@@ -24,15 +29,13 @@ Model::Model(int num_verts, const Vec4* verts, const Vec4* vert_colors)
 	num_primitives = 1;
 	vertices_per_primitive = num_verts;
 
-	vertices = std::unique_ptr<Vec4[]>(new Vec4[num_verts]);
+	vertices = std::unique_ptr<Vec4f[]>(new Vec4f[num_verts]);
 	if(verts)
-		for(i = 0; i < num_verts; i++)
-			vertices[i] = verts[i];
+		memcpy(vertices.get(), verts, num_verts * sizeof(Vec4f));
 	if(vert_colors)
 	{
-		vertex_colors = std::unique_ptr<Vec4[]>(new Vec4[num_verts]);
-		for(i = 0; i < num_verts; i++)
-			vertex_colors[i] = vert_colors[i];
+		vertex_colors = std::unique_ptr<Vec4f[]>(new Vec4f[num_verts]);
+		memcpy(vertex_colors.get(), vert_colors, num_verts * sizeof(Vec4f));
 	}
 	else
 		vertex_colors = NULL;
@@ -41,6 +44,7 @@ Model::Model(int num_verts, const Vec4* verts, const Vec4* vert_colors)
 
 	vertex_buffer = vertex_color_buffer = element_buffer = normal_buffer = 0;
 	raw_vertex_array = 0;
+	bounding_radius = TAU / 2;
 }
 
 Model::Model(
@@ -48,48 +52,44 @@ Model::Model(
 	int num_verts,
 	int verts_per_prim,
 	int num_prims,
-	const Vec4* verts,
+	const Vec4f* verts,
 	const unsigned int* ixes,
-	const Vec4* vert_colors,
-	const Vec4* norms
+	const Vec4f* vert_colors,
+	const Vec4f* norms
 ) {
-	int i;
 	primitive = prim;
 	num_vertices = num_verts;
 	vertices_per_primitive = verts_per_prim;
 	num_primitives = num_prims;
-	vertices = std::unique_ptr<Vec4[]>(new Vec4[num_verts]);
+	vertices = std::unique_ptr<Vec4f[]>(new Vec4f[num_verts]);
 	if(verts)
-		for(i = 0; i < num_verts; i++)
-			vertices[i] = verts[i];
+		memcpy(vertices.get(), verts, num_verts * sizeof(Vec4f));
 	if(verts_per_prim)
 	{
 		elements = std::unique_ptr<GLuint[]>(new GLuint[num_prims * verts_per_prim]);
 		if(ixes)
-			for(i = 0; i < num_prims * verts_per_prim; i++)
-				elements[i] = ixes[i];
+			memcpy(elements.get(), ixes, num_prims * verts_per_prim * sizeof(GLuint));
 	}
 	else
 		elements = NULL;
 	if(vert_colors)
 	{
-		vertex_colors = std::unique_ptr<Vec4[]>(new Vec4[num_verts]);
-		for(i = 0; i < num_verts; i++)
-			vertex_colors[i] = vert_colors[i];
+		vertex_colors = std::unique_ptr<Vec4f[]>(new Vec4f[num_verts]);
+		memcpy(vertex_colors.get(), vert_colors, num_verts * sizeof(Vec4f));
 	}
 	else
 		vertex_colors = NULL;
 	if(norms)
 	{
-		normals = std::unique_ptr<Vec4[]>(new Vec4[num_verts]);
-		for(i = 0; i < num_verts; i++)
-			normals[i] = norms[i];
+		normals = std::unique_ptr<Vec4f[]>(new Vec4f[num_verts]);
+		memcpy(normals.get(), norms, num_verts * sizeof(Vec4f));
 	}
 	else
 		normals = NULL;
 
 	vertex_buffer = vertex_color_buffer = element_buffer = normal_buffer = 0;
 	raw_vertex_array = 0;
+	bounding_radius = TAU / 2;
 }
 
 Model::~Model()
@@ -101,7 +101,10 @@ Model::~Model()
 	if(element_buffer)
 		glDeleteBuffers(1, &element_buffer);
 	if(raw_vertex_array)
+	{
 		glDeleteVertexArrays(1, &raw_vertex_array);
+		state_forget_vertex_array(raw_vertex_array);
+	}
 }
 
 
@@ -109,16 +112,16 @@ GLuint Model::make_vertex_array()
 {
 	GLuint vertex_array;
 	glGenVertexArrays(1, &vertex_array);
-	glBindVertexArray(vertex_array);
+	state_bind_vertex_array(vertex_array);
 
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-	glVertexAttribPointer(0, 4, GL_DOUBLE, GL_FALSE, sizeof(Vec4), (void*)0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Vec4f), (void*)0);
 	glEnableVertexAttribArray(0);
 
 	if(vertex_color_buffer)
 	{
 		glBindBuffer(GL_ARRAY_BUFFER, vertex_color_buffer);
-		glVertexAttribPointer(1, 4, GL_DOUBLE, GL_FALSE, sizeof(Vec4), (void*)0);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Vec4f), (void*)0);
 		glEnableVertexAttribArray(1);
 	}
 
@@ -128,11 +131,11 @@ GLuint Model::make_vertex_array()
 	if(normal_buffer)
 	{
 		glBindBuffer(GL_ARRAY_BUFFER, normal_buffer);
-		glVertexAttribPointer(2, 4, GL_DOUBLE, GL_FALSE, sizeof(Vec4), (void*)0);
+		glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Vec4f), (void*)0);
 		glEnableVertexAttribArray(2);
 	}
 
-	glBindVertexArray(0);
+	state_bind_vertex_array(0);
 
 	return vertex_array;
 }
@@ -141,10 +144,15 @@ void Model::prepare_to_render()
 {
 	if(vertex_buffer)
 		error("Model was already prepared for rendering.\n");
+
+	double min_cos = 1;
+	for(int i = 0; i < num_vertices; i++)
+		min_cos = std::min(min_cos, (double)vertices[i].w / vertices[i].mag());
+	bounding_radius = acos(std::max(min_cos, -1.0));
 		
 	glGenBuffers(1, &vertex_buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(Vec4), vertices.get(), GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(Vec4f), vertices.get(), GL_STATIC_DRAW);
 	#ifdef VERIFY_BUFFERS
 		fprintf(stderr, "%d vertices = %d\n", num_vertices, vertex_buffer);
 		for(int i = 0; i < num_vertices; i++)
@@ -158,7 +166,7 @@ void Model::prepare_to_render()
 	{
 		glGenBuffers(1, &vertex_color_buffer);
 		glBindBuffer(GL_ARRAY_BUFFER, vertex_color_buffer);
-		glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(Vec4), vertex_colors.get(), GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(Vec4f), vertex_colors.get(), GL_STATIC_DRAW);
 		#ifdef VERIFY_BUFFERS
 			fprintf(stderr, "%d vertex colors = %d\n", num_vertices, vertex_buffer);
 			for(int i = 0; i < num_vertices; i++)
@@ -171,6 +179,8 @@ void Model::prepare_to_render()
 
 	if(elements)
 	{
+		//The element array binding belongs to the VAO, and draws leave their VAO bound.
+		state_bind_vertex_array(0);
 		glGenBuffers(1, &element_buffer);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_primitives * vertices_per_primitive * sizeof(GLuint), elements.get(), GL_STATIC_DRAW);
@@ -190,7 +200,7 @@ void Model::prepare_to_render()
 	{
 		glGenBuffers(1, &normal_buffer);
 		glBindBuffer(GL_ARRAY_BUFFER, normal_buffer);
-		glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(Vec4), normals.get(), GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(Vec4f), normals.get(), GL_STATIC_DRAW);
 		#ifdef VERIFY_BUFFERS
 			fprintf(stderr, "%d normals = %d\n", num_vertices, normal_buffer);
 			for(int i = 0; i < num_vertices; i++)
@@ -206,18 +216,18 @@ void Model::prepare_to_render()
 
 ShaderProgram* Model::get_shader_program(bool shadow, bool instanced_xforms, bool instanced_base_colors)
 {
-	auto options = std::set<const char*>();
+	ShaderOptions options = 0;
 	if(vertex_colors)
-		options.insert(DEFINE_VERTEX_COLOR);
+		options |= OPTION_VERTEX_COLOR;
 	if(normals)
-		options.insert(DEFINE_VERTEX_NORMAL);
+		options |= OPTION_VERTEX_NORMAL;
 	if(instanced_base_colors)
-		options.insert(DEFINE_INSTANCED_BASE_COLOR);
+		options |= OPTION_INSTANCED_BASE_COLOR;
 	if(shadow)
-		options.insert(DEFINE_SHADOW);
-	auto vert_options = options;
+		options |= OPTION_SHADOW;
+	ShaderOptions vert_options = options;
 	if(instanced_xforms)
-		vert_options.insert(DEFINE_INSTANCED_XFORM);
+		vert_options |= OPTION_INSTANCED_XFORM;
 	return ShaderProgram::get(
 		Shader::get(vert, vert_options),
 		Shader::get(primitive == GL_POINTS ? geom_points : geom_triangles, options),
@@ -226,61 +236,70 @@ ShaderProgram* Model::get_shader_program(bool shadow, bool instanced_xforms, boo
 }
 
 
-void Model::draw(const Mat4& xform, const Vec4& base_color)
+//Which of the faces being drawn in the current shadow pass a model at model_view_xform could show up in.
+static unsigned shadow_faces_touched(const Mat4f& model_view_xform, double radius)
+{
+	return get_shadow_face_mask() & cube_faces_touched(Vec4(model_view_xform.get_column(_w)), radius);
+}
+
+
+void Model::draw(const Mat4& xform, const Vec4f& base_color)
 {
 	if(!vertex_buffer)
 		prepare_to_render();
 		
-	ShaderProgram* raw_program = get_shader_program(s_is_shadow_pass(), false, false);
-	raw_program->use();
-	raw_program->set_vector("base_color", base_color);
-	raw_program->set_matrix("model_view_xform", ~s_curcam->get_mat() * xform);		//That should be the inverse of cam_mat, but it _should_ always be SO(4), so the inverse _should_ always be the transpose....
-	
-	glBindVertexArray(raw_vertex_array);
-	draw_raw();
-	glBindVertexArray(0);
+	RenderItem item;
+	item.model_view_xform = Mat4f(~s_curcam->get_mat() * xform);		//That should be the inverse of cam_mat, but cam_mat is built from a unit Rotor, so the transpose is the inverse.
+	item.face_mask = s_is_shadow_pass() ? shadow_faces_touched(item.model_view_xform, bounding_radius) : ALL_CUBE_FACES;
+	if(!item.face_mask)
+		return;
+	item.base_color = base_color;
+	item.program = get_shader_program(s_is_shadow_pass(), false, false);
+	item.model = this;
+	item.vertex_array = raw_vertex_array;
+	item.instance_count = 0;
+	item.set_base_color = true;
+	item.key = make_sort_key(RENDER_LAYER_OPAQUE, item.program->get_index(), raw_vertex_array, item.model_view_xform.data[_w][_w]);
+	s_render_queue.submit(item);
 }
 
 
-void Model::bind_xform_array(GLuint vertex_array, int count, const Mat4* xforms)
+void Model::bind_xform_array(GLuint vertex_array, int count, const Mat4f* xforms)
 {
-	glBindVertexArray(vertex_array);
+	state_bind_vertex_array(vertex_array);
 
 	GLuint xform_buffer;
 	glGenBuffers(1, &xform_buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, xform_buffer);
 
-	float* temp = new float[16 * count];
-	for(int mat = 0; mat < count; mat++)
-		for(int i = 0; i < 4; i++)
-			for(int j = 0; j < 4; j++)
-				temp[mat * 16 + j * 4 + i] = xforms[mat].data[i][j];
-	glBufferData(GL_ARRAY_BUFFER, count * 16 * sizeof(float), temp, GL_STATIC_DRAW);
-	delete[] temp;
+	//Instances are sent as Rotors (8 floats) rather than matrices (16 floats). The vertex shader applies them directly.
+	std::unique_ptr<Rotorf[]> temp(new Rotorf[count]);
+	rotors_from_mats(xforms, temp.get(), count);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(Rotorf), temp.get(), GL_STATIC_DRAW);
 
-	for(int i = 0; i < 4; i++)
+	for(int i = 0; i < 2; i++)
 	{
 		glEnableVertexAttribArray(3 + i);
-		glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(float), (void*)(4 * i * sizeof(float)));
+		glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(Rotorf), (void*)(4 * i * sizeof(float)));
 		glVertexAttribDivisor(3 + i, 1);
 	}
 
-	glBindVertexArray(0);
+	state_bind_vertex_array(0);
 }
 
-void Model::bind_color_array(GLuint vertex_array, int count, const Vec4* base_colors)
+void Model::bind_color_array(GLuint vertex_array, int count, const Vec4f* base_colors)
 {
-	glBindVertexArray(vertex_array);
+	state_bind_vertex_array(vertex_array);
 
 	GLuint base_color_buffer;
 	glGenBuffers(1, &base_color_buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, base_color_buffer);
-	glBufferData(GL_ARRAY_BUFFER, count * sizeof(Vec4), base_colors, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(Vec4f), base_colors, GL_STATIC_DRAW);
 	glEnableVertexAttribArray(7);
-	glVertexAttribPointer(7, 4, GL_DOUBLE, GL_FALSE, sizeof(Vec4), (void*)0);
+	glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(Vec4f), (void*)0);
 	glVertexAttribDivisor(7, 1);
 
-	glBindVertexArray(0);
+	state_bind_vertex_array(0);
 }
 
 void Model::draw_raw()
@@ -338,7 +357,7 @@ void Model::draw_instanced(int count)
 }
 
 
-DrawFunc Model::make_draw_func(int count, const Mat4* xforms, Vec4 base_color, bool use_instancing)
+DrawFunc Model::make_draw_func(int count, const Mat4f* xforms, const Vec4f& base_color, bool use_instancing)
 {
 	if(!vertex_buffer)
 		prepare_to_render();
@@ -349,37 +368,49 @@ DrawFunc Model::make_draw_func(int count, const Mat4* xforms, Vec4 base_color, b
 		bind_xform_array(vertex_array, count, xforms);
 
 		return [count, vertex_array, base_color, this]() {
-			ShaderProgram* program = get_shader_program(s_is_shadow_pass(), true, false);
-			program->use();
-			glBindVertexArray(vertex_array);
-			program->set_vector("base_color", base_color);
-			draw_instanced(count);
-			glBindVertexArray(0);
+			RenderItem item;
+			item.base_color = base_color;
+			item.program = get_shader_program(s_is_shadow_pass(), true, false);
+			item.model = this;
+			item.vertex_array = vertex_array;
+			item.instance_count = count;
+			item.face_mask = ALL_CUBE_FACES;
+			item.set_base_color = true;
+			item.key = make_sort_key(RENDER_LAYER_OPAQUE, item.program->get_index(), vertex_array, 1);
+			s_render_queue.submit(item);
 		};
 	}
 	else
 	{
-		std::shared_ptr<Mat4[]> temp_xforms(new Mat4[count]);
-		for(int i = 0; i < count; i++)
-			temp_xforms[i] = xforms[i];
-
-		return [count, temp_xforms, base_color, this]() {
-			ShaderProgram* program = get_shader_program(s_is_shadow_pass(), false, false);
-			program->use();
-			program->set_vector("base_color", base_color);
-			glBindVertexArray(raw_vertex_array);
+		std::shared_ptr<Mat4f[]> temp_xforms(new Mat4f[count]);
+		memcpy(temp_xforms.get(), xforms, count * sizeof(Mat4f));
+		std::shared_ptr<Mat4f[]> model_view_xforms(new Mat4f[count]);
+
+		return [count, temp_xforms, model_view_xforms, base_color, this]() {
+			RenderItem item;
+			item.base_color = base_color;
+			item.program = get_shader_program(s_is_shadow_pass(), false, false);
+			item.model = this;
+			item.vertex_array = raw_vertex_array;
+			item.instance_count = 0;
+			item.set_base_color = true;
+			transform(Mat4f(~s_curcam->get_mat()), temp_xforms.get(), model_view_xforms.get(), count);
+			bool shadow = s_is_shadow_pass();
 			for(int i = 0; i < count; i++)
 			{
-				program->set_matrix("model_view_xform", ~s_curcam->get_mat() * temp_xforms[i]);
-				draw_raw();
+				item.model_view_xform = model_view_xforms[i];
+				item.face_mask = shadow ? shadow_faces_touched(item.model_view_xform, bounding_radius) : ALL_CUBE_FACES;
+				if(!item.face_mask)
+					continue;
+				item.key = make_sort_key(RENDER_LAYER_OPAQUE, item.program->get_index(), raw_vertex_array, model_view_xforms[i].data[_w][_w]);
+				s_render_queue.submit(item);
 			}
-			glBindVertexArray(0);
 		};
 	}
 }
 
 
-DrawFunc Model::make_draw_func(int count, const Mat4* xforms, const Vec4* base_colors, bool use_instancing)
+DrawFunc Model::make_draw_func(int count, const Mat4f* xforms, const Vec4f* base_colors, bool use_instancing)
 {
 	if(!vertex_buffer)
 		prepare_to_render();
@@ -391,35 +422,44 @@ DrawFunc Model::make_draw_func(int count, const Mat4* xforms, const Vec4* base_c
 		bind_color_array(vertex_array, count, base_colors);
 
 		return [count, vertex_array, this]() {
-			ShaderProgram* program = get_shader_program(s_is_shadow_pass(), true, true);
-			program->use();
-			glBindVertexArray(vertex_array);
-			draw_instanced(count);
-			glBindVertexArray(0);
+			RenderItem item;
+			item.program = get_shader_program(s_is_shadow_pass(), true, true);
+			item.model = this;
+			item.vertex_array = vertex_array;
+			item.instance_count = count;
+			item.face_mask = ALL_CUBE_FACES;
+			item.set_base_color = false;
+			item.key = make_sort_key(RENDER_LAYER_OPAQUE, item.program->get_index(), vertex_array, 1);
+			s_render_queue.submit(item);
 		};
 	}
 	else
 	{
-		std::shared_ptr<Mat4[]> temp_xforms(new Mat4[count]);
-		std::shared_ptr<Vec4[]> temp_colors(new Vec4[count]);
-		for(int i = 0; i < count; i++)
-		{
-			temp_xforms[i] = xforms[i];
-			temp_colors[i] = base_colors[i];
-		}
-
-		return [count, temp_xforms, temp_colors, this]() {
-			ShaderProgram* program = get_shader_program(s_is_shadow_pass(), false, false);
-			program->use();
-			glBindVertexArray(raw_vertex_array);
+		std::shared_ptr<Mat4f[]> temp_xforms(new Mat4f[count]);
+		std::shared_ptr<Vec4f[]> temp_colors(new Vec4f[count]);
+		memcpy(temp_xforms.get(), xforms, count * sizeof(Mat4f));
+		memcpy(temp_colors.get(), base_colors, count * sizeof(Vec4f));
+		std::shared_ptr<Mat4f[]> model_view_xforms(new Mat4f[count]);
+
+		return [count, temp_xforms, temp_colors, model_view_xforms, this]() {
+			RenderItem item;
+			item.program = get_shader_program(s_is_shadow_pass(), false, false);
+			item.model = this;
+			item.vertex_array = raw_vertex_array;
+			item.instance_count = 0;
+			item.set_base_color = true;
+			transform(Mat4f(~s_curcam->get_mat()), temp_xforms.get(), model_view_xforms.get(), count);
+			bool shadow = s_is_shadow_pass();
 			for(int i = 0; i < count; i++)
 			{
-				Vec4 base_color = temp_colors[i];
-				program->set_vector("base_color", base_color);
-				program->set_matrix("model_view_xform", ~s_curcam->get_mat() * temp_xforms[i]);
-				draw_raw();
+				item.model_view_xform = model_view_xforms[i];
+				item.face_mask = shadow ? shadow_faces_touched(item.model_view_xform, bounding_radius) : ALL_CUBE_FACES;
+				if(!item.face_mask)
+					continue;
+				item.base_color = temp_colors[i];
+				item.key = make_sort_key(RENDER_LAYER_OPAQUE, item.program->get_index(), raw_vertex_array, model_view_xforms[i].data[_w][_w]);
+				s_render_queue.submit(item);
 			}
-			glBindVertexArray(0);
 		};
 	}
 }
@@ -447,10 +487,14 @@ void Model::generate_vertex_colors(double scale)
 {
 	if(vertex_colors)
 		error("Model already has vertex colors.");
-	vertex_colors = std::unique_ptr<Vec4[]>(new Vec4[num_vertices]);
+	vertex_colors = std::unique_ptr<Vec4f[]>(new Vec4f[num_vertices]);
 	if(scale > 0)
+	{
+		std::unique_ptr<float[]> rands(new float[3 * num_vertices]);
+		thread_random().fill_floats(rands.get(), 3 * num_vertices);
 		for(int i = 0; i < num_vertices; i++)
-			vertex_colors[i] = Vec4(scale * frand(), scale * frand(), scale * frand(), 0);
+			vertex_colors[i] = (float)scale * Vec4f(rands[3 * i], rands[3 * i + 1], rands[3 * i + 2], 0);
+	}
 }
 
 void Model::generate_primitive_colors(double scale)
@@ -460,25 +504,28 @@ void Model::generate_primitive_colors(double scale)
 	if(!elements)
 		error("Model has no primitives to color.");
 
-	std::unique_ptr<Vec4[]> old_verts = std::move(vertices);
+	std::unique_ptr<Vec4f[]> old_verts = std::move(vertices);
 	num_vertices = num_primitives * vertices_per_primitive;
-	vertices.reset(new Vec4[num_vertices]);
+	vertices.reset(new Vec4f[num_vertices]);
 
 	std::unique_ptr<GLuint[]> old_elements = std::move(elements);
 	elements = NULL;
 
-	std::unique_ptr<Vec4[]> old_normals;
+	std::unique_ptr<Vec4f[]> old_normals;
 	if(normals)
 	{
 		old_normals = std::move(normals);
-		normals.reset(new Vec4[num_vertices]);
+		normals.reset(new Vec4f[num_vertices]);
 	}
 
-	vertex_colors = std::unique_ptr<Vec4[]>(new Vec4[num_vertices]);
+	vertex_colors = std::unique_ptr<Vec4f[]>(new Vec4f[num_vertices]);
+
+	std::unique_ptr<float[]> rands(new float[3 * num_primitives]);
+	thread_random().fill_floats(rands.get(), 3 * num_primitives);
 
 	for(int i = 0; i < num_primitives; i++)
 	{
-		Vec4 temp(scale * frand(), scale * frand(), scale * frand(), 0);
+		Vec4f temp = (float)scale * Vec4f(rands[3 * i], rands[3 * i + 1], rands[3 * i + 2], 0);
 		for(int j = 0; j < vertices_per_primitive; j++)
 		{
 			int ix = vertices_per_primitive * i + j;
@@ -491,16 +538,20 @@ void Model::generate_primitive_colors(double scale)
 }
 
 
-typedef std::function<void(int, int, int)> TriangleFunc;
-
 /*
 	Convert a primitive into triangles. Except it's indirect, so convert a primitive into the 
 	indices into the elements list corresponding to those triangles. It's indirect because 
 	Models may or may not use element lists, so the actual list being indexed might be 
-	elements or vertices.
+	elements or vertices. The triangles are appended to out, three indices each.
 */
-void _split_into_triangles_indirect(int primitive, int start, int verts_per_primitive, TriangleFunc emit_triangle)
+void _split_into_triangles_indirect(int primitive, int start, int verts_per_primitive, std::vector<int>& out)
 {
+	auto emit_triangle = [&out](int a, int b, int c) {
+		out.push_back(a);
+		out.push_back(b);
+		out.push_back(c);
+	};
+
 	switch(primitive)
 	{
 		case GL_TRIANGLES:
@@ -523,82 +574,83 @@ void _split_into_triangles_indirect(int primitive, int start, int verts_per_prim
 			}
 			break;
 		default:
-			error("Don't know how to split primitive type %d into triangles.\n");
+			error("Don't know how to split primitive type %d into triangles.\n", primitive);
 			break;
 	}
 }
 
+//Triangles (or vertices) per chunk of normal generation.
+#define NORMAL_CHUNK_SIZE		(2048)
+
+/*
+	The triangle normals are computed in parallel, and then each vertex sums the normals of its 
+	own triangles, found through a vertex -> triangle adjacency list. The list is in triangle 
+	order, so the sums come out the same no matter how many cores there are, and nothing needs 
+	more than a few entries per triangle or vertex.
+*/
 void Model::generate_normals()
 {
-	normals = std::unique_ptr<Vec4[]>(new Vec4[num_vertices]);
-	for(int i = 0; i < num_vertices; i++)
-		normals[i] = Vec4(0, 0, 0, 0);
+	//Flatten everything into one list of triangles (as vertex indices).
+	std::vector<int> triangles;
+	triangles.reserve(3 * 2 * num_primitives * (vertices_per_primitive - 2));
+	for(int prim = 0; prim < num_primitives; prim++)
+		_split_into_triangles_indirect(primitive, prim * vertices_per_primitive, vertices_per_primitive, triangles);
+	if(elements)
+		for(auto& ix : triangles)
+			ix = elements[ix];
 
-	std::shared_ptr<int[]> times_touched(new int[num_vertices]);
+	int num_triangles = triangles.size() / 3;
 
-	for(int prim = 0; prim < num_primitives; prim++)
+	//The normals are stored as floats, but they're computed and summed in double.
+	std::vector<Vec4> triangle_normals(num_triangles);
+	parallel_chunks((num_triangles + NORMAL_CHUNK_SIZE - 1) / NORMAL_CHUNK_SIZE, [&](int chunk) {
+		int end = std::min((chunk + 1) * NORMAL_CHUNK_SIZE, num_triangles);
+		for(int t = chunk * NORMAL_CHUNK_SIZE; t < end; t++)
+		{
+			/*
+				The normal of the triangle in the tangent space at va is perpendicular to va, vb - va 
+				and vc - va, which is cross(va, vb, vc), and it comes out with the right handedness.
+			*/
+			Vec4 normal = cross(Vec4(vertices[triangles[3 * t]]), Vec4(vertices[triangles[3 * t + 1]]), Vec4(vertices[triangles[3 * t + 2]]));
+			double mag2 = normal.mag2();
+			triangle_normals[t] = mag2 == 0 ? Vec4(0, 0, 0, 0) : normal / sqrt(mag2);		//0 for a degenerate triangle
+		}
+	});
+
+	//Adjacency list of corners (3 * triangle + corner), grouped by vertex, by counting sort.
+	std::vector<int> first_corner(num_vertices + 1, 0), corners(triangles.size());
+	for(int ix : triangles)
+		first_corner[ix + 1]++;
+	for(int i = 0; i < num_vertices; i++)
+		first_corner[i + 1] += first_corner[i];
 	{
-		_split_into_triangles_indirect(
-			primitive,
-			prim * vertices_per_primitive,
-			vertices_per_primitive,
-			[this, times_touched](int a, int b, int c) {
-				if(elements)
-				{
-					a = elements[a];
-					b = elements[b];
-					c = elements[c];
-				}
-				Vec4 va = vertices[a], vb = vertices[b], vc = vertices[c];
-
-				/*
-					You might think vb and vc are close enough to va that the tangents 
-					don't need to be orthogonalized to va (since the final normals are 
-					going to be orthonormalized against vb and vc anyway). But no, the 
-					~0.02 dot product between the tangents and va occasionally 
-					derails the normal generation catastrophically.
-				*/
-				Vec4 tangent = vb - va;
-				tangent = (tangent - va * (va * tangent)).normalize();
-				Vec4 bitangent = vc - va;
-				bitangent = (bitangent - tangent * (tangent * bitangent) - va * (va * bitangent)).normalize();
-
-				Vec4 temp;
-				do {
-					temp = rand_s3();
-				}while((temp - tangent).mag2() < 0.2 || (temp - bitangent).mag2() < 0.2 || (temp - va).mag2() < 0.2);
-				//In theory we should check against vertices b and c as well, but we assume they're close to a.
-
-				//an approximate normal to the triangle. We check for handedness only once because vb and vc are close to va.
-				temp = temp - tangent * (tangent * temp) - bitangent * (bitangent * temp) - va * (va * temp);
-				Mat4 check = Mat4::from_columns(tangent, bitangent, temp, va);
-				if(check.determinant() > 0)		//Why is this >?
-					temp = -temp;
-
-				//We have to orthonormalize temp three times because va, vb and vc are not parallel. Yes, there's 
-				//no such thing as a flat triangle in a curved space.
-				normals[a] = normals[a] + temp.normalize();
-				times_touched[a]++;
-
-				normals[b] = normals[b] + (temp - vb * (vb * temp)).normalize();
-				times_touched[b]++;
-
-				normals[c] = normals[c] + (temp - vc * (vc * temp)).normalize();
-				times_touched[c]++;
-			}
-		);
+		std::vector<int> next(first_corner.begin(), first_corner.end() - 1);
+		for(int corner = 0; corner < (int)triangles.size(); corner++)
+			corners[next[triangles[corner]]++] = corner;
 	}
 
-	for(int i = 0; i < num_vertices; i++)
-		normals[i] = (normals[i] / times_touched[i]).normalize();
+	normals = std::unique_ptr<Vec4f[]>(new Vec4f[num_vertices]);
+	parallel_chunks((num_vertices + NORMAL_CHUNK_SIZE - 1) / NORMAL_CHUNK_SIZE, [&](int chunk) {
+		int end = std::min((chunk + 1) * NORMAL_CHUNK_SIZE, num_vertices);
+		for(int i = chunk * NORMAL_CHUNK_SIZE; i < end; i++)
+		{
+			/*
+				cross(va, vb, vc) is perpendicular to all three of the triangle's vertices, so every 
+				triangle normal is already in the tangent space at each of its corners, and so is 
+				their sum. Degenerate triangles add 0.
+			*/
+			Vec4 sum(0, 0, 0, 0);
+			for(int k = first_corner[i]; k < first_corner[i + 1]; k++)
+				sum = sum + triangle_normals[corners[k] / 3];
+			double mag2 = sum.mag2();
+			normals[i] = Vec4f(mag2 == 0 ? sum : sum / sqrt(mag2));		//0 if the vertex has no non-degenerate triangles
+		}
+	});
 }
 
 
 Model* Model::make_icosahedron(double scale, int subdivisions, bool normalize) {
-	std::unique_ptr<TriangleModel> ico(new TriangleModel(12, 20, icosahedron_verts, icosahedron_elements));
-
-	for(int i = 0; i < subdivisions; i++)
-		ico->subdivide(normalize);
+	std::unique_ptr<TriangleModel> ico(make_icosphere(subdivisions, normalize));
 
 	return new Model(
 		GL_TRIANGLES,
@@ -687,9 +739,9 @@ Model* Model::make_bumpy_torus(int longitudinal_segments, int transverse_segment
 }
 
 
-std::shared_ptr<Vec4[]> Model::s3ify(int count, double scale, const Vec3* vertices)
+std::shared_ptr<Vec4f[]> Model::s3ify(int count, double scale, const Vec3* vertices)
 {
-	std::shared_ptr<Vec4[]> ret(new Vec4[count]);
+	std::shared_ptr<Vec4f[]> ret(new Vec4f[count]);
 	for(int i = 0; i < count; i++)
 	{
 		/*
@@ -697,12 +749,12 @@ std::shared_ptr<Vec4[]> Model::s3ify(int count, double scale, const Vec3* vertic
 			get the magnitude and take its secant to preserve distance from the origin.
 		*/
 		const Vec3& temp = vertices[i];
-		ret[i] = Vec4(
+		ret[i] = Vec4f(Vec4(
 			temp.x * scale,
 			temp.y * scale,
 			temp.z * scale,
 			1
-		).normalize();
+		).normalize());
 	}
 
 	return ret;
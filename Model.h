@@ -14,16 +14,16 @@ typedef std::function <void()> DrawFunc;
 class Model
 {
 public:
-	Model(int num_verts, const Vec4* verts = NULL, const Vec4* vert_colors = NULL);		//for GL_POINTS
+	Model(int num_verts, const Vec4f* verts = NULL, const Vec4f* vert_colors = NULL);		//for GL_POINTS
 	Model(
 		int prim,
 		int num_verts,
 		int verts_per_prim,
 		int num_prims,
-		const Vec4* verts = NULL,
+		const Vec4f* verts = NULL,
 		const unsigned int* ixes = NULL,
-		const Vec4* vert_colors = NULL,
-		const Vec4* norms = NULL
+		const Vec4f* vert_colors = NULL,
+		const Vec4f* norms = NULL
 	);
 
 	~Model();
@@ -45,27 +45,31 @@ public:
 
 	void generate_normals();
 
-	void draw(const Mat4& xform, const Vec4& base_color);
+	//draw() and the DrawFuncs don't draw anything right away. They submit to s_render_queue (see RenderQueue.h).
+	void draw(const Mat4& xform, const Vec4f& base_color);
 
 	//Note: Instancing is broken. Dunno why, but passing use_instancing = true makes rendering much slower.
-	DrawFunc make_draw_func(int count, const Mat4* xforms, Vec4 base_color, bool use_instancing = false);
-	DrawFunc make_draw_func(int count, const Mat4* xforms, const Vec4* base_colors, bool use_instancing = false);
+	DrawFunc make_draw_func(int count, const Mat4f* xforms, const Vec4f& base_color, bool use_instancing = false);
+	DrawFunc make_draw_func(int count, const Mat4f* xforms, const Vec4f* base_colors, bool use_instancing = false);
 	
 	static Model* make_icosahedron(double scale, int subdivisions = 0, bool normalize = false);
 	static Model* make_torus(int longitudinal_segments, int transverse_segments, double hole_ratio, bool use_quad_strips = true, bool make_normals = false);
 	static Model* make_torus_arc(int longitudinal_segments, int transverse_segments, double length, double hole_ratio, bool use_quad_strips = true, bool make_normals = false);
 	static Model* make_bumpy_torus(int longitudinal_segments, int transverse_segments, double bump_height, bool use_quad_strips = false);
-	static std::shared_ptr<Vec4[]> s3ify(int count, double scale, const Vec3* vertices);		//Project a list of R3 vertices onto S3.
+	static std::shared_ptr<Vec4f[]> s3ify(int count, double scale, const Vec3* vertices);		//Project a list of R3 vertices onto S3.
 
 private:
 	int primitive;						//GL_POINTS, GL_TRIANGLES, etc.
 	int vertices_per_primitive;
 	int num_vertices, num_primitives;
 
-	std::unique_ptr<Vec4[]> vertices;
-	std::unique_ptr<Vec4[]> vertex_colors;				//If this is NULL, the model will render with base color only.
+	//Model data is float all the way to the GPU. Only the camera and the other things that accumulate need double.
+	std::unique_ptr<Vec4f[]> vertices;
+	std::unique_ptr<Vec4f[]> vertex_colors;				//If this is NULL, the model will render with base color only.
 	std::unique_ptr<GLuint[]> elements;					//If this is NULL, use glDrawArrays() instead of glDrawElements().
-	std::unique_ptr<Vec4[]> normals;					//If this is NULL, normals will all be zero, so the model will catch no light.
+	std::unique_ptr<Vec4f[]> normals;					//If this is NULL, normals will all be zero, so the model will catch no light.
+
+	double bounding_radius;								//Of the cap around (0, 0, 0, 1) that holds every vertex. Set in prepare_to_render().
 
 	GLuint vertex_buffer, vertex_color_buffer, element_buffer, normal_buffer;
 	
@@ -77,9 +81,11 @@ private:
 
 	ShaderProgram* get_shader_program(bool shadow, bool instanced_xforms, bool instanced_base_colors);
 
-	void bind_xform_array(GLuint vertex_array, int count, const Mat4* xforms);		//Creates a vertex buffer for the given xforms and binds it the given VAO.
-	void bind_color_array(GLuint vertex_array, int count, const Vec4* base_colors);
+	void bind_xform_array(GLuint vertex_array, int count, const Mat4f* xforms);		//Creates a vertex buffer for the given xforms and binds it the given VAO.
+	void bind_color_array(GLuint vertex_array, int count, const Vec4f* base_colors);
 	
 	void draw_raw();
 	void draw_instanced(int count);
+
+	friend class RenderQueue;
 };
@@ -0,0 +1,272 @@
+#include "Random.h"
+
+#include "BatchMath.h"
+#include <atomic>
+#include <memory>
+
+
+#define PHILOX_M0	(0xD2511F53u)
+#define PHILOX_M1	(0xCD9E8D57u)
+#define PHILOX_W0	(0x9E3779B9u)
+#define PHILOX_W1	(0xBB67AE85u)
+#define PHILOX_ROUNDS	(10)
+
+#define INV_2_24	(5.9604644775390625e-8f)
+#define INV_2_53	(1.1102230246251565e-16)
+
+//How many points the batch functions make at a time, which sets the size of their scratch buffers.
+#define BATCH_SIZE	(256)
+
+
+static uint64_t global_seed = DEFAULT_RANDOM_SEED;
+static std::atomic<uint64_t> next_thread_stream(0);
+
+
+static inline void mulhilo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo)
+{
+	uint64_t product = (uint64_t)a * b;
+	hi = (uint32_t)(product >> 32);
+	lo = (uint32_t)product;
+}
+
+//The counter is (block, stream) and the key is the seed.
+static void philox_block(uint64_t seed, uint64_t stream, uint64_t block, uint32_t* out)
+{
+	uint32_t c0 = (uint32_t)block, c1 = (uint32_t)(block >> 32), c2 = (uint32_t)stream, c3 = (uint32_t)(stream >> 32);
+	uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+	for(int round = 0; round < PHILOX_ROUNDS; round++)
+	{
+		uint32_t hi0, lo0, hi1, lo1;
+		mulhilo(PHILOX_M0, c0, hi0, lo0);
+		mulhilo(PHILOX_M1, c2, hi1, lo1);
+		c0 = hi1 ^ c1 ^ k0;
+		c1 = lo1;
+		c2 = hi0 ^ c3 ^ k1;
+		c3 = lo0;
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+
+#if defined(S3_SSE2) || defined(S3_AVX2)
+	//Four 32 x 32 -> 64 bit products at once. _mm_mul_epu32 only does the even lanes, so the odd lanes get shifted down for a second go.
+	static inline void mulhilo_x4(__m128i a, __m128i m, __m128i& hi, __m128i& lo)
+	{
+		const __m128i low_halves = _mm_set_epi32(0, -1, 0, -1);
+		__m128i even = _mm_mul_epu32(a, m);
+		__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), m);
+		lo = _mm_or_si128(_mm_and_si128(even, low_halves), _mm_slli_epi64(odd, 32));
+		hi = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_andnot_si128(low_halves, odd));
+	}
+
+	//Blocks block through block + 3, one per lane, written out in order.
+	static void philox_block_x4(uint64_t seed, uint64_t stream, uint64_t block, uint32_t* out)
+	{
+		__m128i c0 = _mm_set_epi32((int)(uint32_t)(block + 3), (int)(uint32_t)(block + 2), (int)(uint32_t)(block + 1), (int)(uint32_t)block);
+		__m128i c1 = _mm_set_epi32((int)(uint32_t)((block + 3) >> 32), (int)(uint32_t)((block + 2) >> 32), (int)(uint32_t)((block + 1) >> 32), (int)(uint32_t)(block >> 32));
+		__m128i c2 = _mm_set1_epi32((int)(uint32_t)stream);
+		__m128i c3 = _mm_set1_epi32((int)(uint32_t)(stream >> 32));
+		const __m128i m0 = _mm_set1_epi32((int)PHILOX_M0), m1 = _mm_set1_epi32((int)PHILOX_M1);
+		uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+		for(int round = 0; round < PHILOX_ROUNDS; round++)
+		{
+			__m128i hi0, lo0, hi1, lo1;
+			mulhilo_x4(c0, m0, hi0, lo0);
+			mulhilo_x4(c2, m1, hi1, lo1);
+			c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32((int)k0));
+			c1 = lo1;
+			c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32((int)k1));
+			c3 = lo0;
+			k0 += PHILOX_W0;
+			k1 += PHILOX_W1;
+		}
+
+		__m128 r0 = _mm_castsi128_ps(c0), r1 = _mm_castsi128_ps(c1), r2 = _mm_castsi128_ps(c2), r3 = _mm_castsi128_ps(c3);
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		_mm_storeu_si128((__m128i*)out, _mm_castps_si128(r0));
+		_mm_storeu_si128((__m128i*)(out + 4), _mm_castps_si128(r1));
+		_mm_storeu_si128((__m128i*)(out + 8), _mm_castps_si128(r2));
+		_mm_storeu_si128((__m128i*)(out + 12), _mm_castps_si128(r3));
+	}
+#endif
+
+
+RandomStream::RandomStream(uint64_t stream)
+	: RandomStream(global_seed, stream) {}
+
+RandomStream::RandomStream(uint64_t seed, uint64_t stream)
+	: seed(seed), stream(stream), block(0), buffered(0) {}
+
+uint32_t RandomStream::next_u32()
+{
+	if(!buffered)
+	{
+		philox_block(seed, stream, block++, buffer);
+		buffered = 4;
+	}
+	return buffer[4 - buffered--];
+}
+
+uint64_t RandomStream::next_u64()
+{
+	uint64_t hi = next_u32();
+	return (hi << 32) | next_u32();
+}
+
+double RandomStream::next_double()
+{
+	return (next_u64() >> 11) * INV_2_53;
+}
+
+double RandomStream::next_signed()
+{
+	return 2.0 * next_double() - 1.0;
+}
+
+/*
+	In Hopf coordinates, (sqrt(1 - u) * (cos(a), sin(a)), sqrt(u) * (cos(b), sin(b))) is uniform on S3 when 
+	u, a and b are uniform. For S2, Archimedes says the height z is uniform in [-1, 1].
+*/
+Vec4 RandomStream::s3()
+{
+	double u = next_double(), a = TAU * next_double(), b = TAU * next_double();
+	double r1 = sqrt(1 - u), r2 = sqrt(u);
+	return Vec4(r1 * cos(a), r1 * sin(a), r2 * cos(b), r2 * sin(b));
+}
+
+Vec3 RandomStream::s2()
+{
+	double z = next_signed(), phi = TAU * next_double();
+	double r = sqrt(1 - z * z);
+	return Vec3(r * cos(phi), r * sin(phi), z);
+}
+
+void RandomStream::fill_u32(uint32_t* out, size_t count)
+{
+	buffered = 0;
+	size_t i = 0;
+	#if defined(S3_SSE2) || defined(S3_AVX2)
+		for(; i + 16 <= count; i += 16, block += 4)
+			philox_block_x4(seed, stream, block, out + i);
+	#endif
+	for(; i + 4 <= count; i += 4)
+		philox_block(seed, stream, block++, out + i);
+	if(i < count)
+	{
+		uint32_t temp[4];
+		philox_block(seed, stream, block++, temp);
+		for(int j = 0; i < count; i++, j++)
+			out[i] = temp[j];
+	}
+}
+
+void RandomStream::fill_floats(float* out, size_t count)
+{
+	uint32_t words[4 * BATCH_SIZE];
+	while(count)
+	{
+		size_t n = count < 4 * BATCH_SIZE ? count : 4 * BATCH_SIZE;
+		fill_u32(words, n);
+		for(size_t i = 0; i < n; i++)
+			out[i] = (words[i] >> 8) * INV_2_24;
+		out += n;
+		count -= n;
+	}
+}
+
+void RandomStream::fill_s3(Vec4f* out, size_t count)
+{
+	float u[BATCH_SIZE], a[BATCH_SIZE], b[BATCH_SIZE], sin_a[BATCH_SIZE], cos_a[BATCH_SIZE], sin_b[BATCH_SIZE], cos_b[BATCH_SIZE];
+	uint32_t words[3 * BATCH_SIZE];
+	while(count)
+	{
+		size_t n = count < BATCH_SIZE ? count : BATCH_SIZE;
+		fill_u32(words, 3 * n);
+		for(size_t i = 0; i < n; i++)
+		{
+			u[i] = (words[3 * i] >> 8) * INV_2_24;
+			a[i] = (float)TAU * ((words[3 * i + 1] >> 8) * INV_2_24);
+			b[i] = (float)TAU * ((words[3 * i + 2] >> 8) * INV_2_24);
+		}
+		batch_sincos(a, sin_a, cos_a, n);
+		batch_sincos(b, sin_b, cos_b, n);
+		for(size_t i = 0; i < n; i++)
+		{
+			float r1 = sqrtf(1 - u[i]), r2 = sqrtf(u[i]);
+			out[i] = Vec4f(r1 * cos_a[i], r1 * sin_a[i], r2 * cos_b[i], r2 * sin_b[i]);
+		}
+		out += n;
+		count -= n;
+	}
+}
+
+void RandomStream::fill_s2(Vec3f* out, size_t count)
+{
+	float z[BATCH_SIZE], phi[BATCH_SIZE], sin_phi[BATCH_SIZE], cos_phi[BATCH_SIZE];
+	uint32_t words[2 * BATCH_SIZE];
+	while(count)
+	{
+		size_t n = count < BATCH_SIZE ? count : BATCH_SIZE;
+		fill_u32(words, 2 * n);
+		for(size_t i = 0; i < n; i++)
+		{
+			z[i] = 2 * ((words[2 * i] >> 8) * INV_2_24) - 1;
+			phi[i] = (float)TAU * ((words[2 * i + 1] >> 8) * INV_2_24);
+		}
+		batch_sincos(phi, sin_phi, cos_phi, n);
+		for(size_t i = 0; i < n; i++)
+		{
+			float r = sqrtf(1 - z[i] * z[i]);
+			out[i] = Vec3f(r * cos_phi[i], r * sin_phi[i], z[i]);
+		}
+		out += n;
+		count -= n;
+	}
+}
+
+
+static thread_local std::unique_ptr<RandomStream> s_thread_stream;
+
+void init_random(uint64_t seed)
+{
+	global_seed = seed;
+	next_thread_stream = 0;
+	s_thread_stream.reset(new RandomStream(seed, next_thread_stream++));
+}
+
+RandomStream& thread_random()
+{
+	if(!s_thread_stream)
+		s_thread_stream.reset(new RandomStream(next_thread_stream++));
+	return *s_thread_stream;
+}
+
+unsigned long long random()
+{
+	return thread_random().next_u64();
+}
+
+double frand()
+{
+	return thread_random().next_double();
+}
+
+double fsrand()
+{
+	return thread_random().next_signed();
+}
+
+Vec4 rand_s3()
+{
+	return thread_random().s3();
+}
+
+Vec3 rand_s2()
+{
+	return thread_random().s2();
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Vector.h"
+#include <stdint.h>
+
+
+/*
+	Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3"). It's a counter-based 
+	generator: block n of stream s is just a hash of (n, s) under the key (the seed), so there's no state 
+	to share between threads and any stream can be jumped into anywhere. Each block is four 32-bit words.
+
+	The same seed always gives the same numbers, so a scene can be regenerated exactly. Code that does 
+	random work in parallel should give each chunk of work its own stream (e.g. the chunk's index), 
+	rather than using thread_random(), so that the result doesn't depend on which thread got which chunk.
+*/
+class RandomStream {
+	uint64_t seed, stream, block;
+	uint32_t buffer[4];
+	int buffered;
+
+public:
+	//Uses the seed given to init_random().
+	explicit RandomStream(uint64_t stream);
+	RandomStream(uint64_t seed, uint64_t stream);
+
+	uint32_t next_u32();
+	uint64_t next_u64();
+	double next_double();		//[0, 1)
+	double next_signed();		//[-1, 1)
+
+	//Uniformly distributed points on the unit spheres. These are exact, with no rejection sampling.
+	Vec4 s3();
+	Vec3 s2();
+
+	/*
+		The batch versions. These fill whole blocks straight from the counter (four blocks at a time with 
+		SIMD), so they skip whatever is left over from next_u32() etc.
+	*/
+	void fill_u32(uint32_t* out, size_t count);
+	void fill_floats(float* out, size_t count);		//[0, 1)
+	void fill_s3(Vec4f* out, size_t count);
+	void fill_s2(Vec3f* out, size_t count);
+};
+
+
+//Starts over with the given seed. The same seed gives the same scene.
+#define DEFAULT_RANDOM_SEED		(0x5335335335335335ull)
+void init_random(uint64_t seed = DEFAULT_RANDOM_SEED);
+
+//This thread's stream. The first thread to ask gets stream 0, the next one stream 1, etc.
+RandomStream& thread_random();
+
+//These all use thread_random().
+unsigned long long random();
+double frand();
+double fsrand();
+Vec4 rand_s3();
+Vec3 rand_s2();
@@ -0,0 +1,53 @@
+#include "RenderQueue.h"
+
+#include "Model.h"
+#include "Shaders.h"
+#include "GLState.h"
+#include <algorithm>
+
+
+RenderQueue s_render_queue;
+
+
+void RenderQueue::execute()
+{
+	order.clear();
+	for(int i = 0; i < (int)items.size(); i++)
+		order.push_back({items[i].key, i});
+	std::sort(order.begin(), order.end());		//Ties go by index, i.e. submission order.
+
+	ShaderProgram* program = NULL;
+	Uniform base_color, model_view_xform, object_face_mask;
+	last_program_switches = 0;
+
+	for(auto& entry : order)
+	{
+		const RenderItem& item = items[entry.second];
+
+		if(item.program != program)
+		{
+			program = item.program;
+			program->use();
+			base_color = program->get_uniform("base_color");
+			model_view_xform = program->get_uniform("model_view_xform");
+			object_face_mask = program->get_uniform("object_face_mask");		//Only shadow programs have it.
+			last_program_switches++;
+		}
+
+		state_bind_vertex_array(item.vertex_array);
+		if(item.set_base_color)
+			program->set_vector(base_color, item.base_color);
+		if(object_face_mask.location >= 0)
+			program->set_int(object_face_mask, item.face_mask);
+		if(item.instance_count)
+			item.model->draw_instanced(item.instance_count);
+		else
+		{
+			program->set_matrix(model_view_xform, item.model_view_xform);
+			item.model->draw_raw();
+		}
+	}
+
+	last_item_count = items.size();
+	items.clear();
+}
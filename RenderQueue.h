@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Vector.h"
+#include "GL/glew.h"
+#include <vector>
+#include <stdint.h>
+
+
+/*
+	Models don't draw immediately. Model::draw() and the funcs from Model::make_draw_func() submit 
+	RenderItems to s_render_queue, and execute() sorts them by key and draws them. Items with the same 
+	program end up next to each other, and within a program, items with the same VAO, so the program 
+	and VAO switches happen once per group instead of once per draw. Within a group, nearer things 
+	are drawn first.
+
+	Key layout, most significant bits first:
+		8	layer (RENDER_LAYER_*, lower layers draw first)
+		16	program (ShaderProgram::get_index())
+		16	VAO
+		16	depth bucket (0 = at the camera, 0xFFFF = at the camera's antipode)
+		8	unused
+	Items with equal keys are drawn in the order they were submitted.
+
+	The program and model_view_xform of an item depend on the current pass (shadow or not) and 
+	s_curcam, so the queue has to be executed before either of those changes. That means once per 
+	Pass that draws models, including every light's shadow pass. So does face_mask: in a shadow 
+	pass, models work out which cube faces they can show up in when they submit, and don't 
+	submit at all if that's none of the faces being drawn.
+*/
+
+#define RENDER_LAYER_OPAQUE		(0)
+
+struct RenderItem
+{
+	Mat4f model_view_xform;			//only used when instance_count is 0
+	Vec4f base_color;				//only used if set_base_color
+	uint64_t key;
+	class ShaderProgram* program;
+	class Model* model;
+	GLuint vertex_array;
+	int instance_count;				//0 means draw the model once with model_view_xform
+	unsigned face_mask;				//Cube faces the item can touch in a shadow pass (object_face_mask in the geometry shaders)
+	bool set_base_color;
+};
+
+//cos_distance is the w coordinate of the thing's position relative to the camera, i.e. the cosine of its distance.
+inline uint64_t make_sort_key(int layer, int program_index, GLuint vertex_array, double cos_distance)
+{
+	double normalized = 0.5 * (1 - cos_distance);		//Monotonic in distance, and a lot cheaper than acos.
+	uint64_t depth = normalized <= 0 ? 0 : normalized >= 1 ? 0xFFFF : (uint64_t)(normalized * 0xFFFF);
+	return ((uint64_t)(layer & 0xFF) << 56)
+		| ((uint64_t)(program_index & 0xFFFF) << 40)
+		| ((uint64_t)(vertex_array & 0xFFFF) << 24)
+		| (depth << 8);
+}
+
+
+class RenderQueue
+{
+public:
+	void submit(const RenderItem& item) {items.push_back(item);}
+
+	//Sort, draw everything, and empty the queue.
+	void execute();
+
+	bool empty() const {return items.empty();}
+
+	//For the last execute().
+	int get_item_count() const {return last_item_count;}
+	int get_program_switches() const {return last_program_switches;}
+
+private:
+	std::vector<RenderItem> items;
+	std::vector<std::pair<uint64_t, int>> order;		//(key, index into items), so the sort doesn't move whole items around
+
+	int last_item_count = 0, last_program_switches = 0;
+};
+
+extern RenderQueue s_render_queue;
@@ -0,0 +1,80 @@
+#include "Rotor.h"
+
+#include "Utils.h"
+
+
+/*
+	If m = L(a) * R(conj(b)), then the "associate matrix"
+		A[p][q] = 1/4 * sum over j of (column j of m) . (e_p * e_j * conj(e_q))
+	is exactly a[p] * b[q]. So b is the direction of the biggest row of A, and a = A * b.
+	If m has drifted a bit from SO(4), A is only approximately rank 1, and this gives a
+	nearby rotation.
+*/
+template<typename T>
+RotorT<T> RotorT<T>::from_mat(const Mat4T<T>& m)
+{
+	Mat4 columns = ~Mat4(m);
+	Mat4 assoc(0.0);
+	for(int p = 0; p < 4; p++)
+		for(int q = 0; q < 4; q++)
+		{
+			Vec4 conj_eq = quat_conj(Vec4(q));
+			for(int j = 0; j < 4; j++)
+				assoc.data[p][q] += columns.get_row(j) * quat_mul(quat_mul(Vec4(p), Vec4(j)), conj_eq);
+			assoc.data[p][q] *= 0.25;
+		}
+
+	int best_row = 0;
+	double best_mag2 = 0;
+	for(int p = 0; p < 4; p++)
+	{
+		double mag2 = assoc.get_row(p).mag2();
+		if(mag2 > best_mag2)
+		{
+			best_mag2 = mag2;
+			best_row = p;
+		}
+	}
+	if(best_mag2 == 0)
+		error("Can't make a rotor out of a singular matrix.\n");
+
+	Vec4 b = assoc.get_row(best_row).normalize();
+	Vec4 a = (assoc * b).normalize();
+	return RotorT<T>(Vec4T<T>(a), Vec4T<T>(b));
+}
+
+
+template<typename T>
+static Vec4T<T> quat_slerp(const Vec4T<T>& p, const Vec4T<T>& q, double t)
+{
+	double dp = p * q;
+	if(dp > 0.9995)		//Close enough that lerp is fine and sin(theta) would be too small to divide by.
+		return (p + (T)t * (q - p)).normalize();
+	double theta = acos(dp > 1 ? 1 : (dp < -1 ? -1 : dp));
+	double inv_sin = 1.0 / sin(theta);
+	return (T)(sin((1 - t) * theta) * inv_sin) * p + (T)(sin(t * theta) * inv_sin) * q;
+}
+
+template<typename T>
+RotorT<T> RotorT<T>::slerp(const RotorT& r0, const RotorT& r1, double t)
+{
+	//-r1 is the same rotation as r1, so take whichever one is closer to r0.
+	RotorT end = r1;
+	if(r0.left * r1.left + r0.right * r1.right < 0)
+	{
+		end.left = -end.left;
+		end.right = -end.right;
+	}
+	return RotorT(quat_slerp(r0.left, end.left, t), quat_slerp(r0.right, end.right, t));
+}
+
+
+template struct RotorT<double>;
+template struct RotorT<float>;
+
+
+void rotors_from_mats(const Mat4f* in, Rotorf* out, int count)
+{
+	for(int i = 0; i < count; i++)
+		out[i] = Rotorf::from_mat(in[i]);
+}
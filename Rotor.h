@@ -0,0 +1,163 @@
+#pragma once
+
+#include "Vector.h"
+
+
+/*
+	Every element of SO(4) can be written as v -> left * v * conj(right), where left and right
+	are unit quaternions and v is treated as a quaternion. Quaternions are stored in Vec4Ts
+	with w as the real part, so a Vec4 and the corresponding quaternion have the same layout.
+
+	A rotor is half the size of a Mat4, composing two of them is two quaternion products
+	instead of a matrix product, and renormalizing two quaternions is enough to keep it
+	exactly SO(4), so there's no orthogonality drift to worry about.
+
+	(left, right) and (-left, -right) are the same rotation.
+*/
+
+
+//Quaternion product, with w as the real part.
+template<typename T>
+constexpr Vec4T<T> quat_mul(const Vec4T<T>& p, const Vec4T<T>& q)
+{
+	return Vec4T<T>(
+		p.w * q.x + p.x * q.w + p.y * q.z - p.z * q.y,
+		p.w * q.y - p.x * q.z + p.y * q.w + p.z * q.x,
+		p.w * q.z + p.x * q.y - p.y * q.x + p.z * q.w,
+		p.w * q.w - p.x * q.x - p.y * q.y - p.z * q.z
+	);
+}
+
+template<typename T>
+constexpr Vec4T<T> quat_conj(const Vec4T<T>& q)
+{
+	return Vec4T<T>(-q.x, -q.y, -q.z, q.w);
+}
+
+
+template<typename T>
+struct RotorT
+{
+	Vec4T<T> left, right;
+
+	RotorT() = default;
+	constexpr RotorT(const Vec4T<T>& left, const Vec4T<T>& right) : left(left), right(right) {}
+	template<typename U>
+	constexpr explicit RotorT(const RotorT<U>& other) : left(other.left), right(other.right) {}
+
+	static constexpr RotorT identity()
+	{
+		return RotorT(Vec4T<T>(0, 0, 0, 1), Vec4T<T>(0, 0, 0, 1));
+	}
+
+	//Same rotation as Mat4T::axial_rotation(ix1, ix2, theta).
+	static constexpr RotorT axial_rotation(int ix1, int ix2, double theta)
+	{
+		RotorT ret = identity();
+		ret.rotate(ix1, ix2, theta);
+		return ret;
+	}
+
+	//Applying right_operand first and then left_operand, the same as the Mat4 product.
+	constexpr friend RotorT operator* (const RotorT& left_operand, const RotorT& right_operand)
+	{
+		return RotorT(quat_mul(left_operand.left, right_operand.left), quat_mul(left_operand.right, right_operand.right));
+	}
+
+	constexpr friend Vec4T<T> operator* (const RotorT& r, const Vec4T<T>& v)
+	{
+		return quat_mul(quat_mul(r.left, v), quat_conj(r.right));
+	}
+
+	//The inverse. This is exact, unlike the transpose of a Mat4 that has drifted.
+	constexpr RotorT operator~ () const
+	{
+		return RotorT(quat_conj(left), quat_conj(right));
+	}
+
+	/*
+		*this = *this * axial_rotation(ix1, ix2, theta), but done in place. Multiplying by the
+		rotor of an axial rotation only mixes pairs of quaternion components, so it's four
+		Givens rotations instead of two quaternion products.
+	*/
+	constexpr void rotate(int ix1, int ix2, double theta)
+	{
+		T c = (T)cx_cos(0.5 * theta), s = (T)cx_sin(0.5 * theta);
+		if(ix1 == _w)
+		{
+			givens_in_place(left, ix2, c, s);
+			givens_in_place(right, ix2, c, -s);
+		}
+		else if(ix2 == _w)
+		{
+			givens_in_place(left, ix1, c, -s);
+			givens_in_place(right, ix1, c, s);
+		}
+		else
+		{
+			//A rotation in the ix1-ix2 plane is a 3D rotation about the remaining spatial axis.
+			int axis = 3 - ix1 - ix2;
+			T signed_s = ix2 == (ix1 + 1) % 3 ? s : -s;
+			givens_in_place(left, axis, c, signed_s);
+			givens_in_place(right, axis, c, signed_s);
+		}
+	}
+
+	//Call every so often when composing lots of rotors to keep the quaternions unit length.
+	constexpr void normalize_in_place()
+	{
+		left.normalize_in_place();
+		right.normalize_in_place();
+	}
+
+	constexpr Mat4T<T> to_mat() const
+	{
+		//M = L(left) * R(conj(right)), where L(q) and R(q) are the matrices of left and right multiplication by q.
+		const Vec4T<T>& a = left;
+		Vec4T<T> b = quat_conj(right);
+		Mat4T<T> l(
+			a.w,	-a.z,	a.y,	a.x,
+			a.z,	a.w,	-a.x,	a.y,
+			-a.y,	a.x,	a.w,	a.z,
+			-a.x,	-a.y,	-a.z,	a.w
+		);
+		Mat4T<T> r(
+			b.w,	b.z,	-b.y,	b.x,
+			-b.z,	b.w,	b.x,	b.y,
+			b.y,	-b.x,	b.w,	b.z,
+			-b.x,	-b.y,	-b.z,	b.w
+		);
+		return l * r;
+	}
+
+	//m is assumed to be (close to) SO(4). The result is the nearest rotor in a loose sense and is always exactly SO(4).
+	static RotorT from_mat(const Mat4T<T>& m);
+
+	//Interpolate along the shortest path from r0 (t = 0) to r1 (t = 1).
+	static RotorT slerp(const RotorT& r0, const RotorT& r1, double t);
+
+private:
+	//q = q * (c + s * e_axis)
+	static constexpr void givens_in_place(Vec4T<T>& q, int axis, T c, T s)
+	{
+		givens_pair(q[axis], q[_w], c, s);
+		givens_pair(q[(axis + 1) % 3], q[(axis + 2) % 3], c, s);
+	}
+
+	static constexpr void givens_pair(T& p, T& q, T c, T s)
+	{
+		T temp = c * p + s * q;
+		q = c * q - s * p;
+		p = temp;
+	}
+};
+
+
+typedef RotorT<double> Rotor;
+typedef RotorT<float> Rotorf;
+
+static_assert(sizeof(Rotorf) == 8 * sizeof(float) && std::is_trivially_copyable<Rotorf>::value, "Rotorf should be uploadable as 8 GL_FLOATs.");
+
+
+//Convert a batch of (SO(4)) matrices, e.g. for instance data.
+void rotors_from_mats(const Mat4f* in, Rotorf* out, int count);
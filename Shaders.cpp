@@ -3,9 +3,14 @@
 #include "Camera.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <filesystem>
+#include <string>
+#include <algorithm>
+#include <stddef.h>
 #include "Utils.h"
 #include "Framebuffer.h"
 #include "Light.h"
+#include "GLState.h"
 
 #pragma warning(disable : 4244)		//conversion from double to float
 #pragma warning(disable : 4996)		//VS doesn't like old-school string manipulation.
@@ -13,29 +18,197 @@
 
 #define VERSION_STRING		"#version 460\n"
 
+//Goes into every shader, between the #defines and the core text. Has to match CameraUniforms, and binding has to be CAMERA_UNIFORMS_BINDING.
+static const char* camera_uniforms_glsl = R"(
+	layout (std140, row_major, binding = 0) uniform CameraUniforms {
+		mat4 view_xform;
+		mat4 proj_xform;
+		mat4 cube_xforms[6];
+		vec4 fog_color;
+		float aspect_ratio;
+		float fog_density;
+		float fog_scale;
+		float chord2_lut_scale;
+		float chord2_lut_offset;
+		uint shadow_face_mask;
+		uint octahedral_shadows;
+	};
+)";
+
+/*
+	Goes into every shader after camera_uniforms_glsl. Octahedral shadow maps fold the sphere 
+	of directions around a light onto a square: the upper half (z > 0) is the diamond in the 
+	middle, and the lower half is folded out into the corners.
+
+	Within one octant, the mapping is a central projection onto a face of the octahedron 
+	followed by an affine unfolding, so it's a linear clip space transform, and a triangle that 
+	stays in one octant rasterizes exactly. The shadow geometry shaders draw each triangle into 
+	every octant it might touch, clipped to that octant with gl_ClipDistance. Nearly every 
+	triangle is in one octant, instead of being drawn into six cube faces.
+*/
+static const char* octahedral_glsl = R"(
+	//In [-1, 1]^2.
+	vec2 octahedral_encode(vec3 direction) {
+		vec2 p = direction.xy / (abs(direction.x) + abs(direction.y) + abs(direction.z));
+		if(direction.z < 0)
+			p = (1 - abs(p.yx)) * vec2(p.x < 0 ? -1 : 1, p.y < 0 ? -1 : 1);
+		return p;
+	}
 
-Shader::Shader(ShaderCore* core, const std::set<const char*> options) : core(core), options(options)
-{
-	id = glCreateShader(core->shader_type);
+	//signs are +-1 for each axis. Only right for p in that octant. Depth is left to gl_FragDepth.
+	vec4 octant_clip_position(vec3 p, vec3 signs) {
+		float w = dot(p, signs);
+		if(signs.z > 0)
+			return vec4(p.x, p.y, 0, w);
+		return vec4(p.x - signs.x * p.z, p.y - signs.y * p.z, 0, w);
+	}
+)";
+
+/*
+	Goes into every fragment and compute shader after camera_uniforms_glsl. The G-buffer is just albedo, a 
+	packed normal and depth. Everything is in view space (the camera at (0, 0, 0, 1)).
+
+	The position is on the ray through the pixel, depth * TAU along it, so it doesn't need to be 
+	stored. depth can be more than 0.5 for the far image of something, which is the same point 
+	as the near image seen in the opposite direction.
+
+	The normal is orthogonal to the position, so it only has three degrees of freedom. Moving it 
+	back along the ray to the camera turns it into a 3-vector: the part along the ray's tangent 
+	becomes the part along the ray's direction, and the rest is already in xyz. The alpha bit 
+	says whether there's a normal at all (some models don't have normals and shouldn't be lit).
+*/
+static const char* gbuffer_glsl = R"(
+	//Direction of the ray through screen_pos, in pixels from the corner of the screen.
+	vec3 screen_direction(vec2 screen_pos, ivec2 screen_size) {
+		vec2 ndc = screen_pos / vec2(screen_size) * 2 - 1;
+		return normalize(vec3(ndc.x / proj_xform[0][0], ndc.y / proj_xform[1][1], 1));
+	}
 
-	fprintf(stderr, "new shader id = %d\n", id);
-	fprintf(stderr, "%s\n", core->name);
-	for(auto option : options)
-		fprintf(stderr, "\t%s", option);
+	//Direction of the ray through the middle of pixel.
+	vec3 pixel_direction(ivec2 pixel, ivec2 screen_size) {
+		return screen_direction(vec2(pixel) + 0.5, screen_size);
+	}
 
+	vec4 gbuffer_position(vec3 direction, float depth) {
+		float distance = depth * 6.283185;
+		return vec4(sin(distance) * direction, cos(distance));
+	}
+
+	//direction is the pixel's direction, so it's -normalize(position.xyz) for a far image.
+	vec4 pack_gbuffer_normal(vec4 normal, vec4 position, vec3 direction) {
+		if(normal == vec4(0, 0, 0, 0))
+			return vec4(0.5, 0.5, 0.5, 0);
+		vec4 ray_tangent = vec4(position.w * direction, -dot(position.xyz, direction));
+		float along = dot(normal, ray_tangent);
+		vec3 transported = normalize(along * direction + normal.xyz - along * ray_tangent.xyz);
+		return vec4(0.5 * transported + 0.5, 1);
+	}
+
+	vec4 unpack_gbuffer_normal(vec4 texel, vec4 position, vec3 direction) {
+		if(texel.a < 0.5)
+			return vec4(0, 0, 0, 0);
+		vec3 transported = normalize(2 * texel.xyz - 1);
+		float along = dot(transported, direction);
+		return vec4(transported - along * direction + along * position.w * direction, -along * dot(position.xyz, direction));
+	}
+)";
+
+
+ShaderCore::ShaderCore(
+	const char* name,
+	GLuint shader_type,
+	const char* core_text,
+	ShaderPullFunc init_func,
+	ShaderPullFunc frame_func,
+	ShaderPullFunc use_func,
+	std::vector<ShaderOption*> options
+)
+	: name(name), shader_type(shader_type), core_text(core_text), init_func(init_func), frame_func(frame_func), use_func(use_func), supported_options(0), options()
+{
 	for(auto option : options)
-		if(!core->options.count(option))
-			error("ShaderCore %s doesn't have option %s", core->name, option);
+	{
+		if(!option->bit || (option->bit & (option->bit - 1)))
+			error("ShaderCore %s: option %s has to be exactly one bit.\n", name, option->def_name);
+		int index = 0;
+		while(!(option->bit & (1u << index)))
+			index++;
+		this->options[index] = option;
+		supported_options |= option->bit;
+	}
+
+	if(strpbrk(name, "-./\\"))
+		error("ShaderCore name %s can't be used in a file name.\n", name);
+	if(all_cores().count(name))
+		error("There are two ShaderCores called %s.\n", name);
+	all_cores()[name] = this;
+}
+
+ShaderCore* ShaderCore::find(const char* name)
+{
+	auto found = all_cores().find(name);
+	return found == all_cores().end() ? NULL : found->second;
+}
+
+std::unordered_map<const char*, ShaderCore*, CStringHash, CStringEqual>& ShaderCore::all_cores()
+{
+	static std::unordered_map<const char*, ShaderCore*, CStringHash, CStringEqual> ret;
+	return ret;
+}
+
+
+static inline uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for(size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+#define FNV1A_START			(14695981039346656037ull)
+
+
+Shader::Shader(ShaderCore* core, ShaderOptions options) : core(core), options(options), id(0)
+{
+	if(options & ~core->supported_options)
+		error("ShaderCore %s doesn't have options %x\n", core->name, options & ~core->supported_options);
+
+	for(int i = 0; i < MAX_SHADER_OPTIONS; i++)
+		if(options & (1u << i))
+			active_options.push_back(core->options[i]);
 
-	std::vector<const char*> text;
 	text.push_back(VERSION_STRING);
-	for(auto option: options)
-		text.push_back(option);
+	for(auto option : active_options)
+		text.push_back(option->def_name);
+	text.push_back(camera_uniforms_glsl);
+	text.push_back(octahedral_glsl);
+	if(core->shader_type == GL_FRAGMENT_SHADER || core->shader_type == GL_COMPUTE_SHADER)
+		text.push_back(gbuffer_glsl);
 	text.push_back(core->core_text);
 
+	source_hash = fnv1a(FNV1A_START, &core->shader_type, sizeof(core->shader_type));
+	for(const char* temp : text)
+		source_hash = fnv1a(source_hash, temp, strlen(temp));
+
+	core->shaders[options] = this;
+}
+
+void Shader::compile()
+{
+	if(id)
+		return;
+
+	id = glCreateShader(core->shader_type);
+
+	fprintf(stderr, "new shader id = %d\n", id);
+	fprintf(stderr, "%s\n", core->name);
+	for(auto option : active_options)
+		fprintf(stderr, "\t%s", option->def_name);
+
 	glShaderSource(id, text.size(), &text[0], NULL);
 	glCompileShader(id);
+}
 
+void Shader::check_compile()
+{
 	GLint success = 0;
 	glGetShaderiv(id, GL_COMPILE_STATUS, &success);
 	if(success == GL_FALSE)
@@ -52,152 +225,534 @@ Shader::Shader(ShaderCore* core, const std::set<const char*> options) : core(cor
 		delete[] log;
 		exit(-1);
 	}
-	
-	init_func = [core, options](ShaderProgram* program) {
-		if(core->init_func)
-			core->init_func(program);
-		for(auto option : options)
-		{
-			ShaderPullFunc temp = core->options[option]->init_func;
-			if(temp)
-				temp(program);
-		}
-	};
+}
 
-	frame_func = [core, options](ShaderProgram* program) {
-		if(core->frame_func)
-			core->frame_func(program);
-		for(auto option : options)
-		{
-			ShaderPullFunc temp = core->options[option]->frame_func;
-			if(temp)
-				temp(program);
-		}
-	};
+void Shader::init(ShaderProgram* program)
+{
+	if(core->init_func)
+		core->init_func(program);
+	for(auto option : active_options)
+		if(option->init_func)
+			option->init_func(program);
+}
 
-	use_func = [core, options](ShaderProgram* program) {
-		if(core->use_func)
-			core->use_func(program);
-		for(auto option : options)
-		{
-			ShaderPullFunc temp = core->options[option]->use_func;
-			if(temp)
-				temp(program);
-		}
-	};
+void Shader::frame(ShaderProgram* program)
+{
+	if(core->frame_func)
+		core->frame_func(program);
+	for(auto option : active_options)
+		if(option->frame_func)
+			option->frame_func(program);
+}
 
-	all_shaders.push_back(this);
+void Shader::use(ShaderProgram* program)
+{
+	if(core->use_func)
+		core->use_func(program);
+	for(auto option : active_options)
+		if(option->use_func)
+			option->use_func(program);
 }
 
-Shader* Shader::get(ShaderCore* core, std::set<const char*> options)
+Shader* Shader::get(ShaderCore* core, ShaderOptions options)
 {
-	for(auto shader : all_shaders)
-		if(shader->core == core && shader->options == options)
-			return shader;
+	auto found = core->shaders.find(options);
+	if(found != core->shaders.end())
+		return found->second;
 	return new Shader(core, options);
 }
 
-std::vector<Shader*> Shader::all_shaders;
-
 
 ShaderProgram::ShaderProgram(Shader* vert, Shader* geom, Shader* frag)
 {
+	if(vert->get_core()->shader_type == GL_COMPUTE_SHADER ? geom || frag : !frag)
+		error("Shader program %s needs a vertex and a fragment shader, or just a compute shader.\n", vert->get_core()->name);
+
 	vertex = vert;
 	geometry = geom;
 	fragment = frag;
 
+	if(!binary_cache_ready)
+		init_binary_cache();
+
 	id = glCreateProgram();
-	fprintf(stderr, "new program id = %d (%d, %d, %d)\n", id, vertex->get_id(), geometry ? geometry->get_id() : -1, fragment->get_id());
+	linked = load_binary();
+	add_to_manifest();
+
+	index = all_shader_programs.size();
+	all_shader_programs.push_back(this);
+	program_table[{vertex, geometry, fragment}] = this;
+}
+
+void ShaderProgram::begin_link()
+{
+	vertex->compile();
+	if(geometry)
+		geometry->compile();
+	if(fragment)
+		fragment->compile();
+
+	fprintf(stderr, "new program id = %d (%d, %d, %d)\n", id, vertex->get_id(), geometry ? geometry->get_id() : -1, fragment ? fragment->get_id() : -1);
 	glAttachShader(id, vertex->get_id());
 	if(geometry)
 		glAttachShader(id, geometry->get_id());
-	glAttachShader(id, fragment->get_id());
+	if(fragment)
+		glAttachShader(id, fragment->get_id());
+	if(binary_cache_dir)
+		glProgramParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(id);
+}
+
+void ShaderProgram::finish()
+{
+	if(!linked)
+	{
+		GLint success;
+		glGetProgramiv(id, GL_LINK_STATUS, &success);
+		if(success == GL_FALSE)
+		{
+			//If it's a compile error, that log is more useful.
+			vertex->check_compile();
+			if(geometry)
+				geometry->check_compile();
+			if(fragment)
+				fragment->check_compile();
+
+			GLint log_length = 0;
+			glGetProgramiv(id, GL_INFO_LOG_LENGTH, &log_length);
+			char* log = new char[log_length + 1];
+			glGetProgramInfoLog(id, log_length, &log_length, log);
+			log[log_length] = 0;
+			printf(log);
+
+			delete[] log;
+			exit(-1);
+		}
+		linked = true;
+		save_binary();
+	}
+
+	reflect_uniforms();
+	init();
+}
+
+
+/*
+	Binary cache file layout:
+		BinaryHeader
+		length bytes of whatever glGetProgramBinary gave us
+	The file name is vertcore.options-geomcore.options-fragcore.options.bin (options in hex, "none" for 
+	no geometry shader, and compcore.options-none-none for a compute program), so it's easy to see 
+	what's in the cache. The header has everything else that has to match.
+
+	The manifest (PROGRAM_MANIFEST_NAME in the same directory) is a text file with the same names 
+	minus the .bin, one per line, appended to whenever a program that isn't in it yet is made. 
+	warm_up_from_cache() makes everything in it. It doesn't depend on the driver, so it's kept even 
+	when binaries aren't supported and survives the binaries being deleted.
+*/
+#define BINARY_CACHE_MAGIC			(0x42503353)		//"S3PB"
+#define BINARY_CACHE_VERSION		(2)
+#define DEFAULT_BINARY_CACHE_DIR	"shader_cache"
+#define MAX_BINARY_PATH_LENGTH		(1024)
+#define PROGRAM_MANIFEST_NAME		"programs.txt"
+
+struct BinaryHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;			//ShaderProgram::get_binary_key()
+	uint32_t format;		//binaryFormat from glGetProgramBinary
+	uint32_t length;
+};
+
+const char* ShaderProgram::binary_cache_dir = DEFAULT_BINARY_CACHE_DIR;
+const char* ShaderProgram::manifest_dir = NULL;
+bool ShaderProgram::binary_cache_ready = false;
+std::vector<std::string> ShaderProgram::manifest;
+uint64_t ShaderProgram::driver_hash = 0;
+
+void ShaderProgram::set_binary_cache_dir(const char* dir)
+{
+	if(binary_cache_ready)
+		error("set_binary_cache_dir has to be called before any shader programs are made.\n");
+	binary_cache_dir = dir;
+}
+
+void ShaderProgram::init_binary_cache()
+{
+	binary_cache_ready = true;
+	if(!binary_cache_dir)
+		return;
+
+	std::error_code err;
+	std::filesystem::create_directories(binary_cache_dir, err);
+	if(err)
+	{
+		fprintf(stderr, "Couldn't make shader cache directory %s (%s). Not caching shaders.\n", binary_cache_dir, err.message().c_str());
+		binary_cache_dir = NULL;
+		return;
+	}
+
+	manifest_dir = binary_cache_dir;
+	char path[MAX_BINARY_PATH_LENGTH];
+	snprintf(path, sizeof(path), "%s/" PROGRAM_MANIFEST_NAME, manifest_dir);
+	FILE* file = fopen(path, "r");
+	if(file)
+	{
+		char line[MAX_BINARY_PATH_LENGTH];
+		while(fgets(line, sizeof(line), file))
+		{
+			line[strcspn(line, "\r\n")] = 0;
+			if(line[0] && std::find(manifest.begin(), manifest.end(), line) == manifest.end())
+				manifest.push_back(line);
+		}
+		fclose(file);
+	}
+
+	GLint num_formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+	if(num_formats <= 0)
+	{
+		fprintf(stderr, "The driver doesn't support program binaries. Not caching shader binaries.\n");
+		binary_cache_dir = NULL;
+		return;
+	}
 
-	GLint success;
+	//A binary is only good for exactly the driver that made it.
+	driver_hash = FNV1A_START;
+	for(GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION})
+	{
+		const char* temp = (const char*)glGetString(name);
+		if(temp)
+			driver_hash = fnv1a(driver_hash, temp, strlen(temp) + 1);
+	}
+}
+
+uint64_t ShaderProgram::get_binary_key() const
+{
+	uint64_t ret = driver_hash;
+	for(Shader* shader : {vertex, geometry, fragment})
+	{
+		uint64_t temp = shader ? shader->get_source_hash() : 0;
+		ret = fnv1a(ret, &temp, sizeof(temp));
+	}
+	return ret;
+}
+
+void ShaderProgram::get_manifest_name(char* name, size_t size) const
+{
+	int length = 0;
+	for(Shader* shader : {vertex, geometry, fragment})
+		if(shader)
+			length += snprintf(name + length, size - length, "%s.%x-", shader->get_core()->name, shader->get_options());
+		else
+			length += snprintf(name + length, size - length, "none-");
+	name[length - 1] = 0;
+}
+
+void ShaderProgram::get_binary_path(char* path, size_t size) const
+{
+	char name[MAX_BINARY_PATH_LENGTH];
+	get_manifest_name(name, sizeof(name));
+	snprintf(path, size, "%s/%s.bin", binary_cache_dir, name);
+}
+
+void ShaderProgram::add_to_manifest() const
+{
+	if(!manifest_dir)
+		return;
+
+	char name[MAX_BINARY_PATH_LENGTH];
+	get_manifest_name(name, sizeof(name));
+	if(std::find(manifest.begin(), manifest.end(), name) != manifest.end())
+		return;
+	manifest.push_back(name);
+
+	char path[MAX_BINARY_PATH_LENGTH];
+	snprintf(path, sizeof(path), "%s/" PROGRAM_MANIFEST_NAME, manifest_dir);
+	FILE* file = fopen(path, "a");
+	if(!file)
+	{
+		fprintf(stderr, "Couldn't write shader manifest %s\n", path);
+		return;
+	}
+	fprintf(file, "%s\n", name);
+	fclose(file);
+}
+
+bool ShaderProgram::load_binary()
+{
+	if(!binary_cache_dir)
+		return false;
+
+	char path[MAX_BINARY_PATH_LENGTH];
+	get_binary_path(path, sizeof(path));
+	FILE* file = fopen(path, "rb");
+	if(!file)
+		return false;
+
+	BinaryHeader header;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1
+		&& header.magic == BINARY_CACHE_MAGIC
+		&& header.version == BINARY_CACHE_VERSION
+		&& header.key == get_binary_key();
+	std::vector<char> data;
+	if(ok)
+	{
+		data.resize(header.length);
+		ok = fread(data.data(), 1, header.length, file) == header.length;
+	}
+	fclose(file);
+	if(!ok)
+	{
+		fprintf(stderr, "Stale shader cache entry %s\n", path);
+		return false;
+	}
+
+	glProgramBinary(id, header.format, data.data(), header.length);
+	GLint success = GL_FALSE;
 	glGetProgramiv(id, GL_LINK_STATUS, &success);
 	if(success == GL_FALSE)
 	{
-		GLint log_length = 0;
-		glGetProgramiv(id, GL_INFO_LOG_LENGTH, &log_length);
-		char* log = new char[log_length + 1];
-		glGetProgramInfoLog(id, log_length, &log_length, log);
-		log[log_length] = 0;
-		printf(log);
+		//The driver can reject a binary for its own reasons. Start over with a clean program object.
+		fprintf(stderr, "Driver rejected shader cache entry %s\n", path);
+		glDeleteProgram(id);
+		id = glCreateProgram();
+		return false;
+	}
 
-		delete[] log;
-		exit(-1);
+	fprintf(stderr, "new program id = %d from %s\n", id, path);
+	return true;
+}
+
+void ShaderProgram::save_binary()
+{
+	if(!binary_cache_dir)
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length);
+	if(length <= 0)
+		return;
+
+	BinaryHeader header;
+	header.magic = BINARY_CACHE_MAGIC;
+	header.version = BINARY_CACHE_VERSION;
+	header.key = get_binary_key();
+	std::vector<char> data(length);
+	GLenum format;
+	glGetProgramBinary(id, length, &length, &format, data.data());
+	header.format = format;
+	header.length = length;
+
+	char path[MAX_BINARY_PATH_LENGTH];
+	get_binary_path(path, sizeof(path));
+	FILE* file = fopen(path, "wb");
+	if(!file)
+	{
+		fprintf(stderr, "Couldn't write shader cache entry %s\n", path);
+		return;
 	}
-	
-	init();
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data.data(), 1, length, file) == (size_t)length;
+	fclose(file);
+	if(!ok)
+	{
+		fprintf(stderr, "Couldn't write shader cache entry %s\n", path);
+		remove(path);
+	}
+}
 
-	all_shader_programs.push_back(this);
+//Bytes in one element of a uniform of this type. Samplers and the like are ints as far as glProgramUniform is concerned.
+static int uniform_type_size(GLenum type)
+{
+	switch(type)
+	{
+		case GL_FLOAT_VEC2:
+		case GL_INT_VEC2:
+			return 8;
+		case GL_FLOAT_VEC3:
+		case GL_INT_VEC3:
+			return 12;
+		case GL_FLOAT_VEC4:
+		case GL_INT_VEC4:
+		case GL_FLOAT_MAT2:
+			return 16;
+		case GL_FLOAT_MAT3:
+			return 36;
+		case GL_FLOAT_MAT4:
+			return 64;
+		default:
+			return 4;
+	}
 }
 
-void ShaderProgram::set_matrix(const char* name, const Mat4& mat)
+void ShaderProgram::reflect_uniforms()
+{
+	GLint count = 0, max_length = 0;
+	glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+	for(GLint i = 0; i < count; i++)
+	{
+		std::unique_ptr<char[]> name(new char[max_length + 1]);
+		GLsizei length = 0;
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(id, i, max_length + 1, &length, &size, &type, name.get());
+		name[length] = 0;
+
+		GLint location = glGetUniformLocation(id, name.get());
+		if(location < 0)		//in a uniform block
+			continue;
+
+		//Arrays are reported as name[0].
+		if(length > 3 && !strcmp(name.get() + length - 3, "[0]"))
+			name[length - 3] = 0;
+
+		UniformValue value;
+		value.offset = uniform_values.size();
+		value.size = size * uniform_type_size(type);
+		value.written_size = 0;
+		uniform_values.resize(value.offset + value.size);
+
+		uniform_table[name.get()] = {location, (int)uniform_value_slots.size()};
+		uniform_value_slots.push_back(value);
+		uniform_names.push_back(std::move(name));
+	}
+}
+
+Uniform ShaderProgram::get_uniform(const char* name) const
+{
+	auto found = uniform_table.find(name);
+	return found == uniform_table.end() ? Uniform {-1, -1} : found->second;
+}
+
+bool ShaderProgram::needs_write(Uniform uniform, const void* value, int size)
+{
+	if(uniform.location < 0)
+	{
+		missing_uniform_writes++;
+		return false;
+	}
+
+	UniformValue& slot = uniform_value_slots[uniform.index];
+	if(size > slot.size)		//Bigger than GL says it is. Let GL deal with it.
+	{
+		issued_uniform_writes++;
+		return true;
+	}
+
+	unsigned char* old_value = &uniform_values[slot.offset];
+	if(slot.written_size == size && !memcmp(old_value, value, size))
+	{
+		skipped_uniform_writes++;
+		return false;
+	}
+
+	memcpy(old_value, value, size);
+	slot.written_size = size;
+	issued_uniform_writes++;
+	return true;
+}
+
+void ShaderProgram::set_matrix(Uniform uniform, const Mat4& mat)
 {
 	float temp[16];
-	for(int i = 0; i < 4; i++)
-		for(int j = 0; j < 4; j++)
-			temp[j * 4 + i] = mat.data[i][j];
-	glProgramUniformMatrix4fv(id, glGetUniformLocation(id, name), 1, false, temp);
+	transpose_to_floats(&mat, temp, 1);
+	if(needs_write(uniform, temp, sizeof(temp)))
+		glProgramUniformMatrix4fv(id, uniform.location, 1, false, temp);
 }
 
-void ShaderProgram::set_matrices(const char* name, const Mat4* mats, int count)
+void ShaderProgram::set_matrices(Uniform uniform, const Mat4* mats, int count)
 {
+	if(uniform.location < 0)
+	{
+		missing_uniform_writes++;
+		return;
+	}
 	float* temp = new float[16 * count];
-	for(int mat = 0; mat < count; mat++)
-		for(int i = 0; i < 4; i++)
-			for(int j = 0; j < 4; j++)
-				temp[mat * 16 + j * 4 + i] = mats[mat].data[i][j];
-	glProgramUniformMatrix4fv(id, glGetUniformLocation(id, name), count, false, temp);
+	transpose_to_floats(mats, temp, count);
+	if(needs_write(uniform, temp, 16 * count * sizeof(float)))
+		glProgramUniformMatrix4fv(id, uniform.location, count, false, temp);
 	delete[] temp;
 }
 
-void ShaderProgram::set_vector(const char* name, const Vec4& v)
+//The Mat4f versions send the untransposed matrix and have GL transpose it, so the copy is of the untransposed matrix.
+void ShaderProgram::set_matrix(Uniform uniform, const Mat4f& mat)
+{
+	if(needs_write(uniform, &mat.data[0][0], 16 * sizeof(float)))
+		glProgramUniformMatrix4fv(id, uniform.location, 1, GL_TRUE, &mat.data[0][0]);
+}
+
+void ShaderProgram::set_matrices(Uniform uniform, const Mat4f* mats, int count)
+{
+	if(needs_write(uniform, &mats[0].data[0][0], 16 * count * sizeof(float)))
+		glProgramUniformMatrix4fv(id, uniform.location, count, GL_TRUE, &mats[0].data[0][0]);
+}
+
+void ShaderProgram::set_vector(Uniform uniform, const Vec4& v)
+{
+	float temp[4] = {(float)v.x, (float)v.y, (float)v.z, (float)v.w};
+	if(needs_write(uniform, temp, sizeof(temp)))
+		glProgramUniform4fv(id, uniform.location, 1, temp);
+}
+
+void ShaderProgram::set_vector(Uniform uniform, const Vec4f& v)
 {
-	glProgramUniform4f(id, glGetUniformLocation(id, name), v.x, v.y, v.z, v.w);
+	if(needs_write(uniform, v.components, 4 * sizeof(float)))
+		glProgramUniform4fv(id, uniform.location, 1, v.components);
 }
 
-void ShaderProgram::set_vector(const char* name, const Vec3& v)
+void ShaderProgram::set_vector(Uniform uniform, const Vec3& v)
 {
-	glProgramUniform3f(id, glGetUniformLocation(id, name), v.x, v.y, v.z);
+	float temp[3] = {(float)v.x, (float)v.y, (float)v.z};
+	if(needs_write(uniform, temp, sizeof(temp)))
+		glProgramUniform3fv(id, uniform.location, 1, temp);
 }
 
-void ShaderProgram::set_float(const char* name, float f)
+void ShaderProgram::set_float(Uniform uniform, float f)
 {
-	glProgramUniform1f(id, glGetUniformLocation(id, name), f);
+	if(needs_write(uniform, &f, sizeof(f)))
+		glProgramUniform1f(id, uniform.location, f);
 }
 
-void ShaderProgram::set_int(const char* name, int i)
+void ShaderProgram::set_int(Uniform uniform, int i)
 {
-	glProgramUniform1i(id, glGetUniformLocation(id, name), i);
+	if(needs_write(uniform, &i, sizeof(i)))
+		glProgramUniform1i(id, uniform.location, i);
 }
 
-void ShaderProgram::set_texture(const char* name, int tex_unit, GLuint texture, GLenum target)
+void ShaderProgram::set_ints(Uniform uniform, const int* values, int count)
 {
-	set_int(name, tex_unit);
-	glActiveTexture(GL_TEXTURE0 + tex_unit);
-	glBindTexture(target, texture);
+	if(needs_write(uniform, values, count * sizeof(int)))
+		glProgramUniform1iv(id, uniform.location, count, values);
 }
 
+void ShaderProgram::set_texture(Uniform uniform, int tex_unit, GLuint texture, GLenum target)
+{
+	set_int(uniform, tex_unit);
+	state_bind_texture(tex_unit, target, texture);
+}
+
+#define MAX_LUT_NAME_LENGTH		(64)
+
 void ShaderProgram::set_lut(const char* name, int tex_unit, LookupTable* lut)
 {
 	check_gl_errors("set_lut 0");
+	char temp[MAX_LUT_NAME_LENGTH + 8];		//8 = strlen("_offset") + 1 for the null char. strlen("_offset") > strlen("_scale").
 	size_t name_length = strlen(name);
-	char* temp = new char[name_length + 8];		//8 = strlen("_offset") + 1 for the null char. strlen("_offset") > strlen("_scale").
-	strcpy(temp, name);
-	
+	if(name_length > MAX_LUT_NAME_LENGTH)
+		error("LUT name %s is too long.\n", name);
+	memcpy(temp, name, name_length);
+
 	set_texture(name, tex_unit, lut->get_texture(), lut->get_target());
-	strcat(temp, "_scale");
 
+	strcpy(temp + name_length, "_scale");
 	set_float(temp, lut->get_scale());
-	temp[name_length] = 0;
-	strcat(temp, "_offset");
 
+	strcpy(temp + name_length, "_offset");
 	set_float(temp, lut->get_offset());
-	
-	delete[] temp;
+
 	check_gl_errors("set_lut 1");
 }
 
@@ -209,19 +764,122 @@ void ShaderProgram::dump() const
 		{
 			printf("\tShader id %d:\n", shader->get_id());
 			printf("\t\t%s\n", shader->get_core()->name);
-			for(auto option : shader->get_options())
-				printf("\t\t\t%s", option);
+			ShaderCore* core = shader->get_core();
+			for(int i = 0; i < MAX_SHADER_OPTIONS; i++)
+				if(shader->get_options() & (1u << i))
+					printf("\t\t\t%s", core->options[i]->def_name);
 		}
 		else
 			printf("None");
 }
 
+size_t ShaderProgram::KeyHash::operator() (const Key& key) const
+{
+	std::hash<Shader*> hash;
+	size_t ret = hash(key.vertex);
+	ret = ret * 31 + hash(key.geometry);
+	ret = ret * 31 + hash(key.fragment);
+	return ret;
+}
+
 ShaderProgram* ShaderProgram::get(Shader* vert, Shader* geom, Shader* frag)
 {
-	for(ShaderProgram* temp : all_shader_programs)
-		if(temp->vertex == vert && temp->geometry == geom && temp->fragment == frag)
-			return temp;
-	return new ShaderProgram(vert, geom, frag);
+	auto found = program_table.find({vert, geom, frag});
+	if(found != program_table.end())
+		return found->second;
+	ShaderProgram* ret = new ShaderProgram(vert, geom, frag);
+	if(!ret->linked)
+		ret->begin_link();
+	ret->finish();
+	return ret;
+}
+
+void ShaderProgram::warm_up(const std::vector<Key>& programs)
+{
+	static bool parallel_checked = false;
+	if(!parallel_checked)
+	{
+		parallel_checked = true;
+		//0xFFFFFFFF = as many threads as the driver wants.
+		if(GLEW_KHR_parallel_shader_compile)
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		else if(GLEW_ARB_parallel_shader_compile)
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+	}
+
+	std::vector<ShaderProgram*> pending;
+	for(const Key& key : programs)
+		if(!program_table.count(key))
+			pending.push_back(new ShaderProgram(key.vertex, key.geometry, key.fragment));
+
+	//Cache hits are already linked. Queue up everything else before waiting on any of it.
+	for(ShaderProgram* program : pending)
+		if(!program->linked)
+			for(Shader* shader : {program->vertex, program->geometry, program->fragment})
+				if(shader)
+					shader->compile();
+	for(ShaderProgram* program : pending)
+		if(!program->linked)
+			program->begin_link();
+	for(ShaderProgram* program : pending)
+		program->finish();
+
+	fprintf(stderr, "Warmed up %d shader programs.\n", (int)pending.size());
+}
+
+//Parses one "core.options" piece of a manifest name.
+static Shader* shader_from_cache_name(const std::string& name)
+{
+	if(name == "none")
+		return NULL;
+	size_t dot = name.rfind('.');
+	if(dot == std::string::npos)
+		return NULL;
+	ShaderCore* core = ShaderCore::find(name.substr(0, dot).c_str());
+	if(!core)
+		return NULL;
+	ShaderOptions options = (ShaderOptions)strtoul(name.c_str() + dot + 1, NULL, 16);
+	if(options & ~core->supported_options)
+		return NULL;
+	return Shader::get(core, options);
+}
+
+void ShaderProgram::warm_up_from_cache()
+{
+	if(!binary_cache_ready)
+		init_binary_cache();
+
+	std::vector<Key> programs;
+	for(const std::string& name : manifest)
+	{
+		//See get_manifest_name(). Anything that doesn't parse (e.g. a core that's been renamed) is skipped.
+		size_t dash1 = name.find('-'), dash2 = name.rfind('-');
+		if(dash1 == std::string::npos || dash1 == dash2)
+			continue;
+		Key key;
+		key.vertex = shader_from_cache_name(name.substr(0, dash1));
+		key.geometry = shader_from_cache_name(name.substr(dash1 + 1, dash2 - dash1 - 1));
+		key.fragment = shader_from_cache_name(name.substr(dash2 + 1));
+		if(!key.vertex || (!key.geometry && name.compare(dash1 + 1, dash2 - dash1 - 1, "none")))
+			continue;
+		if(key.vertex->get_core()->shader_type == GL_COMPUTE_SHADER)
+		{
+			if(key.geometry || name.compare(dash2 + 1, std::string::npos, "none"))
+				continue;
+		}
+		else
+		{
+			if(!key.fragment)
+				continue;
+			if(key.vertex->get_core()->shader_type != GL_VERTEX_SHADER || key.fragment->get_core()->shader_type != GL_FRAGMENT_SHADER)
+				continue;
+			if(key.geometry && key.geometry->get_core()->shader_type != GL_GEOMETRY_SHADER)
+				continue;
+		}
+		programs.push_back(key);
+	}
+
+	warm_up(programs);
 }
 
 void ShaderProgram::init_all()
@@ -237,6 +895,138 @@ void ShaderProgram::frame_all()
 }
 
 std::vector<ShaderProgram*> ShaderProgram::all_shader_programs;
+int ShaderProgram::missing_uniform_writes = 0;
+long long ShaderProgram::issued_uniform_writes = 0, ShaderProgram::skipped_uniform_writes = 0;
+std::unordered_map<ShaderProgram::Key, ShaderProgram*, ShaderProgram::KeyHash> ShaderProgram::program_table;
+
+
+static_assert(offsetof(CameraUniforms, proj_xform) == 64, "CameraUniforms doesn't match std140.");
+static_assert(offsetof(CameraUniforms, cube_xforms) == 128, "CameraUniforms doesn't match std140.");
+static_assert(offsetof(CameraUniforms, fog_color) == 512, "CameraUniforms doesn't match std140.");
+static_assert(offsetof(CameraUniforms, aspect_ratio) == 528, "CameraUniforms doesn't match std140.");
+static_assert(offsetof(CameraUniforms, chord2_lut_offset) == 544, "CameraUniforms doesn't match std140.");
+static_assert(offsetof(CameraUniforms, shadow_face_mask) == 548, "CameraUniforms doesn't match std140.");
+static_assert(offsetof(CameraUniforms, octahedral_shadows) == 552, "CameraUniforms doesn't match std140.");
+
+static GLuint camera_uniform_buffer = 0;
+static GLsizeiptr camera_uniform_stride;		//sizeof(CameraUniforms) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+static int camera_slot_capacity = 0;
+
+/*
+	Each slot remembers the generations of what went into it. Camera::generation covers the camera, 
+	fog_generation covers set_fog_uniforms(), and the LUT and the shadow settings are compared directly. 
+	If they all match, the slot is up to date and use_camera() is at most a glBindBufferRange.
+*/
+struct CameraSlot
+{
+	int index;
+	bool uploaded;
+	unsigned camera_generation, fog_generation;
+	LookupTable* lut;
+	unsigned shadow_face_mask, octahedral_shadows;
+};
+static std::unordered_map<const Camera*, CameraSlot> camera_slots;
+static const CameraSlot* bound_camera_slot = NULL;
+
+//Replace the camera uniform buffer with one that has room for capacity slots, keeping the slots that are already there.
+static void grow_camera_uniform_buffer(int capacity)
+{
+	GLuint new_buffer;
+	glCreateBuffers(1, &new_buffer);
+	glNamedBufferStorage(new_buffer, capacity * camera_uniform_stride, NULL, GL_DYNAMIC_STORAGE_BIT);
+	if(camera_uniform_buffer)
+	{
+		glCopyNamedBufferSubData(camera_uniform_buffer, new_buffer, 0, 0, camera_slot_capacity * camera_uniform_stride);
+		glDeleteBuffers(1, &camera_uniform_buffer);
+	}
+	camera_uniform_buffer = new_buffer;
+	camera_slot_capacity = capacity;
+	bound_camera_slot = NULL;		//The binding pointed at the old buffer.
+}
+
+static CameraUniforms fog_uniforms;
+static unsigned fog_generation = 0;
+static unsigned shadow_face_mask = ALL_CUBE_FACES;
+static unsigned octahedral_shadows = 0;
+
+void set_fog_uniforms(float density, float scale, const Vec3& color)
+{
+	Vec4f fog_color(color.x, color.y, color.z, 1);
+	if(density == fog_uniforms.fog_density && scale == fog_uniforms.fog_scale && !memcmp(&fog_color, &fog_uniforms.fog_color, sizeof(fog_color)))
+		return;
+	fog_uniforms.fog_density = density;
+	fog_uniforms.fog_scale = scale;
+	fog_uniforms.fog_color = fog_color;
+	fog_generation++;
+}
+
+void set_shadow_face_mask(unsigned mask)
+{
+	shadow_face_mask = mask;
+}
+
+unsigned get_shadow_face_mask()
+{
+	return shadow_face_mask;
+}
+
+void set_octahedral_shadows(bool octahedral)
+{
+	octahedral_shadows = octahedral;
+}
+
+void use_camera(Camera* camera)
+{
+	s_curcam = camera;
+
+	if(!camera_uniform_buffer)
+	{
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		camera_uniform_stride = (sizeof(CameraUniforms) + alignment - 1) / alignment * alignment;
+		grow_camera_uniform_buffer(INITIAL_UNIFORM_CAMERAS);
+	}
+
+	auto found = camera_slots.find(camera);
+	if(found == camera_slots.end())
+	{
+		if((int)camera_slots.size() >= camera_slot_capacity)
+			grow_camera_uniform_buffer(2 * camera_slot_capacity);
+		found = camera_slots.insert({camera, {(int)camera_slots.size(), false, 0, 0, NULL, 0, 0}}).first;
+	}
+	CameraSlot& slot = found->second;
+
+	if(!slot.uploaded || slot.camera_generation != camera->get_generation() || slot.fog_generation != fog_generation || slot.lut != s_chord2_lut || slot.shadow_face_mask != shadow_face_mask || slot.octahedral_shadows != octahedral_shadows)
+	{
+		CameraUniforms temp;
+		temp.view_xform = Mat4f(camera->get_mat());
+		temp.proj_xform = camera->get_proj();
+		for(int i = 0; i < 6; i++)
+			temp.cube_xforms[i] = s_cube_xforms[i];
+		temp.fog_color = fog_uniforms.fog_color;
+		temp.aspect_ratio = camera->get_aspect_ratio();
+		temp.fog_density = fog_uniforms.fog_density;
+		temp.fog_scale = fog_uniforms.fog_scale;
+		temp.chord2_lut_scale = s_chord2_lut->get_scale();
+		temp.chord2_lut_offset = s_chord2_lut->get_offset();
+		temp.shadow_face_mask = shadow_face_mask;
+		temp.octahedral_shadows = octahedral_shadows;
+		glNamedBufferSubData(camera_uniform_buffer, slot.index * camera_uniform_stride, sizeof(temp), &temp);
+
+		slot.uploaded = true;
+		slot.camera_generation = camera->get_generation();
+		slot.fog_generation = fog_generation;
+		slot.lut = s_chord2_lut;
+		slot.shadow_face_mask = shadow_face_mask;
+		slot.octahedral_shadows = octahedral_shadows;
+	}
+
+	if(bound_camera_slot != &slot)
+	{
+		glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_UNIFORMS_BINDING, camera_uniform_buffer, slot.index * camera_uniform_stride, sizeof(CameraUniforms));
+		bound_camera_slot = &slot;
+	}
+}
 
 
 ShaderCore *vert, *geom_points, *geom_triangles, *frag_points, *frag;
@@ -267,8 +1057,17 @@ void init_shaders()
 			#endif
 
 			#ifdef INSTANCED_XFORM
-				layout (location = 3) in mat4 model_xform;
-				uniform mat4 view_xform;
+				//The model xform as a Rotor: v -> left * v * conj(right), treating v as a quaternion with w real.
+				layout (location = 3) in vec4 model_rotor_left;
+				layout (location = 4) in vec4 model_rotor_right;
+
+				vec4 quat_mul(vec4 p, vec4 q) {
+					return vec4(p.w * q.xyz + q.w * p.xyz + cross(p.xyz, q.xyz), p.w * q.w - dot(p.xyz, q.xyz));
+				}
+
+				vec4 model_xform(vec4 v) {
+					return quat_mul(quat_mul(model_rotor_left, v), vec4(-model_rotor_right.xyz, model_rotor_right.w));
+				}
 			#else
 				uniform mat4 model_view_xform;
 			#endif
@@ -287,9 +1086,11 @@ void init_shaders()
 				
 			void main() {
 				#ifdef INSTANCED_XFORM
-					mat4 model_view_xform = transpose(view_xform) * model_xform;
+					mat4 inverse_view_xform = transpose(view_xform);
+					vg_r4pos = inverse_view_xform * model_xform(position);
+				#else
+					vg_r4pos = model_view_xform * position;
 				#endif
-				vg_r4pos = model_view_xform * position;
 
 				//The next two lines can be replaced with a table lookup, but it makes the shader slower (?!)
 				float distance = acos(vg_r4pos.w);
@@ -304,7 +1105,11 @@ void init_shaders()
 						vg_color = color;
 					#endif
 					#ifdef VERTEX_NORMAL
-						vg_normal = model_view_xform * normal;
+						#ifdef INSTANCED_XFORM
+							vg_normal = inverse_view_xform * model_xform(normal);
+						#else
+							vg_normal = model_view_xform * normal;
+						#endif
 					#endif
 				#endif
 			}
@@ -313,18 +1118,11 @@ void init_shaders()
 		NULL,
 		NULL,
 		{
-			new ShaderOption(DEFINE_VERTEX_COLOR),
-			new ShaderOption(DEFINE_VERTEX_NORMAL),
-			new ShaderOption(
-				DEFINE_INSTANCED_XFORM,
-				NULL,
-				NULL,
-				[](ShaderProgram* program) {
-					program->set_matrix("view_xform", s_curcam->get_mat());
-				}
-			),
-			new ShaderOption(DEFINE_INSTANCED_BASE_COLOR),
-			new ShaderOption(DEFINE_SHADOW)
+			new ShaderOption(OPTION_VERTEX_COLOR, DEFINE_VERTEX_COLOR),
+			new ShaderOption(OPTION_VERTEX_NORMAL, DEFINE_VERTEX_NORMAL),
+			new ShaderOption(OPTION_INSTANCED_XFORM, DEFINE_INSTANCED_XFORM),
+			new ShaderOption(OPTION_INSTANCED_BASE_COLOR, DEFINE_INSTANCED_BASE_COLOR),
+			new ShaderOption(OPTION_SHADOW, DEFINE_SHADOW)
 		}
 	);
 
@@ -339,12 +1137,7 @@ void init_shaders()
 				layout (triangle_strip, max_vertices = 4) out;
 			#endif
 
-			uniform mat4 proj_xform;
-			uniform float aspect_ratio;
-
-			#ifdef SHADOW
-				uniform mat4 cube_xforms[6];
-			#else
+			#ifndef SHADOW
 				#ifdef VERTEX_COLOR
 					in vec4 vg_color[];
 					out vec4 gf_color;
@@ -362,8 +1155,23 @@ void init_shaders()
 
 			out vec2 point_coord;
 
+			#ifdef SHADOW
+				uniform int object_face_mask;		//The faces the object's bounding cap touches, see RenderItem.
+			#endif
+
 			#define BASE_POINT_SIZE		(0.002)
 
+			/*
+				Octahedral shadow passes have gl_ClipDistance turned on, and it's undefined after 
+				each EmitVertex(). Points aren't clipped to their octant, so a point right on the 
+				edge of one can spill a little into the wrong part of the map.
+			*/
+			#ifdef SHADOW
+				#define EMIT_POINT_VERTEX()		gl_ClipDistance[0] = gl_ClipDistance[1] = gl_ClipDistance[2] = 1; EmitVertex()
+			#else
+				#define EMIT_POINT_VERTEX()		EmitVertex()
+			#endif
+
 			void main() {
 				gf_r4pos = vg_r4pos[0];
 
@@ -382,8 +1190,12 @@ void init_shaders()
 				float height = BASE_POINT_SIZE * distance_factor, width = height / aspect_ratio;
 
 				#ifdef SHADOW
+					//An octahedral map is drawn once, as "face" 0.
+					uint face_mask = octahedral_shadows != 0 ? 1u : shadow_face_mask & uint(object_face_mask);
 					for(int face = 0; face < 6; face++)
 					{
+						if((face_mask & (1u << face)) == 0)
+							continue;
 						gl_Layer = face;
 				#endif
 						vec4 point = gl_in[0].gl_Position;
@@ -393,7 +1205,10 @@ void init_shaders()
 						distance = abs(image_dist);
 
 						#ifdef SHADOW
-							point = proj_xform * cube_xforms[face] * point;
+							if(octahedral_shadows != 0)
+								point = octant_clip_position(point.xyz, vec3(point.x < 0 ? -1 : 1, point.y < 0 ? -1 : 1, point.z < 0 ? -1 : 1));
+							else
+								point = proj_xform * cube_xforms[face] * point;
 						#else
 							point = proj_xform * point;
 						#endif
@@ -401,18 +1216,24 @@ void init_shaders()
 						point.xyz /= point.w;
 						point.w = 1;
 
+						#ifdef SHADOW
+							//Don't emit a sprite that would be clipped away entirely, most of all for faces the point isn't in.
+							if(abs(point.z) > 1 || abs(point.x) > 1 + width || abs(point.y) > 1 + height)
+								continue;
+						#endif
+
 						gl_Position = point + vec4(-width, -height, 0, 0);
 						point_coord = vec2(-1, 1);
-						EmitVertex();
+						EMIT_POINT_VERTEX();
 						gl_Position = point + vec4(width, -height, 0, 0);
 						point_coord = vec2(1, 1);
-						EmitVertex();
+						EMIT_POINT_VERTEX();
 						gl_Position = point + vec4(-width, height, 0, 0);
 						point_coord = vec2(-1, -1);
-						EmitVertex();
+						EMIT_POINT_VERTEX();
 						gl_Position = point + vec4(width, height, 0, 0);
 						point_coord = vec2(1, -1);
-						EmitVertex();
+						EMIT_POINT_VERTEX();
 						EndPrimitive();
 				#ifdef SHADOW
 					}
@@ -421,19 +1242,11 @@ void init_shaders()
 		)",
 		NULL,
 		NULL,
-		[](ShaderProgram* program) {
-			program->set_float("aspect_ratio", s_curcam->get_aspect_ratio());
-			program->set_matrix("proj_xform", s_curcam->get_proj());
-		},
+		NULL,
 		{
-			new ShaderOption(DEFINE_VERTEX_COLOR),
-			new ShaderOption(DEFINE_INSTANCED_BASE_COLOR),
-			new ShaderOption(
-				DEFINE_SHADOW,
-				[](ShaderProgram* program) {
-					program->set_matrices("cube_xforms", s_cube_xforms, 6);
-				}
-			)
+			new ShaderOption(OPTION_VERTEX_COLOR, DEFINE_VERTEX_COLOR),
+			new ShaderOption(OPTION_INSTANCED_BASE_COLOR, DEFINE_INSTANCED_BASE_COLOR),
+			new ShaderOption(OPTION_SHADOW, DEFINE_SHADOW)
 		}
 	);
 
@@ -443,16 +1256,12 @@ void init_shaders()
 		R"(
 			layout (triangles, invocations = 2) in;
 			#ifdef SHADOW
-				layout (triangle_strip, max_vertices = 18) out;
+				layout (triangle_strip, max_vertices = 24) out;		//8 octants or 6 cube faces
 			#else
 				layout (triangle_strip, max_vertices = 3) out;
 			#endif
 
-			uniform mat4 proj_xform;
-
-			#ifdef SHADOW
-				uniform mat4 cube_xforms[6];
-			#else
+			#ifndef SHADOW
 				#ifdef VERTEX_COLOR
 					in vec4 vg_color[];
 					out vec4 gf_color;
@@ -472,26 +1281,100 @@ void init_shaders()
 
 			out float distance;
 
+			#ifdef SHADOW
+				uniform int object_face_mask;		//The faces the object's bounding cap touches, see RenderItem.
+
+				//Whether the hardware would clip the whole triangle away, i.e. all three vertices are outside the same clip plane.
+				bool outside_frustum(vec4 p[3]) {
+					for(int axis = 0; axis < 3; axis++)
+					{
+						if(p[0][axis] > p[0].w && p[1][axis] > p[1].w && p[2][axis] > p[2].w)
+							return true;
+						if(p[0][axis] < -p[0].w && p[1][axis] < -p[1].w && p[2][axis] < -p[2].w)
+							return true;
+					}
+					return false;
+				}
+
+				//See octahedral_glsl.
+				void emit_octahedral() {
+					vec3 points[3];
+					float distances[3];
+					for(int i = 0; i < 3; i++)
+					{
+						points[i] = gl_in[i].gl_Position.xyz;
+						float dist = length(points[i]);
+						float image_dist = dist - gl_InvocationID * 6.283185;
+						points[i] *= image_dist / dist;
+						distances[i] = abs(image_dist);
+					}
+					vec3 low = min(min(points[0], points[1]), points[2]);
+					vec3 high = max(max(points[0], points[1]), points[2]);
+
+					for(int octant = 0; octant < 8; octant++)
+					{
+						vec3 signs = vec3((octant & 1) != 0 ? -1 : 1, (octant & 2) != 0 ? -1 : 1, (octant & 4) != 0 ? -1 : 1);
+						//Skip the octant if every vertex is on the wrong side of one of its planes.
+						if(any(lessThan(signs * mix(low, high, greaterThan(signs, vec3(0))), vec3(0))))
+							continue;
+						for(int i = 0; i < 3; i++)
+						{
+							gl_Position = octant_clip_position(points[i], signs);
+							gl_ClipDistance[0] = signs.x * points[i].x;
+							gl_ClipDistance[1] = signs.y * points[i].y;
+							gl_ClipDistance[2] = signs.z * points[i].z;
+							distance = distances[i];
+							gf_r4pos = vg_r4pos[i];
+							EmitVertex();
+						}
+						EndPrimitive();
+					}
+				}
+			#endif
+
+			/*
+				In a shadow pass, a triangle is only sent to the faces in both shadow_face_mask and 
+				object_face_mask, and then only if it isn't entirely outside the face's frustum. 
+				Most triangles end up in one face (per image) instead of all six.
+			*/
 			void main() {
 				#ifdef SHADOW
+					if(octahedral_shadows != 0)
+					{
+						emit_octahedral();
+						return;
+					}
+				#endif
+
+				vec4 points[3];
+				float distances[3];
+				for(int i = 0; i < 3; i++)
+				{
+					points[i] = gl_in[i].gl_Position;
+					float dist = length(points[i].xyz);
+					float image_dist = dist - gl_InvocationID * 6.283185;
+					points[i].xyz *= image_dist / dist;
+					distances[i] = abs(image_dist);
+				}
+
+				#ifdef SHADOW
+					uint face_mask = shadow_face_mask & uint(object_face_mask);
 					for(int face = 0; face < 6; face++)
 					{
+						if((face_mask & (1u << face)) == 0)
+							continue;
+						mat4 face_xform = proj_xform * cube_xforms[face];
+						vec4 positions[3] = vec4[3](face_xform * points[0], face_xform * points[1], face_xform * points[2]);
+						if(outside_frustum(positions))
+							continue;
 						gl_Layer = face;
+				#else
+						vec4 positions[3] = vec4[3](proj_xform * points[0], proj_xform * points[1], proj_xform * points[2]);
 				#endif
 						for(int i = 0; i < 3; i++)
 						{
-							vec4 point = gl_in[i].gl_Position;
-
-							float dist = length(point.xyz);
-							float image_dist = dist - gl_InvocationID * 6.283185;
-							point.xyz *= image_dist / dist;
-							distance = abs(image_dist);
-
-							#ifdef SHADOW
-								gl_Position = proj_xform * cube_xforms[face] * point;
-							#else
-								gl_Position = proj_xform * point;
-							#endif
+							gl_Position = positions[i];
+							distance = distances[i];
 							gf_r4pos = vg_r4pos[i];
 
 							#ifndef SHADOW
@@ -515,20 +1398,12 @@ void init_shaders()
 		)",
 		NULL,
 		NULL,
-		[](ShaderProgram* program) {
-			program->set_float("aspect_ratio", s_curcam->get_aspect_ratio());
-			program->set_matrix("proj_xform", s_curcam->get_proj());
-		},
+		NULL,
 		{
-			new ShaderOption(DEFINE_VERTEX_COLOR),
-			new ShaderOption(DEFINE_VERTEX_NORMAL),
-			new ShaderOption(DEFINE_INSTANCED_BASE_COLOR),
-			new ShaderOption(
-				DEFINE_SHADOW,
-				[](ShaderProgram* program) {
-					program->set_matrices("cube_xforms", s_cube_xforms, 6);
-				}
-			)
+			new ShaderOption(OPTION_VERTEX_COLOR, DEFINE_VERTEX_COLOR),
+			new ShaderOption(OPTION_VERTEX_NORMAL, DEFINE_VERTEX_NORMAL),
+			new ShaderOption(OPTION_INSTANCED_BASE_COLOR, DEFINE_INSTANCED_BASE_COLOR),
+			new ShaderOption(OPTION_SHADOW, DEFINE_SHADOW)
 		}
 	);
 
@@ -553,8 +1428,7 @@ void init_shaders()
 				
 			#ifndef SHADOW
 				layout (location = 0) out vec4 frag_albedo;
-				layout (location = 1) out vec4 frag_position;
-				layout (location = 2) out vec4 frag_normal;
+				layout (location = 1) out vec4 frag_normal;
 			#endif
 			layout (depth_any) out float gl_FragDepth;
 
@@ -583,9 +1457,10 @@ void init_shaders()
 						frag_albedo = base_color;
 					#endif
 
-					frag_normal = vec4(point_coord.x, point_coord.y, normal_z, 0);
-
-					frag_position = gf_r4pos + BASE_POINT_SIZE * frag_normal;
+					vec4 normal = vec4(point_coord.x, point_coord.y, normal_z, 0);
+					vec4 position = gf_r4pos + BASE_POINT_SIZE * normal;
+					vec3 direction = (distance > 3.141593 ? -1 : 1) * normalize(position.xyz);
+					frag_normal = pack_gbuffer_normal(normal, position, direction);
 				#endif
 				
 				gl_FragDepth = clamp((distance + BASE_POINT_SIZE * normal_z) / 6.283185, 0, 1);
@@ -595,9 +1470,9 @@ void init_shaders()
 		NULL,
 		NULL,
 		{
-			new ShaderOption(DEFINE_VERTEX_COLOR),
-			new ShaderOption(DEFINE_INSTANCED_BASE_COLOR),
-			new ShaderOption(DEFINE_SHADOW)
+			new ShaderOption(OPTION_VERTEX_COLOR, DEFINE_VERTEX_COLOR),
+			new ShaderOption(OPTION_INSTANCED_BASE_COLOR, DEFINE_INSTANCED_BASE_COLOR),
+			new ShaderOption(OPTION_SHADOW, DEFINE_SHADOW)
 		}
 	);
 
@@ -606,8 +1481,6 @@ void init_shaders()
 		GL_FRAGMENT_SHADER,
 		R"(
 			uniform sampler1D chord2_lut;
-			uniform float chord2_lut_scale;
-			uniform float chord2_lut_offset;
 
 			#ifndef SHADOW
 				#ifdef VERTEX_COLOR
@@ -628,8 +1501,7 @@ void init_shaders()
 				
 			#ifndef SHADOW
 				layout (location = 0) out vec4 frag_albedo;
-				layout (location = 1) out vec4 frag_position;
-				layout (location = 2) out vec4 frag_normal;
+				layout (location = 1) out vec4 frag_normal;
 			#endif
 			layout (depth_any) out float gl_FragDepth;
 
@@ -647,12 +1519,11 @@ void init_shaders()
 					#endif
 					
 					#ifdef VERTEX_NORMAL
-						frag_normal = normalize(gf_normal);
+						vec3 direction = (distance > 3.141593 ? -1 : 1) * normalize(true_position.xyz);
+						frag_normal = pack_gbuffer_normal(normalize(gf_normal), true_position, direction);
 					#else
-						frag_normal = vec4(0, 0, 0, 0);
+						frag_normal = pack_gbuffer_normal(vec4(0, 0, 0, 0), true_position, vec3(0, 0, 1));
 					#endif
-
-					frag_position = true_position;
 				#endif
 				
 				/*
@@ -680,15 +1551,15 @@ void init_shaders()
 			}
 		)",
 		[](ShaderProgram* program) {
-			program->set_lut("chord2_lut", 0, s_chord2_lut);
+			program->set_texture("chord2_lut", 0, s_chord2_lut->get_texture(), s_chord2_lut->get_target());
 		},
 		NULL,
 		NULL,
 		{
-			new ShaderOption(DEFINE_VERTEX_COLOR),
-			new ShaderOption(DEFINE_VERTEX_NORMAL),
-			new ShaderOption(DEFINE_INSTANCED_BASE_COLOR),
-			new ShaderOption(DEFINE_SHADOW)
+			new ShaderOption(OPTION_VERTEX_COLOR, DEFINE_VERTEX_COLOR),
+			new ShaderOption(OPTION_VERTEX_NORMAL, DEFINE_VERTEX_NORMAL),
+			new ShaderOption(OPTION_INSTANCED_BASE_COLOR, DEFINE_INSTANCED_BASE_COLOR),
+			new ShaderOption(OPTION_SHADOW, DEFINE_SHADOW)
 		}
 	);
 
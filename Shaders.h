@@ -5,26 +5,44 @@
 #include "Framebuffer.h"
 #include <vector>
 #include <functional>
-#include <map>
-#include <set>
+#include <unordered_map>
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <string>
 #include "LookupTable.h"
+#include "GLState.h"
 
 
 /*
 	Build a ShaderProgram with ShaderProgram::get(vertex_shader, geometry_shader, fragment_shader).
-	Build the constituent shaders with Shader::get(shader_core, std::set<const char*> {DEFINE_SOMETHING, DEFINE_SOMETHING_ELSE}).
+	Build the constituent shaders with Shader::get(shader_core, OPTION_SOMETHING | OPTION_SOMETHING_ELSE).
 
 	The *::get() functions cache the individual object generated, so renderers with the same requirements 
-	will share the same programs and programs that need the same shaders will share shaders.
+	will share the same programs and programs that need the same shaders will share shaders. Both caches 
+	are hash tables keyed on plain integers and pointers, so looking up an existing program doesn't 
+	allocate anything.
 
 	Shaders are built out of ShaderCores and ShaderOptions. The ShaderCore contains the main chunk of 
-	GLSL for the shader, and ShaderOptions correspond to #defines.
+	GLSL for the shader, and ShaderOptions correspond to #defines. A set of options is a ShaderOptions 
+	bitmask, with one bit for each OPTION_* below.
+
+	Linked programs are cached on disk as driver binaries (glGetProgramBinary), one file per program in 
+	the directory set by ShaderProgram::set_binary_cache_dir(). Shaders are only compiled when a program 
+	isn't in the cache. A cache entry is only used if the GLSL text and the driver (vendor, renderer and 
+	version strings) are exactly the same as when it was written. Anything else, including the driver 
+	rejecting the binary, falls back to a full compile and overwrites the entry. The same directory 
+	has a manifest of every program that's been made, which is written even when the driver can't do 
+	binaries, so ShaderProgram::warm_up_from_cache() knows what to build on any run after the first.
 
 	Uniforms are divided into domains:
 		long term
 		per frame
+		per camera
 		per model
-	Per model uniform management is done in Model.cpp. Long term and per frame uniforms are managed 
+	Per camera uniforms (and per frame ones that every program would otherwise need) are in the 
+	CameraUniforms block below, which goes into every shader. Per model uniform management is done 
+	in Model.cpp. Long term and per frame uniforms are managed 
 	by ShaderPullFuncs. ShaderPullFuncs set uniforms on the shader program from global vars (in S3.h). 
 	Both ShaderCores and ShaderOptions can define ShaderPullFuncs. init funcs should be called 
 	whenever the window is resized, via ShaderProgram::init_all(). (They are also called when the shader 
@@ -35,6 +53,17 @@
 
 typedef std::function<void(class ShaderProgram*)> ShaderPullFunc;
 
+typedef uint32_t ShaderOptions;
+#define MAX_SHADER_OPTIONS			(32)
+
+
+#define OPTION_VERTEX_COLOR			(1u << 0)
+#define OPTION_INSTANCED_XFORM		(1u << 1)
+#define OPTION_INSTANCED_BASE_COLOR	(1u << 2)
+#define OPTION_VERTEX_NORMAL		(1u << 3)
+#define OPTION_SHADOW				(1u << 4)
+#define OPTION_HORIZONTAL			(1u << 5)
+#define NUM_SHARED_OPTIONS			(6)		//Apps can number their own options from here.
 
 #define DEFINE_VERTEX_COLOR			"#define VERTEX_COLOR\n"
 #define DEFINE_INSTANCED_XFORM		"#define INSTANCED_XFORM\n"
@@ -44,11 +73,29 @@ typedef std::function<void(class ShaderProgram*)> ShaderPullFunc;
 #define DEFINE_HORIZONTAL			"#define HORIZONTAL\n"
 
 
+//For hashing uniform and core names without making std::strings out of them.
+struct CStringHash
+{
+	size_t operator() (const char* s) const
+	{
+		size_t ret = 14695981039346656037ull;		//FNV-1a
+		for(; *s; s++)
+			ret = (ret ^ (unsigned char)*s) * 1099511628211ull;
+		return ret;
+	}
+};
+struct CStringEqual
+{
+	bool operator() (const char* a, const char* b) const {return !strcmp(a, b);}
+};
+
+
 struct ShaderOption
 {
-	ShaderOption(const char* def_name, ShaderPullFunc init_func = NULL, ShaderPullFunc frame_func = NULL, ShaderPullFunc use_func = NULL)
-		: def_name(def_name), init_func(init_func), frame_func(frame_func), use_func(use_func) {}
+	ShaderOption(ShaderOptions bit, const char* def_name, ShaderPullFunc init_func = NULL, ShaderPullFunc frame_func = NULL, ShaderPullFunc use_func = NULL)
+		: bit(bit), def_name(def_name), init_func(init_func), frame_func(frame_func), use_func(use_func) {}
 
+	ShaderOptions bit;
 	const char* def_name;
 	ShaderPullFunc init_func, frame_func, use_func;
 };
@@ -64,47 +111,66 @@ struct ShaderCore
 		ShaderPullFunc frame_func,
 		ShaderPullFunc use_func,
 		std::vector<ShaderOption*> options
-	)
-		: name(name), shader_type(shader_type), core_text(core_text), init_func(init_func), frame_func(frame_func), use_func(use_func), options()
-	{
-		for(auto option : options)
-			this->options[option->def_name] = option;
-	}
+	);
 
 	const char* name;
 	GLuint shader_type;
 	const char* core_text;
 	ShaderPullFunc init_func, frame_func, use_func;
-	std::map<const char*, ShaderOption*> options;
+
+	ShaderOptions supported_options;				//all the bits that have an entry in options
+	ShaderOption* options[MAX_SHADER_OPTIONS];		//indexed by bit number
+
+	std::unordered_map<ShaderOptions, class Shader*> shaders;		//every permutation made so far
+
+	//Finds a core by name, or returns NULL.
+	static ShaderCore* find(const char* name);
+
+private:
+	//A function rather than a static member, because some ShaderCores are globals made before main().
+	static std::unordered_map<const char*, ShaderCore*, CStringHash, CStringEqual>& all_cores();
 };
 
 
 class Shader
 {
 public:
-	GLuint get_id() {return id;}
-
-	void init(ShaderProgram* program) {init_func(program);}
-	void frame(ShaderProgram* program) {frame_func(program);}
-	void use(ShaderProgram* program) {use_func(program);}
+	GLuint get_id() {return id;}		//0 until the shader is compiled
+
+	/*
+		Starts compiling the shader if it hasn't been already. With KHR/ARB_parallel_shader_compile the 
+		driver does this on its own threads. Nothing waits on the result until the program is linked, so 
+		compile as many shaders as possible before linking anything.
+	*/
+	void compile();
+	//Blocks until compilation is done and exits with the log if it failed.
+	void check_compile();
+	//Hash of all of the GLSL text, including the #defines for the options.
+	uint64_t get_source_hash() {return source_hash;}
+
+	void init(ShaderProgram* program);
+	void frame(ShaderProgram* program);
+	void use(ShaderProgram* program);
 
 	ShaderCore* get_core() {return core;}
-	const std::set<const char*> get_options() {return options;}
+	ShaderOptions get_options() {return options;}
 
 private:
-	Shader(ShaderCore* core, const std::set<const char*> options);
+	Shader(ShaderCore* core, ShaderOptions options);
 
 	ShaderCore* core;
-	const std::set<const char*> options;
+	const ShaderOptions options;
 
 	GLuint id;
-	ShaderPullFunc init_func, frame_func, use_func;
 
-public:
-	static Shader* get(ShaderCore* core, const std::set<const char*> options);
+	//The options that are on, in bit order, so the pull funcs don't have to go looking for them.
+	std::vector<ShaderOption*> active_options;
 
-private:
-	static std::vector<Shader*> all_shaders;		//This should be a map.
+	std::vector<const char*> text;		//the pieces passed to glShaderSource
+	uint64_t source_hash;
+
+public:
+	static Shader* get(ShaderCore* core, ShaderOptions options);
 };
 
 
@@ -117,42 +183,135 @@ void init_shaders();
 
 
 
+//A uniform location that has already been looked up, so that it can be set repeatedly without going through the name. Get one from ShaderProgram::get_uniform().
+struct Uniform
+{
+	GLint location;
+	int index;		//into the program's copy of its uniform values
+};
+
+
+
+/*
+	One std140 uniform block, shared by every program, for everything that depends only on the camera 
+	or the frame. It's declared in every shader (camera_uniforms_glsl in Shaders.cpp), so the names below are just 
+	globals in GLSL. The buffer has a slot for each camera. use_camera() fills in the camera's slot 
+	(if anything changed) and binds that range, so switching to a light's camera for a shadow pass 
+	doesn't touch any programs. The buffer starts with INITIAL_UNIFORM_CAMERAS slots and doubles 
+	whenever a new camera doesn't fit, so every shadowed light can keep its own slot.
+
+	The matrices are row_major in the block, so they go up as Mat4fs without transposing.
+*/
+#define CAMERA_UNIFORMS_BINDING		(0)
+#define INITIAL_UNIFORM_CAMERAS		(64)
+
+struct alignas(16) CameraUniforms
+{
+	Mat4f view_xform;			//The camera's mat, i.e. the inverse of the view transform.
+	Mat4f proj_xform;
+	Mat4f cube_xforms[6];		//s_cube_xforms, for rendering shadow cube maps.
+	Vec4f fog_color;
+	float aspect_ratio;
+	float fog_density;
+	float fog_scale;
+	float chord2_lut_scale;
+	float chord2_lut_offset;
+	unsigned shadow_face_mask;	//Which of the cube_xforms the shadow geometry shaders draw, one bit per face.
+	unsigned octahedral_shadows;	//Shadow maps are octahedral 2D maps instead of cube maps, see octahedral_glsl.
+};
+
+//Fog isn't per camera, but every camera's slot gets these. Takes effect at the next use_camera().
+void set_fog_uniforms(float density, float scale, const Vec3& color);
+
+#define ALL_CUBE_FACES		(0x3Fu)
+
+//Same for the faces a shadow pass draws into (ALL_CUBE_FACES until it's changed), and the kind of shadow maps.
+void set_shadow_face_mask(unsigned mask);
+unsigned get_shadow_face_mask();
+void set_octahedral_shadows(bool octahedral);
+
+//s_curcam = camera, and point the CameraUniforms block at camera's slot, uploading it if it's changed.
+void use_camera(class Camera* camera);
+
+
 class ShaderProgram
 {
 public:
 	GLuint get_id() {return id;}
+	int get_index() {return index;}		//Programs are numbered in the order they're made.
 	void use()
 	{
-		glUseProgram(id);
+		state_use_program(id);
 		vertex->use(this);
 		if(geometry)
 			geometry->use(this);
-		fragment->use(this);
+		if(fragment)
+			fragment->use(this);
 	}
 	void init()
 	{
 		vertex->init(this);
 		if(geometry)
 			geometry->init(this);
-		fragment->init(this);
+		if(fragment)
+			fragment->init(this);
 	}
 	void frame()
 	{
 		vertex->frame(this);
 		if(geometry)
 			geometry->frame(this);
-		fragment->frame(this);
+		if(fragment)
+			fragment->frame(this);
 	}
-
-	void set_matrix(const char* name, const Mat4& mat);
-	void set_matrices(const char* name, const Mat4* mats, int count);
-	void set_vector(const char* name, const Vec4& v);
-	void set_vector(const char* name, const Vec3& v);
-	void set_float(const char* name, float f);
-	void set_int(const char* name, int i);
-	void set_texture(const char* name, int tex_unit, GLuint texture, GLenum target = GL_TEXTURE_2D);
+	bool is_compute() {return !fragment;}
+
+	/*
+		All the active uniforms are looked up once when the program is linked. get_uniform() finds one 
+		in that table (arrays are under their plain name, without the [0]). If the program doesn't have 
+		the uniform (e.g. the GLSL compiler optimized it out), the location is -1 and setting it does 
+		nothing but count a missing write.
+
+		The program keeps a copy of the last value it sent for each uniform, and the setters don't call 
+		GL if the new value is the same. Uniform values belong to the program, so the copy never goes 
+		stale. (set_texture() still binds the texture every time, because texture units aren't part of 
+		the program.)
+	*/
+	Uniform get_uniform(const char* name) const;
+
+	void set_matrix(Uniform uniform, const Mat4& mat);
+	void set_matrices(Uniform uniform, const Mat4* mats, int count);
+	//The Mat4f versions go straight to GL and let it do the transpose.
+	void set_matrix(Uniform uniform, const Mat4f& mat);
+	void set_matrices(Uniform uniform, const Mat4f* mats, int count);
+	void set_vector(Uniform uniform, const Vec4& v);
+	void set_vector(Uniform uniform, const Vec4f& v);
+	void set_vector(Uniform uniform, const Vec3& v);
+	void set_float(Uniform uniform, float f);
+	void set_int(Uniform uniform, int i);
+	void set_ints(Uniform uniform, const int* values, int count);
+	void set_texture(Uniform uniform, int tex_unit, GLuint texture, GLenum target = GL_TEXTURE_2D);
+
+	void set_matrix(const char* name, const Mat4& mat) {set_matrix(get_uniform(name), mat);}
+	void set_matrices(const char* name, const Mat4* mats, int count) {set_matrices(get_uniform(name), mats, count);}
+	void set_matrix(const char* name, const Mat4f& mat) {set_matrix(get_uniform(name), mat);}
+	void set_matrices(const char* name, const Mat4f* mats, int count) {set_matrices(get_uniform(name), mats, count);}
+	void set_vector(const char* name, const Vec4& v) {set_vector(get_uniform(name), v);}
+	void set_vector(const char* name, const Vec4f& v) {set_vector(get_uniform(name), v);}
+	void set_vector(const char* name, const Vec3& v) {set_vector(get_uniform(name), v);}
+	void set_float(const char* name, float f) {set_float(get_uniform(name), f);}
+	void set_int(const char* name, int i) {set_int(get_uniform(name), i);}
+	void set_ints(const char* name, const int* values, int count) {set_ints(get_uniform(name), values, count);}
+	void set_texture(const char* name, int tex_unit, GLuint texture, GLenum target = GL_TEXTURE_2D) {set_texture(get_uniform(name), tex_unit, texture, target);}
+	//Sets name, name_scale and name_offset.
 	void set_lut(const char* name, int tex_unit, LookupTable* lut);
 
+	//How many times something tried to set a uniform that the program doesn't have. Only for debugging.
+	static int get_missing_uniform_writes() {return missing_uniform_writes;}
+	//How many uniform writes actually went to GL, and how many were skipped because the value was the same.
+	static long long get_issued_uniform_writes() {return issued_uniform_writes;}
+	static long long get_skipped_uniform_writes() {return skipped_uniform_writes;}
+
 	Shader* get_vertex() {return vertex;}
 	Shader* get_geometry() {return geometry;}
 	Shader* get_fragment() {return fragment;}
@@ -163,17 +322,81 @@ private:
 	ShaderProgram(Shader* vert, Shader* geom, Shader* frag);
 
 	GLuint id;
-
-	Shader* vertex;
+	int index;
+	bool linked;		//Only false between begin_link() and finish().
+
+	void begin_link();
+	void finish();
+	bool load_binary();		//Returns false if there's no usable cache entry, leaving the program unlinked.
+	void save_binary();
+	void get_binary_path(char* path, size_t size) const;
+	void get_manifest_name(char* name, size_t size) const;
+	void add_to_manifest() const;
+	uint64_t get_binary_key() const;
+
+	Shader* vertex;			//or the compute shader, for a compute program
 	Shader* geometry;
-	Shader* fragment;
+	Shader* fragment;		//NULL for a compute program
+
+	void reflect_uniforms();
+	//Returns true if value (size bytes) has to be sent to GL, and remembers it.
+	bool needs_write(Uniform uniform, const void* value, int size);
+
+	struct UniformValue
+	{
+		int offset, size;		//in uniform_values
+		int written_size;		//0 if nothing has been written yet
+	};
+
+	std::vector<std::unique_ptr<char[]>> uniform_names;		//storage for the keys of uniform_table
+	std::unordered_map<const char*, Uniform, CStringHash, CStringEqual> uniform_table;
+	std::vector<UniformValue> uniform_value_slots;			//indexed by Uniform::index
+	std::vector<unsigned char> uniform_values;
+
+	static int missing_uniform_writes;
+	static long long issued_uniform_writes, skipped_uniform_writes;
 
 public:
 	static ShaderProgram* get(Shader* vert, Shader* geom, Shader* frag);
+	//A compute program is stored as {comp, NULL, NULL}, so it goes through the same table and binary cache as everything else.
+	static ShaderProgram* get_compute(Shader* comp) {return get(comp, NULL, NULL);}
 
 	static void init_all();
 	static void frame_all();
 
+	//dir = NULL turns off the binary cache and the program manifest. Call before any programs are made.
+	static void set_binary_cache_dir(const char* dir);
+
+	//The shaders in a program.
+	struct Key
+	{
+		Shader *vertex, *geometry, *fragment;
+		bool operator== (const Key& other) const {return vertex == other.vertex && geometry == other.geometry && fragment == other.fragment;}
+	};
+
+	/*
+		Makes all of these programs at once: every shader that needs compiling is submitted, then every 
+		program is linked, and only then does anything wait on the driver. With parallel shader compile 
+		this is much faster than making them one at a time with get(), and it avoids hitches from 
+		programs first being made in the middle of a frame.
+	*/
+	static void warm_up(const std::vector<Key>& programs);
+	//warm_up() every program in the manifest, i.e. every program made on previous runs.
+	static void warm_up_from_cache();
+
 private:
-	static std::vector<ShaderProgram*> all_shader_programs;		//This should be a map.
+	struct KeyHash
+	{
+		size_t operator() (const Key& key) const;
+	};
+
+	static std::vector<ShaderProgram*> all_shader_programs;
+
+	static const char* binary_cache_dir;
+	static const char* manifest_dir;		//binary_cache_dir, except that it stays when the driver can't do binaries
+	static bool binary_cache_ready;
+	static std::vector<std::string> manifest;		//Manifest names (see get_manifest_name()), in the order they were made
+	static uint64_t driver_hash;
+	static void init_binary_cache();
+	static std::unordered_map<Key, ShaderProgram*, KeyHash> program_table;
 };
@@ -6,6 +6,9 @@
 #include "Shaders.h"
 #include "Utils.h"
 #include "Framebuffer.h"
+#include "FrameGraph.h"
+#include "GLState.h"
+#include "RenderQueue.h"
 #include "Light.h"
 #include "TorusWorldShaders.h"
 #include "TorusWorldTransforms.h"
@@ -24,6 +27,9 @@
 #define WALK_SPEED		(TAU / 50)		//Note that this isn't on the same scale as distances on the Sphere.
 #define SUN_SPEED		(TAU / 60)
 
+#define ROLLING_BOULDER_SPEED	(TAU / 40)
+#define ROLLING_BOULDER_SIZE	(0.1)		//boulder_model's radius
+
 #define FOG_INCREMENT	(0.05)
 
 #define EYE_HEIGHT		(0.03)
@@ -38,7 +44,16 @@ enum Mode {
 	DUMP_BLOOM_RESULT
 };
 
+//How the lights are drawn, see Light.h.
+enum LightingMode {
+	PER_LIGHT,
+	SINGLE_PASS,
+	CLUSTERED,
+	NUM_LIGHTING_MODES
+};
+
 bool bloom = true;
+int lighting_mode = CLUSTERED;
 
 
 Model* dots_model;
@@ -50,19 +65,32 @@ ShaderProgram* final_program;
 ShaderProgram *bloom_separate_program, *bloom_program_h, *bloom_program_v;
 Mode mode = NORMAL;
 
-Framebuffer *bloom_separate, *bloom_h, *bloom_v;
 Pass *gpass, *apass, *unlit_pass, *bloom_separate_pass, *bloom_h_pass, *bloom_v_pass, *final_pass;
 
+FrameGraph* frame_graph;
+FrameResource fr_gbuffer, fr_abuffer, fr_shadow_maps, fr_screen, fr_bloom_main, fr_bloom_bright, fr_bloom_h, fr_bloom_v;
+FrameNode final_node, final_no_bloom_node, copy_textures_node, dump_light_map_node, dump_lut_node;
+FrameNode dump_bloom_result_node, dump_bloom_main_color_node, dump_bloom_bright_color_node;
+
 std::vector<Light*> lights;
 
 double last_frame_time;
 
+Mat4 rolling_boulder;		//The one thing in the scene that moves, so it's the dynamic part of the shadows.
+
 
 Mat4 sun_xform()
 {
 	return Mat4::axial_rotation(_x, _y, SUN_SPEED * last_frame_time) * Mat4::axial_rotation(_w, _x, TAU / 4) * Mat4::axial_rotation(_z, _y, TAU / 4);
 }
 
+//Goes around the torus the long way, turning about as fast as it would if it were really rolling.
+Mat4 rolling_boulder_xform()
+{
+	double x = ROLLING_BOULDER_SPEED * last_frame_time;
+	return torus_world_xform(Vec3(x, TAU / 4, 0.05), 0, -INV_ROOT_2 * x / ROLLING_BOULDER_SIZE);
+}
+
 
 struct Controls
 {
@@ -113,10 +141,10 @@ struct PlayerState
 			pos.y += right * sy + fwd * cy;
 		}
 
-		cam.set_mat(torus_world_xform(pos, yaw, pitch));
+		cam.set_rotor(torus_world_rotor(pos, yaw, pitch));
 	}
 
-	void start_jump(Vec4 destination)
+	void start_jump(const Vec4& destination)
 	{
 		jumping = true;
 		jump_start = torus_world_xform(pos).get_column(_w);
@@ -128,6 +156,8 @@ struct PlayerState
 PlayerState player_state;
 
 
+void init_frame_graph();
+
 void init()
 {
 	check_gl_errors("init 0");
@@ -143,28 +173,10 @@ void init()
 	init_shaders();
 	init_framebuffers();
 	init_torus_world_shaders();
+	ShaderProgram::warm_up_from_cache();
 
 	check_gl_errors("init 1");
 
-	bloom_separate = new Screenbuffer(
-		"Bloom Separate",
-		{
-			{GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT0},
-			{GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT1}
-		},
-		{}
-	);
-	bloom_h = new Screenbuffer(
-		"Bloom H",
-		{{GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT0}},
-		{}
-	);
-	bloom_v = new Screenbuffer(
-		"Bloom V",
-		{{GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT0}},
-		{}
-	);
-
 	gpass = new Pass(s_gbuffer);
 
 	/*
@@ -181,15 +193,16 @@ void init()
 	unlit_pass->cull_face = GL_BACK;
 	unlit_pass->blend = false;
 
-	bloom_separate_pass = new Pass(bloom_separate);
+	//The bloom passes' framebuffers come from the frame graph.
+	bloom_separate_pass = new Pass(NULL);
 	bloom_separate_pass->clear_mask = 0;
 	bloom_separate_pass->depth_test = bloom_separate_pass->depth_mask = false;
 	bloom_separate_pass->cull_face = 0;
 	bloom_separate_pass->blend = false;
 
-	bloom_h_pass = new Pass(bloom_h, bloom_separate_pass);
+	bloom_h_pass = new Pass(NULL, bloom_separate_pass);
 
-	bloom_v_pass = new Pass(bloom_v, bloom_separate_pass);
+	bloom_v_pass = new Pass(NULL, bloom_separate_pass);
 
 	final_pass = new Pass(NULL);
 	final_pass->clear_mask = 0;
@@ -200,41 +213,38 @@ void init()
 	check_gl_errors("init 2");
 
 	bloom_separate_program = ShaderProgram::get(
-		Shader::get(vert_screenspace, {}),
+		Shader::get(vert_screenspace, 0),
 		NULL,
-		Shader::get(frag_bloom_separate, {})
+		Shader::get(frag_bloom_separate, 0)
 	);
 
 	bloom_program_h = ShaderProgram::get(
-		Shader::get(vert_screenspace, {}),
+		Shader::get(vert_screenspace, 0),
 		NULL,
-		Shader::get(frag_bloom, {DEFINE_HORIZONTAL})
+		Shader::get(frag_bloom, OPTION_HORIZONTAL)
 	);
 
 	bloom_program_v = ShaderProgram::get(
-		Shader::get(vert_screenspace, {}),
+		Shader::get(vert_screenspace, 0),
 		NULL,
-		Shader::get(frag_bloom, {})
+		Shader::get(frag_bloom, 0)
 	);
 
 	final_program = ShaderProgram::get(
-		Shader::get(vert_screenspace, {}),
+		Shader::get(vert_screenspace, 0),
 		NULL,
-		Shader::get(frag_final_color, {})
+		Shader::get(frag_final_color, 0)
 	);
 
 	check_gl_errors("init 3");
 
-	Vec4* dots = new Vec4[NUM_DOTS];
+	//Only the half of the space with the xy part bigger than the zw part. Swapping the two parts is an 
+	//isometry that exchanges the halves, so doing that to the other half keeps the dots uniform.
+	Vec4f* dots = new Vec4f[NUM_DOTS];
+	thread_random().fill_s3(dots, NUM_DOTS);
 	for(int i = 0; i < NUM_DOTS; i++)
-	{
-		double c, s;
-		do {
-			dots[i] = rand_s3();
-			s = sqrt(1 - dots[i].w * dots[i].w - dots[i].z * dots[i].z);
-			c = sqrt(1 - dots[i].y * dots[i].y - dots[i].x * dots[i].x);
-		} while(c > s);
-	}
+		if(dots[i].z * dots[i].z + dots[i].w * dots[i].w > dots[i].x * dots[i].x + dots[i].y * dots[i].y)
+			dots[i] = Vec4f(dots[i].z, dots[i].w, dots[i].x, dots[i].y);
 	dots_model = new Model(NUM_DOTS, dots);
 	delete[] dots;
 
@@ -246,12 +256,14 @@ void init()
 	boulder_model->generate_primitive_colors(0.3);
 	boulder_model->generate_normals();
 
-	Mat4* boulders = new Mat4[NUM_BOULDERS];
+	Mat4f* boulders = new Mat4f[NUM_BOULDERS];
 	for(int i = 0; i < NUM_BOULDERS; i++)
-		boulders[i] = torus_world_xform(random_torus_pos(0.05, 0.05), frand() * TAU, fsrand() * 0.5 * TAU, fsrand() * 0.5 * TAU);
-	render_boulders = boulder_model->make_draw_func(NUM_BOULDERS, boulders, Vec4(0.7, 0.7, 0.7, 1));
+		boulders[i] = Mat4f(torus_world_xform(random_torus_pos(0.05, 0.05), frand() * TAU, fsrand() * 0.5 * TAU, fsrand() * 0.5 * TAU));
+	render_boulders = boulder_model->make_draw_func(NUM_BOULDERS, boulders, Vec4f(0.7, 0.7, 0.7, 1));
 	delete[] boulders;
 
+	rolling_boulder = rolling_boulder_xform();
+
 	check_gl_errors("init 4");
 
 	//The Sun
@@ -280,28 +292,220 @@ void init()
 		));
 
 	check_gl_errors("init 5");
+
+	init_frame_graph();
+
+	check_gl_errors("init 6");
 }
 
 void reshape(int w, int h)
 {
-	resize_screenbuffers(w, h);
-	cam.set_perspective((double)window_width / window_height);
-
-	ShaderProgram::init_all();
+	request_resize(w, h);
 }
 
 void draw_scene()
 {
-	torus_model->draw(Mat4::identity(), Vec4(0.3, 0.3, 0.3, 1));
-	dots_model->draw(Mat4::identity(), Vec4(1, 1, 1, 1));
+	torus_model->draw(Mat4::identity(), Vec4f(0.3, 0.3, 0.3, 1));
+	dots_model->draw(Mat4::identity(), Vec4f(1, 1, 1, 1));
 	render_boulders();
 }
 
+//Whatever moves. See display() for the invalidate_shadows() calls that go with it.
+void draw_dynamic_scene()
+{
+	boulder_model->draw(rolling_boulder, Vec4f(0.7, 0.5, 0.4, 1));
+}
+
+/*
+	Everything display() draws. Which passes actually run each frame depends on which output
+	display() asks for, e.g. the bloom passes only run if bloom is on or one of the bloom
+	textures is being dumped.
+*/
+void init_frame_graph()
+{
+	frame_graph = new FrameGraph();
+
+	fr_gbuffer = frame_graph->import_resource("G-Buffer");
+	fr_abuffer = frame_graph->import_resource("A-Buffer");
+	fr_shadow_maps = frame_graph->import_resource("Shadow Maps");
+	fr_screen = frame_graph->import_resource("Screen");
+
+	TextureSpec color_spec(GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT0);
+	fr_bloom_main = frame_graph->create_texture("Bloom Main Color", color_spec);
+	fr_bloom_bright = frame_graph->create_texture("Bloom Bright Color", color_spec);
+	fr_bloom_h = frame_graph->create_texture("Bloom H", color_spec);
+	fr_bloom_v = frame_graph->create_texture("Bloom V", color_spec);
+
+	//Geometry Pass
+	frame_graph->add_pass("Geometry", {}, {fr_gbuffer}, []() {
+		gpass->start();
+		draw_scene();
+		draw_dynamic_scene();
+		s_render_queue.execute();
+	});
+
+	//Light (Accumulation) Pass
+	frame_graph->add_pass("Clear A-Buffer", {}, {fr_abuffer}, []() {
+		apass->start();
+	});
+	/*
+		Everything in draw_scene() is static, so a shadow map is only redrawn when its light moves. 
+		The rolling boulder only costs the lights it passes a redraw of draw_dynamic_scene() on 
+		top of their static caches.
+	*/
+	frame_graph->add_pass("Lights", {fr_gbuffer, fr_abuffer}, {fr_abuffer, fr_shadow_maps}, []() {
+		update_shadow_maps(lights, draw_scene, draw_dynamic_scene);
+		switch(lighting_mode)
+		{
+			case PER_LIGHT:
+				for(auto light : lights)
+					light->render();
+				break;
+			case SINGLE_PASS:
+				render_all_lights(lights);
+				break;
+			case CLUSTERED:
+				render_clustered_lights(lights);
+				break;
+		}
+	});
+
+	//Unlit Pass
+	frame_graph->add_pass("Unlit", {fr_gbuffer, fr_abuffer}, {fr_abuffer}, []() {
+		unlit_pass->start();
+		for(auto light : lights)
+			light->draw();
+		s_render_queue.execute();
+	});
+
+	//Bloom Passes
+	frame_graph->add_pass("Bloom Separate", {fr_abuffer}, {fr_bloom_main, fr_bloom_bright}, []() {
+		bloom_separate_pass->start();
+		bloom_separate_program->use();
+		bloom_separate_program->set_texture("color_tex", 0, s_abuffer_color);
+		draw_fsq();
+	}, bloom_separate_pass);
+	frame_graph->add_pass("Bloom H", {fr_bloom_bright}, {fr_bloom_h}, []() {
+		bloom_h_pass->start();
+		bloom_program_h->use();
+		bloom_program_h->set_texture("color_tex", 0, frame_graph->get_texture(fr_bloom_bright));
+		draw_fsq();
+	}, bloom_h_pass);
+	frame_graph->add_pass("Bloom V", {fr_bloom_h}, {fr_bloom_v}, []() {
+		bloom_v_pass->start();
+		bloom_program_v->use();
+		bloom_program_v->set_texture("color_tex", 0, frame_graph->get_texture(fr_bloom_h));
+		draw_fsq();
+	}, bloom_v_pass);
+
+	//Final Pass
+	final_node = frame_graph->add_pass("Final", {fr_bloom_main, fr_bloom_v}, {fr_screen}, []() {
+		final_pass->start();
+		final_program->use();
+		final_program->set_texture("main_color_tex", 0, frame_graph->get_texture(fr_bloom_main));
+		final_program->set_texture("bright_color_tex", 1, frame_graph->get_texture(fr_bloom_v));
+		draw_fsq();
+	});
+	final_no_bloom_node = frame_graph->add_pass("Final (No Bloom)", {fr_abuffer}, {fr_screen}, []() {
+		final_pass->start();
+		final_program->use();
+		final_program->set_texture("main_color_tex", 0, s_abuffer_color);
+		final_program->set_texture("bright_color_tex", 1, 0);		//This is naughty.
+		draw_fsq();
+	});
+
+	//Debug Views
+	copy_textures_node = frame_graph->add_pass("Copy Textures", {fr_gbuffer}, {fr_screen}, []() {
+		ShaderProgram* dump_program = ShaderProgram::get(
+			Shader::get(vert_screenspace, 0),
+			NULL,
+			Shader::get(frag_dump_texture, 0)
+		);
+
+		final_pass->start();
+		dump_program->use();
+	
+		dump_program->set_texture("tex", 0, s_gbuffer_albedo);
+		draw_qsq(0);
+		dump_program->set_texture("tex", 0, s_gbuffer_normal);
+		draw_qsq(1);
+		dump_program->set_texture("tex", 0, s_gbuffer_depth);
+		draw_qsq(2);
+	});
+
+	dump_light_map_node = frame_graph->add_pass("Dump Light Map", {fr_shadow_maps}, {fr_screen}, []() {
+		final_pass->start();
+		glClear(GL_COLOR_BUFFER_BIT);
+		if(octahedral_shadow_maps())
+		{
+			ShaderProgram* dump_program = ShaderProgram::get(
+				Shader::get(vert_screenspace, 0),
+				NULL,
+				Shader::get(frag_dump_texture, 0)
+			);
+			dump_program->use();
+			dump_program->set_texture("tex", 0, lights[0]->shadow_map());
+			draw_fsq();
+			return;
+		}
+
+		ShaderProgram* dump_cube_program = ShaderProgram::get(
+			Shader::get(vert_screenspace, 0),
+			NULL,
+			Shader::get(frag_dump_cubemap, 0)
+		);
+		dump_cube_program->use();
+		dump_cube_program->set_texture("tex", 0, lights[0]->shadow_map(), GL_TEXTURE_CUBE_MAP);
+		dump_cube_program->set_float("z_mult", 1);
+		draw_hsq(0);
+		dump_cube_program->set_float("z_mult", -1);
+		draw_hsq(1);
+	});
+
+	dump_lut_node = frame_graph->add_pass("Dump LUT", {}, {fr_screen}, []() {
+		ShaderProgram* dump_program = ShaderProgram::get(
+			Shader::get(vert_screenspace, 0),
+			NULL,
+			Shader::get(frag_dump_texture1d, 0)
+		);
+		final_pass->start();
+		dump_program->use();
+		dump_program->set_texture("tex", 0, s_chord2_lut->get_texture(), s_chord2_lut->get_target());
+		dump_program->set_float("output_scale", 0.01);
+		dump_program->set_float("output_offset", 0);
+		draw_fsq();
+	});
+
+	auto dump_texture = [](FrameResource resource) {
+		ShaderProgram* dump_program = ShaderProgram::get(
+			Shader::get(vert_screenspace, 0),
+			NULL,
+			Shader::get(frag_dump_texture, 0)
+		);
+		final_pass->start();
+		dump_program->use();
+		dump_program->set_texture("tex", 0, frame_graph->get_texture(resource));
+		draw_fsq();
+	};
+	dump_bloom_result_node = frame_graph->add_pass("Dump Bloom Result", {fr_bloom_h}, {fr_screen}, [=]() {dump_texture(fr_bloom_h);});
+	dump_bloom_main_color_node = frame_graph->add_pass("Dump Bloom Main Color", {fr_bloom_main}, {fr_screen}, [=]() {dump_texture(fr_bloom_main);});
+	dump_bloom_bright_color_node = frame_graph->add_pass("Dump Bloom Bright Color", {fr_bloom_bright}, {fr_screen}, [=]() {dump_texture(fr_bloom_bright);});
+
+	frame_graph->compile();
+}
+
 void display()
 {
 	check_gl_errors("display 0");
 
-	glutWarpPointer(window_width >> 1, window_height >> 1);
+	if(apply_pending_resize())
+	{
+		frame_graph->resize();
+		cam.set_perspective((double)window_width / window_height);
+		ShaderProgram::init_all();
+	}
+
+	glutWarpPointer(default_framebuffer_width >> 1, default_framebuffer_height >> 1);
 
 	double dt = current_time() - last_frame_time;
 
@@ -318,153 +522,38 @@ void display()
 	#ifdef PRINT_FRAME_RATE
 		printf("%f\n", 1.0 / dt);
 		print_matrix(cam.get_mat());
+		printf("GL state changes: %d issued, %d elided\n", state_frame_stats().issued, state_frame_stats().elided);
 		printf("\n");
 	#endif
+	state_new_frame();
 
 	check_gl_errors("display 1");
 
+	set_fog_uniforms(s_fog_density, 0, s_fog_color);
+	use_camera(&cam);
 	ShaderProgram::frame_all();
 
 	check_gl_errors("display 2");
 
-	//Geometry Pass
-	gpass->start();
-	draw_scene();
-
-	check_gl_errors("display 3");
-	
-	//Light (Accumulation) Pass
-	apass->start();
 	lights[0]->set_mat(sun_xform());
 
-	for(auto light : lights)
-		light->render(draw_scene);
-
-	check_gl_errors("display 4");
-	
-	//Unlit Pass
-	unlit_pass->start();
-
-	for(auto light : lights)
-		light->draw();
-
-	check_gl_errors("display 5");
-	
-	if(bloom)
-	{
-		//Bloom Passes
-		bloom_separate_pass->start();
-		bloom_separate_program->use();
-		bloom_separate_program->set_texture("color_tex", 0, s_abuffer_color);
-		draw_fsq();
-
-		bloom_h_pass->start();
-		bloom_program_h->use();
-		bloom_program_h->set_texture("color_tex", 0, bloom_separate->textures[1]);
-		draw_fsq();
-
-		bloom_v_pass->start();
-		bloom_program_v->use();
-		bloom_program_v->set_texture("color_tex", 0, bloom_h->textures[0]);
-		draw_fsq();
-
-		//Final Pass
-		final_pass->start();
-		final_program->set_texture("main_color_tex", 0, bloom_separate->textures[0]);
-		final_program->set_texture("bright_color_tex", 1, bloom_v->textures[0]);
-	}
-	else
-	{
-		//Final Pass
-		final_pass->start();
-		final_program->set_texture("main_color_tex", 0, s_abuffer_color);
-		final_program->set_texture("bright_color_tex", 1, 0);		//This is naughty.
-	}
+	//Where the boulder was and where it is now both change the shadows.
+	invalidate_shadows(lights, rolling_boulder.get_column(_w), ROLLING_BOULDER_SIZE, false);
+	rolling_boulder = rolling_boulder_xform();
+	invalidate_shadows(lights, rolling_boulder.get_column(_w), ROLLING_BOULDER_SIZE, false);
 
+	FrameNode output;
 	switch(mode)
 	{
-		case NORMAL:
-			final_program->use();
-			draw_fsq();
-			break;
-
-		case COPY_TEXTURES:
-			{
-				ShaderProgram* dump_program = ShaderProgram::get(
-					Shader::get(vert_screenspace, {}),
-					NULL,
-					Shader::get(frag_dump_texture, {})
-				);
-
-				dump_program->use();
-			
-				dump_program->set_texture("tex", 0, s_gbuffer_albedo);
-				draw_qsq(0);
-				dump_program->set_texture("tex", 0, s_gbuffer_position);
-				draw_qsq(1);
-				dump_program->set_texture("tex", 0, s_gbuffer_normal);
-				draw_qsq(2);
-				dump_program->set_texture("tex", 0, s_gbuffer_depth);
-				draw_qsq(3);
-			}
-			break;
-
-		case DUMP_LIGHT_MAP:
-			{
-				ShaderProgram* dump_cube_program = ShaderProgram::get(
-					Shader::get(vert_screenspace, {}),
-					NULL,
-					Shader::get(frag_dump_cubemap, {})
-				);
-				glClear(GL_COLOR_BUFFER_BIT);
-				dump_cube_program->use();
-				dump_cube_program->set_texture("tex", 0, lights[0]->shadow_map(), GL_TEXTURE_CUBE_MAP);
-				dump_cube_program->set_float("z_mult", 1);
-				draw_hsq(0);
-				dump_cube_program->set_float("z_mult", -1);
-				draw_hsq(1);
-			}
-			break;
-
-		case DUMP_LUT:
-			{
-				ShaderProgram* dump_program = ShaderProgram::get(
-					Shader::get(vert_screenspace, {}),
-					NULL,
-					Shader::get(frag_dump_texture1d, {})
-				);
-				dump_program->use();
-				dump_program->set_texture("tex", 0, s_chord2_lut->get_texture(), s_chord2_lut->get_target());
-				dump_program->set_float("output_scale", 0.01);
-				dump_program->set_float("output_offset", 0);
-				draw_fsq();
-			}
-			break;
-
-		default:
-			{
-				ShaderProgram* dump_program = ShaderProgram::get(
-					Shader::get(vert_screenspace, {}),
-					NULL,
-					Shader::get(frag_dump_texture, {})
-				);
-				dump_program->use();
-				switch(mode) 
-				{
-					case DUMP_BLOOM_RESULT:
-						dump_program->set_texture("tex", 0, bloom_h->textures[0]);
-						break;
-					case DUMP_BLOOM_MAIN_COLOR:
-						dump_program->set_texture("tex", 0, bloom_separate->textures[0]);
-						break;
-					case DUMP_BLOOM_BRIGHT_COLOR:
-						dump_program->set_texture("tex", 0, bloom_separate->textures[1]);
-						break;
-				}
-				draw_fsq();
-			}
-			break;
+		case NORMAL:					output = bloom ? final_node : final_no_bloom_node;	break;
+		case COPY_TEXTURES:				output = copy_textures_node;						break;
+		case DUMP_LIGHT_MAP:			output = dump_light_map_node;						break;
+		case DUMP_LUT:					output = dump_lut_node;								break;
+		case DUMP_BLOOM_RESULT:			output = dump_bloom_result_node;					break;
+		case DUMP_BLOOM_MAIN_COLOR:		output = dump_bloom_main_color_node;				break;
+		case DUMP_BLOOM_BRIGHT_COLOR:	output = dump_bloom_bright_color_node;				break;
 	}
+	frame_graph->execute({output});
 	
 	check_gl_errors("display 6");
 
@@ -480,8 +569,8 @@ void display()
 
 void mouse(int x, int y)
 {
-	y -= window_height >> 1;
-	x -= window_width >> 1;
+	y -= default_framebuffer_height >> 1;
+	x -= default_framebuffer_width >> 1;
 	player_state.pitch -= PITCH_SENSITIVITY * y;
 	player_state.yaw += YAW_SENSITIVITY * x;
 
@@ -600,6 +689,15 @@ void special(int key, int x, int y)
 		case GLUT_KEY_F8:
 			bloom = !bloom;
 			break;
+		case GLUT_KEY_F9:
+			lighting_mode = (lighting_mode + 1) % NUM_LIGHTING_MODES;
+			break;
+		case GLUT_KEY_F10:
+			s_shadow_map_16_bit = !s_shadow_map_16_bit;
+			break;
+		case GLUT_KEY_F11:
+			s_octahedral_shadows = !s_octahedral_shadows;
+			break;
 	}
 }
 
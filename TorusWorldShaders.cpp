@@ -1,152 +1,404 @@
 #include "TorusWorldShaders.h"
 
 #include "Light.h"
+#include <string>
 
 
-ShaderCore *frag_point_light, *frag_bloom, *frag_bloom_separate, *frag_final_color;
+ShaderCore *frag_point_light, *frag_all_lights, *comp_clustered_lights, *frag_bloom, *frag_bloom_separate, *frag_final_color;
 ShaderCore *frag_copy_textures, *frag_dump_texture, *frag_dump_cubemap, *frag_dump_texture1d;
 
 Screenbuffer* s_abuffer;
 
 
+/*
+	The lighting math for one point light, shared by frag_point_light (one draw per light), 
+	frag_all_lights (every light in one draw) and comp_clustered_lights (every light in one 
+	dispatch). It uses textureLod() because compute shaders don't have derivatives. None of 
+	these textures have mipmaps anyway.
+
+	Shadow maps are layers of the shadow tier arrays, see Light.h.
+*/
+static_assert(NUM_SHADOW_TIERS == 5, "light_map_distance() needs a case for each shadow tier.");
+static const char* point_light_glsl = R"(
+	uniform sampler1D chord2_lut;
+	uniform samplerCubeArray light_maps[5];
+	uniform sampler2DArray light_oct_maps[5];
+
+	#define NUM_SHADOW_SAMPLES 5
+	#define SHADOW_SAMPLE_EXTENT 0.001
+	float shadow_offset(int i) {
+		return -SHADOW_SAMPLE_EXTENT + i * 2 * SHADOW_SAMPLE_EXTENT / (NUM_SHADOW_SAMPLES - 1);
+	}
+
+	#define NUM_FOG_STEPS (15)
+
+	float bnoise(ivec2 p) {
+		int temp =	(p.x * p.y * 999999937) ^
+					(p.x * p.y * 999416681) ^
+					999319777;
+		return float(temp % 135977) / 135976;
+	}
+
+	vec4 chord2_lookup(vec4 delta) {
+		return textureLod(chord2_lut, dot(delta, delta) * chord2_lut_scale + chord2_lut_offset, 0);
+	}
+
+	/*
+		Normalized distance to the nearest occluder in direction, or 2 (beyond everything) if 
+		shadow_tier is -1. Sampler arrays can only be indexed with constants or dynamically 
+		uniform expressions, and the tier isn't uniform in comp_clustered_lights, hence the switch.
+	*/
+	float light_map_distance(vec3 direction, int shadow_tier, int shadow_index) {
+		if(octahedral_shadows != 0)
+		{
+			vec3 oct_coords = vec3(octahedral_encode(direction) * 0.5 + 0.5, shadow_index);
+			switch(shadow_tier)
+			{
+				case 0: return textureLod(light_oct_maps[0], oct_coords, 0).r;
+				case 1: return textureLod(light_oct_maps[1], oct_coords, 0).r;
+				case 2: return textureLod(light_oct_maps[2], oct_coords, 0).r;
+				case 3: return textureLod(light_oct_maps[3], oct_coords, 0).r;
+				case 4: return textureLod(light_oct_maps[4], oct_coords, 0).r;
+			}
+			return 2.0;
+		}
+
+		vec4 coords = vec4(direction, shadow_index);
+		switch(shadow_tier)
+		{
+			case 0: return textureLod(light_maps[0], coords, 0).r;
+			case 1: return textureLod(light_maps[1], coords, 0).r;
+			case 2: return textureLod(light_maps[2], coords, 0).r;
+			case 3: return textureLod(light_maps[3], coords, 0).r;
+			case 4: return textureLod(light_maps[4], coords, 0).r;
+		}
+		return 2.0;
+	}
+
+	//light_xform takes view space to the light's space. The shadow map is layer shadow_index of light_maps[shadow_tier].
+	vec3 point_light(vec4 position, vec4 normal, vec3 albedo, mat4 light_xform, vec3 light_emission, int shadow_tier, int shadow_index) {
+		vec4 lightspace_pos = light_xform * position;
+		vec4 lightspace_delta = lightspace_pos - vec4(0, 0, 0, 1);
+
+		//DISTANCE:
+		vec4 lut_data = chord2_lookup(lightspace_delta);
+		float distance_factor = lut_data.y;		//1 / sin^2(distance)
+
+		//NORMAL:
+		/*
+			Dot product between the surface normal and the far image of the light.
+			If this is positive, we can see the far image of the light. If it's 
+			negative, we can see the near image. Either way, we are illuminated 
+			according to the magnitude of the dot product (if we're not in shadow).
+		*/
+		vec4 lightspace_normal = light_xform * normal;
+		float long_dot = dot(lightspace_normal, lightspace_delta);
+		float normal_factor = abs(long_dot);
+
+		//SHADOW:
+		if(long_dot > 0)			//If we're facing the far image of the light, check the complimentary distance in the opposite direction.
+		{
+			lightspace_pos.xyz = -lightspace_pos.xyz;
+			lut_data.x = 1 - lut_data.x;		//normalized distance
+		}
+		float shadow_factor = 0.0;
+		for(int i = 0; i < NUM_SHADOW_SAMPLES; i++)
+		{
+			float distance_delta = light_map_distance(lightspace_pos.xyz + shadow_offset(i) * lightspace_normal.xyz, shadow_tier, shadow_index) - lut_data.x;
+			shadow_factor += smoothstep(-0.002, 0.0, distance_delta);
+		}
+		shadow_factor /= NUM_SHADOW_SAMPLES;
+
+		return shadow_factor * normal_factor * distance_factor * light_emission * albedo;
+	}
+
+	//Light scattered toward the camera by the fog along the ray in direction, out to distance.
+	vec3 point_light_fog(vec3 direction, float distance, ivec2 pixel_coords, mat4 light_xform, vec3 light_emission, int shadow_tier, int shadow_index) {
+		vec4 ortho_position = vec4(direction, 0);		//Position orthogonalized against the camera position.
+
+		float fog = 0;
+		float theta_offset = bnoise(pixel_coords);
+		for(int i = 1; i < NUM_FOG_STEPS; i++)
+		{
+			float theta = (i + theta_offset) * distance / NUM_FOG_STEPS;
+			vec4 curpos = cos(theta) * vec4(0, 0, 0, 1) + sin(theta) * ortho_position;
+			vec4 lightspace_delta = light_xform * curpos - vec4(0, 0, 0, 1);
+			vec4 lut_data = chord2_lookup(lightspace_delta);
+			float lightspace_distance = lut_data.x;
+
+			if(lightspace_distance < light_map_distance(lightspace_delta.xyz, shadow_tier, shadow_index))
+				fog += lut_data.y;
+			if(1 - lightspace_distance < light_map_distance(-lightspace_delta.xyz, shadow_tier, shadow_index))
+				fog += lut_data.y;
+		}
+		fog *= distance / NUM_FOG_STEPS;
+		
+		//This being strictly additive doesn't work with unlights.
+		return fog_density * fog * fog_color.rgb * light_emission;
+	}
+)";
+
+//The lights SSBO, for the shaders that do every light at once. Goes after point_light_glsl.
+static std::string light_buffer_glsl = std::string()
+	+ "#define LIGHTS_BINDING " + std::to_string(LIGHTS_BINDING) + "\n"
+	+ R"(
+	//Has to match GPULight.
+	struct GPULight {
+		mat4 light_xform;
+		vec4 position;
+		vec4 emission;		//w is the radius of influence
+		int shadow_index;
+		int shadow_tier;
+		int use_fog;
+	};
+	layout (std430, row_major, binding = LIGHTS_BINDING) readonly buffer Lights {
+		GPULight lights[];
+	};
+	uniform int light_count;
+
+	//Everything lights[i] adds to a pixel.
+	vec3 gpu_light(uint i, vec4 position, vec4 normal, vec3 albedo, vec3 direction, float depth, ivec2 pixel_coords) {
+		vec3 ret = point_light(position, normal, albedo, lights[i].light_xform, lights[i].emission.rgb, lights[i].shadow_tier, lights[i].shadow_index);
+		if(lights[i].use_fog != 0)
+			ret += point_light_fog(direction, depth * 6.283185, pixel_coords, lights[i].light_xform, lights[i].emission.rgb, lights[i].shadow_tier, lights[i].shadow_index);
+		return ret;
+	}
+)";
+
+
+static void set_light_map_units(ShaderProgram* program)
+{
+	int units[NUM_SHADOW_TIERS], oct_units[NUM_SHADOW_TIERS];
+	for(int t = 0; t < NUM_SHADOW_TIERS; t++)
+	{
+		units[t] = SHADOW_MAP_ARRAY_UNIT + t;
+		oct_units[t] = OCTAHEDRAL_SHADOW_MAP_UNIT + t;
+	}
+	program->set_ints("light_maps", units, NUM_SHADOW_TIERS);
+	program->set_ints("light_oct_maps", oct_units, NUM_SHADOW_TIERS);
+}
+
+
 void init_torus_world_shaders()
 {
-	s_abuffer = new Screenbuffer("A-Buffer", {{GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT0}}, {{GL_DEPTH_ATTACHMENT, s_gbuffer_depth}});
+	s_abuffer = new Screenbuffer("A-Buffer", {{GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT0}}, {{GL_DEPTH_ATTACHMENT, 0, s_gbuffer, S_GBUFFER_DEPTH_INDEX}});
 
-	frag_point_light = new ShaderCore(
-		"frag_point_light",
-		GL_FRAGMENT_SHADER,
-		R"(
-			uniform sampler1D chord2_lut;
-			uniform float chord2_lut_scale;
-			uniform float chord2_lut_offset;
-
-			uniform sampler2D albedo_tex;
-			uniform sampler2D position_tex;
-			uniform sampler2D normal_tex;
-			uniform sampler2D depth_tex;
-			uniform samplerCube light_map;
-
-			uniform mat4 light_xform;
-			uniform vec4 light_pos;
-			uniform vec3 light_emission;
-
-			#define NUM_SHADOW_SAMPLES 5
-			#define SHADOW_SAMPLE_EXTENT 0.001
-			float shadow_offset(int i) {
-				return -SHADOW_SAMPLE_EXTENT + i * 2 * SHADOW_SAMPLE_EXTENT / (NUM_SHADOW_SAMPLES - 1);
-			}
+	static std::string frag_point_light_text = std::string(point_light_glsl) + R"(
+		uniform sampler2D albedo_tex;
+		uniform sampler2D normal_tex;
+		uniform sampler2D depth_tex;
 
-			#ifdef USE_FOG
-				#define NUM_FOG_STEPS (15)
-				uniform float fog_density;
-				uniform vec3 fog_color;
-
-				float bnoise(ivec2 p) {
-					int temp =	(p.x * p.y * 999999937) ^
-								(p.x * p.y * 999416681) ^
-								999319777;
-					return float(temp % 135977) / 135976;
-				}
-			#endif
+		uniform mat4 light_xform;
+		uniform vec4 light_pos;
+		uniform vec3 light_emission;
+		uniform int shadow_tier;
+		uniform int shadow_index;
 
-			out vec4 frag_color;
+		out vec4 frag_color;
 
-			void main() {
-				ivec2 pixel_coords = ivec2(gl_FragCoord.xy);
-				vec4 albedo = texelFetch(albedo_tex, pixel_coords, 0);
+		void main() {
+			ivec2 pixel_coords = ivec2(gl_FragCoord.xy);
+			vec4 albedo = texelFetch(albedo_tex, pixel_coords, 0);
 
-				//Note: must do something about the back of the player's head when albedo.w == 0.
+			//Note: must do something about the back of the player's head when albedo.w == 0.
 
-				vec4 position = texelFetch(position_tex, pixel_coords, 0);
-				vec4 normal = texelFetch(normal_tex, pixel_coords, 0);
+			vec3 direction = pixel_direction(pixel_coords, textureSize(depth_tex, 0));
+			float depth = texelFetch(depth_tex, pixel_coords, 0).r;
+			vec4 position = gbuffer_position(direction, depth);
+			vec4 normal = unpack_gbuffer_normal(texelFetch(normal_tex, pixel_coords, 0), position, direction);
 
-				vec4 lightspace_pos = light_xform * position;
-				vec4 lightspace_delta = lightspace_pos - vec4(0, 0, 0, 1);
+			frag_color.rgb = point_light(position, normal, albedo.rgb, light_xform, light_emission, shadow_tier, shadow_index);
+			frag_color.a = 1;
 
-				//DISTANCE:
-				vec4 lut_data = texture(chord2_lut, dot(lightspace_delta, lightspace_delta) * chord2_lut_scale + chord2_lut_offset);
-				float distance_factor = lut_data.y;		//1 / sin^2(distance)
+			#ifdef USE_FOG
+				//FOG:
+				frag_color.rgb += point_light_fog(direction, depth * 6.283185, pixel_coords, light_xform, light_emission, shadow_tier, shadow_index);
+			#endif
+		}
+	)";
+	frag_point_light = new ShaderCore(
+		"frag_point_light",
+		GL_FRAGMENT_SHADER,
+		frag_point_light_text.c_str(),
+		[](ShaderProgram* program) {
+			program->set_texture("chord2_lut", 0, s_chord2_lut->get_texture(), s_chord2_lut->get_target());
+			set_light_map_units(program);
+		},
+		NULL,
+		[](ShaderProgram* program) {
+			program->set_texture("albedo_tex", 1, s_gbuffer_albedo);
+			program->set_texture("normal_tex", 2, s_gbuffer_normal);
+			program->set_texture("depth_tex", 3, s_gbuffer_depth);
+		},
+		{
+			new ShaderOption(OPTION_USE_FOG, DEFINE_USE_FOG)
+		}
+	);
 
-				//NORMAL:
-				/*
-					Dot product between the surface normal and the far image of the light.
-					If this is positive, we can see the far image of the light. If it's 
-					negative, we can see the near image. Either way, we are illuminated 
-					according to the magnitude of the dot product (if we're not in shadow).
-				*/
-				vec4 lightspace_normal = light_xform * normal;
-				float long_dot = dot(lightspace_normal, lightspace_delta);
-				float normal_factor = abs(long_dot);
+	//Every light in one fullscreen draw, reading the G-buffer once.
+	static std::string frag_all_lights_text = std::string(point_light_glsl) + light_buffer_glsl + R"(
+		uniform sampler2D albedo_tex;
+		uniform sampler2D normal_tex;
+		uniform sampler2D depth_tex;
 
-				//SHADOW:
-				if(long_dot > 0)			//If we're facing the far image of the light, check the complimentary distance in the opposite direction.
-				{
-					lightspace_pos.xyz = -lightspace_pos.xyz;
-					lut_data.x = 1 - lut_data.x;		//normalized distance
-				}
-				float shadow_factor = 0.0;
-				for(int i = 0; i < NUM_SHADOW_SAMPLES; i++)
-				{
-					float distance_delta = texture(light_map, lightspace_pos.xyz + shadow_offset(i) * lightspace_normal.xyz).r - lut_data.x;
-					shadow_factor += smoothstep(-0.002, 0.0, distance_delta);
-				}
-				shadow_factor /= NUM_SHADOW_SAMPLES;
+		out vec4 frag_color;
 
-				frag_color.rgb = shadow_factor * normal_factor * distance_factor * light_emission * albedo.rgb;
-				frag_color.a = 1;
+		void main() {
+			ivec2 pixel_coords = ivec2(gl_FragCoord.xy);
+			vec4 albedo = texelFetch(albedo_tex, pixel_coords, 0);
+
+			vec3 direction = pixel_direction(pixel_coords, textureSize(depth_tex, 0));
+			float depth = texelFetch(depth_tex, pixel_coords, 0).r;
+			vec4 position = gbuffer_position(direction, depth);
+			vec4 normal = unpack_gbuffer_normal(texelFetch(normal_tex, pixel_coords, 0), position, direction);
+
+			frag_color = vec4(0, 0, 0, 1);
+			for(uint i = 0; i < uint(light_count); i++)
+				frag_color.rgb += gpu_light(i, position, normal, albedo.rgb, direction, depth, pixel_coords);
+		}
+	)";
+	frag_all_lights = new ShaderCore(
+		"frag_all_lights",
+		GL_FRAGMENT_SHADER,
+		frag_all_lights_text.c_str(),
+		[](ShaderProgram* program) {
+			program->set_texture("chord2_lut", 0, s_chord2_lut->get_texture(), s_chord2_lut->get_target());
+			set_light_map_units(program);
+		},
+		NULL,
+		[](ShaderProgram* program) {
+			program->set_texture("albedo_tex", 1, s_gbuffer_albedo);
+			program->set_texture("normal_tex", 2, s_gbuffer_normal);
+			program->set_texture("depth_tex", 3, s_gbuffer_depth);
+		},
+		{}
+	);
 
-				#ifdef USE_FOG
-					//FOG:
-					vec4 ortho_position;		//Position orthogonalized against the camera position.
-					ortho_position.xyz = normalize(position.xyz);
-					ortho_position.w = 0;
-					float distance = texelFetch(depth_tex, pixel_coords, 0).r * 6.283185;
+	/*
+		One workgroup per CLUSTER_TILE_SIZE square tile of the screen. The tile is cut into 
+		NUM_DEPTH_SLICES slices of geodesic depth (0 to TAU, so the far half is far images), and 
+		each slice that has any of the tile's pixels in it is a cluster. The workgroup finds the 
+		lights that can reach each cluster, and then every pixel adds up the lights in its own 
+		cluster, reading the G-buffer once.
+
+		Every pixel of the tile is within tile_angle of tile_direction, so every point of a cluster 
+		is within tile_angle + half a slice of the cluster's center (on the ray through the middle 
+		of the tile, halfway through the slice). A light can reach the cluster if either of its 
+		images (the light itself and its antipode) is within that plus the light's radius of 
+		influence.
+	*/
+	static std::string comp_clustered_lights_text = std::string(point_light_glsl) + light_buffer_glsl
+		+ "#define CLUSTER_TILE_SIZE " + std::to_string(CLUSTER_TILE_SIZE) + "\n"
+		+ "#define NUM_DEPTH_SLICES " + std::to_string(NUM_DEPTH_SLICES) + "u\n"
+		+ "#define MAX_LIGHTS_PER_CLUSTER " + std::to_string(MAX_LIGHTS_PER_CLUSTER) + "u\n"
+		+ R"(
+		layout (local_size_x = CLUSTER_TILE_SIZE, local_size_y = CLUSTER_TILE_SIZE) in;
+
+		uniform sampler2D albedo_tex;
+		uniform sampler2D normal_tex;
+		uniform sampler2D depth_tex;
+
+		layout (rgba32f, binding = 0) writeonly uniform image2D abuffer_image;
+
+		shared uint tile_min_slice, tile_max_slice;
+		shared uint slice_light_count[NUM_DEPTH_SLICES];
+		shared uint slice_lights[NUM_DEPTH_SLICES][MAX_LIGHTS_PER_CLUSTER];
+
+		void main() {
+			ivec2 screen_size = textureSize(depth_tex, 0);
+			ivec2 pixel_coords = ivec2(gl_GlobalInvocationID.xy);
+			bool inside = pixel_coords.x < screen_size.x && pixel_coords.y < screen_size.y;
+			pixel_coords = min(pixel_coords, screen_size - 1);
+			uint num_invocations = CLUSTER_TILE_SIZE * CLUSTER_TILE_SIZE;
+
+			if(gl_LocalInvocationIndex == 0)
+			{
+				tile_min_slice = NUM_DEPTH_SLICES - 1;
+				tile_max_slice = 0;
+			}
+			for(uint s = gl_LocalInvocationIndex; s < NUM_DEPTH_SLICES; s += num_invocations)
+				slice_light_count[s] = 0;
+			barrier();
+
+			float depth = texelFetch(depth_tex, pixel_coords, 0).r;
+			uint slice = min(uint(depth * NUM_DEPTH_SLICES), NUM_DEPTH_SLICES - 1);
+			if(inside)
+			{
+				atomicMin(tile_min_slice, slice);
+				atomicMax(tile_max_slice, slice);
+			}
+			barrier();
+
+			//CULLING:
+			vec2 tile_min = vec2(gl_WorkGroupID.xy * CLUSTER_TILE_SIZE);
+			vec2 tile_max = min(tile_min + CLUSTER_TILE_SIZE, vec2(screen_size));
+			vec3 tile_direction = screen_direction(0.5 * (tile_min + tile_max), screen_size);
+			float tile_angle = 0;
+			for(int corner = 0; corner < 4; corner++)
+			{
+				vec2 corner_pos = vec2((corner & 1) != 0 ? tile_max.x : tile_min.x, (corner & 2) != 0 ? tile_max.y : tile_min.y);
+				tile_angle = max(tile_angle, acos(clamp(dot(tile_direction, screen_direction(corner_pos, screen_size)), -1, 1)));
+			}
+			float slice_depth = 6.283185 / NUM_DEPTH_SLICES;
 
-					float fog = 0;
-					float theta_offset = bnoise(pixel_coords);
-					for(int i = 1; i < NUM_FOG_STEPS; i++)
+			for(uint i = gl_LocalInvocationIndex; i < uint(light_count); i += num_invocations)
+			{
+				float reach = tile_angle + 0.5 * slice_depth + lights[i].emission.w;
+				for(uint s = tile_min_slice; s <= tile_max_slice; s++)
+				{
+					float middle = (s + 0.5) * slice_depth;
+					vec4 center = vec4(sin(middle) * tile_direction, cos(middle));
+					float light_distance = acos(clamp(dot(center, lights[i].position), -1, 1));
+					if(light_distance < reach || 3.141593 - light_distance < reach)
 					{
-						float theta = (i + theta_offset) * distance / NUM_FOG_STEPS;
-						vec4 curpos = cos(theta) * vec4(0, 0, 0, 1) + sin(theta) * ortho_position;
-						//Note: reusing variables from before. I don't like this.
-						lightspace_delta = light_xform * curpos - vec4(0, 0, 0, 1);
-						lut_data = texture(chord2_lut, dot(lightspace_delta, lightspace_delta) * chord2_lut_scale + chord2_lut_offset);
-						float lightspace_distance = lut_data.x;
-
-						if(lightspace_distance < texture(light_map, lightspace_delta.xyz).r)
-							fog += lut_data.y;
-						if(1 - lightspace_distance < texture(light_map, -lightspace_delta.xyz).r)
-							fog += lut_data.y;
+						uint index = atomicAdd(slice_light_count[s], 1);
+						if(index < MAX_LIGHTS_PER_CLUSTER)
+							slice_lights[s][index] = i;
 					}
-					fog *= distance / NUM_FOG_STEPS;
-					
-					//This being strictly additive doesn't work with unlights.
-					frag_color.xyz += fog_density * fog * fog_color * light_emission;
-				#endif
+				}
 			}
-		)",
+			barrier();
+
+			//SHADING:
+			vec4 albedo = texelFetch(albedo_tex, pixel_coords, 0);
+			vec3 direction = pixel_direction(pixel_coords, screen_size);
+			vec4 position = gbuffer_position(direction, depth);
+			vec4 normal = unpack_gbuffer_normal(texelFetch(normal_tex, pixel_coords, 0), position, direction);
+
+			/*
+				A cluster that got more than MAX_LIGHTS_PER_CLUSTER lights doesn't know which ones 
+				made it into its list (that's up to the order of the atomicAdd()s), so it loops 
+				over every light instead, the same as frag_all_lights. Slower, but the same 
+				picture every frame.
+			*/
+			vec3 color = vec3(0, 0, 0);
+			uint count = slice_light_count[slice];
+			if(count > MAX_LIGHTS_PER_CLUSTER)
+				for(uint i = 0; i < uint(light_count); i++)
+					color += gpu_light(i, position, normal, albedo.rgb, direction, depth, pixel_coords);
+			else
+				for(uint j = 0; j < count; j++)
+					color += gpu_light(slice_lights[slice][j], position, normal, albedo.rgb, direction, depth, pixel_coords);
+
+			if(inside)
+				imageStore(abuffer_image, ivec2(gl_GlobalInvocationID.xy), vec4(color, 1));
+		}
+	)";
+	comp_clustered_lights = new ShaderCore(
+		"comp_clustered_lights",
+		GL_COMPUTE_SHADER,
+		comp_clustered_lights_text.c_str(),
 		[](ShaderProgram* program) {
-			program->set_lut("chord2_lut", 0, s_chord2_lut);
+			program->set_texture("chord2_lut", 0, s_chord2_lut->get_texture(), s_chord2_lut->get_target());
+			set_light_map_units(program);
 		},
 		NULL,
 		[](ShaderProgram* program) {
 			program->set_texture("albedo_tex", 1, s_gbuffer_albedo);
-			program->set_texture("position_tex", 2, s_gbuffer_position);
-			program->set_texture("normal_tex", 3, s_gbuffer_normal);
+			program->set_texture("normal_tex", 2, s_gbuffer_normal);
+			program->set_texture("depth_tex", 3, s_gbuffer_depth);
 		},
-		{
-			new ShaderOption(
-				DEFINE_USE_FOG,
-				NULL,
-				NULL,
-				[](ShaderProgram* program) {
-					program->set_float("fog_density", s_fog_density);
-					program->set_vector("fog_color", s_fog_color);
-					program->set_texture("depth_tex", 4, s_gbuffer_depth);
-				}
-			)
-		}
+		{}
 	);
 
 	frag_bloom_separate = new ShaderCore(
@@ -208,7 +460,7 @@ void init_torus_world_shaders()
 		NULL,
 		NULL,
 		{
-			new ShaderOption(DEFINE_HORIZONTAL)
+			new ShaderOption(OPTION_HORIZONTAL, DEFINE_HORIZONTAL)
 		}
 	);
 
@@ -3,6 +3,7 @@
 #include "Shaders.h"
 
 
+#define OPTION_USE_FOG		(1u << NUM_SHARED_OPTIONS)
 #define DEFINE_USE_FOG		"#define USE_FOG\n"
 
 
@@ -10,7 +11,9 @@ extern Screenbuffer* s_abuffer;
 #define s_abuffer_color (s_abuffer->textures[0])
 
 //Screenspace shaders:
-extern ShaderCore *frag_point_light, *frag_bloom_separate, *frag_bloom, *frag_final_color;
+extern ShaderCore *frag_point_light, *frag_all_lights, *frag_bloom_separate, *frag_bloom, *frag_final_color;
+//Compute shaders:
+extern ShaderCore *comp_clustered_lights;
 //Debugging shaders:
 extern ShaderCore *frag_dump_texture, *frag_dump_cubemap, *frag_dump_texture1d;
 
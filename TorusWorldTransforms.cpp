@@ -4,27 +4,33 @@
 #include "Utils.h"
 
 
-Mat4 torus_world_xform(Vec3 p, double yaw, double pitch, double roll)
+Rotor torus_world_rotor(const Vec3& p, double yaw, double pitch, double roll)
 {
-	double cx = cos(p.x), sx = sin(p.x), cy = cos(p.y), sy = sin(p.y);
-	Vec4 pos = INV_ROOT_2 * Vec4(cx, -sx, cy, sy);
-	Vec4 fwd = Vec4(0, 0, -sy, cy);
+	/*
+		The frame at p.x = p.y = 0 is
+			right = (0, -1, 0, 0), down = (-1, 0, 1, 0) / root 2, fwd = (0, 0, 0, 1), pos = (1, 0, 1, 0) / root 2
+		and moving in x and y just rotates it in the y-x and z-w planes respectively.
+	*/
+	static const Rotor origin_frame = Rotor::from_mat(Mat4::from_columns(
+		Vec4(0, -1, 0, 0),
+		INV_ROOT_2 * Vec4(-1, 0, 1, 0),
+		Vec4(0, 0, 0, 1),
+		INV_ROOT_2 * Vec4(1, 0, 1, 0)
+	));
 
-	Vec4 down = INV_ROOT_2 * Vec4(-cx, sx, cy, sy);
-	Vec4 right = Vec4(-sx, -cx, 0, 0);
-	
-	Mat4 ret = Mat4::from_columns(right, down, fwd, pos) * Mat4::axial_rotation(_y, _w, p.z);
+	Rotor ret = Rotor::axial_rotation(_y, _x, p.x) * Rotor::axial_rotation(_z, _w, p.y) * origin_frame;
+	ret.rotate(_y, _w, p.z);
 	if(yaw != 0)
-		ret = ret * Mat4::axial_rotation(_z, _x, yaw);
+		ret.rotate(_z, _x, yaw);
 	if(pitch != 0)
-		ret = ret * Mat4::axial_rotation(_y, _z, pitch);
+		ret.rotate(_y, _z, pitch);
 	if(roll != 0)
-		ret = ret * Mat4::axial_rotation(_x, _y, roll);
+		ret.rotate(_x, _y, roll);
 	return ret;
 }
 
 
-Vec3 inverse_torus_world_xform(Vec4 p)
+Vec3 inverse_torus_world_xform(const Vec4& p)
 {
 	Vec3 ret;
 	ret.x = atan2(-p.y, p.x);
@@ -56,7 +62,7 @@ bool r_binary_search(SearchableFunc f, double x0, double x1, double f0, double f
 
 //Find intersection between the ray p, v and the Torus.
 //Dunno how to solve this exactly, so use binary search.
-bool cast_ray(Vec4 p, Vec4 v, Vec4& out_hit)
+bool cast_ray(const Vec4& p, const Vec4& v, Vec4& out_hit)
 {
 	double	c2 = p.x * p.x + p.y * p.y - p.z * p.z - p.w * p.w,
 			s2 = v.x * v.x + v.y * v.y - v.z * v.z - v.w * v.w,
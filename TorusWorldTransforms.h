@@ -2,12 +2,15 @@
 
 
 #include "Vector.h"
+#include "Rotor.h"
 
 
-Mat4 torus_world_xform(Vec3 p, double yaw = 0, double pitch = 0, double roll = 0);
+Rotor torus_world_rotor(const Vec3& p, double yaw = 0, double pitch = 0, double roll = 0);
+inline Mat4 torus_world_xform(const Vec3& p, double yaw = 0, double pitch = 0, double roll = 0)
+	{return torus_world_rotor(p, yaw, pitch, roll).to_mat();}
 
-Vec3 inverse_torus_world_xform(Vec4 p);
+Vec3 inverse_torus_world_xform(const Vec4& p);
 
-bool cast_ray(Vec4 p, Vec4 v, Vec4& out_hit);
+bool cast_ray(const Vec4& p, const Vec4& v, Vec4& out_hit);
 
 Vec3 random_torus_pos(double min_height, double max_height);
@@ -5,74 +5,44 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include "GL/glew.h"
+#include <thread>
+#include <atomic>
+#include <vector>
 
 #pragma warning(disable : 4244)
 
 
-
-//RNG adapted from Numerical Recipes 3rd Edition (Generator A1).
-
-#define A1	(21)
-#define A2	(35)
-#define A3	(4)
-
-unsigned long long random_seed;
-
-void init_random()
-{
-	random_seed = clock();
-}
-
-unsigned long long random()
-{
-	random_seed ^= (random_seed >> A1);
-	random_seed ^= (random_seed << A2);
-	random_seed ^= (random_seed >> A3);
-	return random_seed;
-}
-
-double frand()
-{
-	return 5.42101086242752217E-20 * random();
-}
-
-double fsrand()
-{
-	return 2.0 * frand() - 1.0;
-}
-
 double current_time()
 {
 	return (double)clock() / CLOCKS_PER_SEC;
 }
 
 
-Vec4 rand_s3()
+void parallel_chunks(int num_chunks, const std::function<void(int)>& work)
 {
-	for(;;)
+	int num_threads = std::thread::hardware_concurrency();
+	if(num_threads > num_chunks)
+		num_threads = num_chunks;
+	if(num_threads <= 1)
 	{
-		Vec4 ret(fsrand(), fsrand(), fsrand(), fsrand());
-		float l2 = ret.mag2();
-		if(l2 > 0 && l2 < 1)
-		{
-			ret.normalize_in_place();
-			return ret;
-		}
+		for(int chunk = 0; chunk < num_chunks; chunk++)
+			work(chunk);
+		return;
 	}
-}
 
-Vec3 rand_s2()
-{
-	for(;;)
-	{
-		Vec3 ret(fsrand(), fsrand(), fsrand());
-		float l2 = ret.mag2();
-		if(l2 > 0 && l2 < 1)
-		{
-			ret.normalize_in_place();
-			return ret;
-		}
-	}
+	std::atomic<int> next_chunk(0);
+	auto worker = [&]() {
+		for(int chunk = next_chunk++; chunk < num_chunks; chunk = next_chunk++)
+			work(chunk);
+	};
+
+	//This thread does its share too.
+	std::vector<std::thread> threads;
+	for(int i = 1; i < num_threads; i++)
+		threads.emplace_back(worker);
+	worker();
+	for(auto& thread : threads)
+		thread.join();
 }
 
 
@@ -1,17 +1,18 @@
 #pragma once
 
 #include "Vector.h"
+#include "Random.h"
+#include <functional>
 
 
-void init_random();
-unsigned long long random();
-double frand();
-double fsrand();
-
 double current_time();
 
-Vec4 rand_s3();
-Vec3 rand_s2();
+/*
+	Call work(chunk) for chunk = 0 through num_chunks - 1, spread over up to hardware_concurrency() threads, 
+	and wait for them all. How the work is split up depends only on num_chunks, so as long as each chunk 
+	only touches its own data, the result is the same on any machine.
+*/
+void parallel_chunks(int num_chunks, const std::function<void(int)>& work);
 
 void error(const char* fmt, ...);
 
@@ -5,53 +5,134 @@
 
 //const Vec4 xhat(1, 0, 0, 0), yhat(0, 1, 0, 0), zhat(0, 0, 1, 0), what(0, 0, 0, 1);
 
-Mat4 basis_around(Vec4 a, Vec4 b, double* chord)
+
+template<typename T>
+static void transform_vectors(const Mat4T<T>& m, const Vec4T<T>* in, Vec4T<T>* out, int count)
+{
+	//m * v = v.x * column x + ... + v.w * column w, so transposing m once turns every product into combine_rows().
+	Mat4T<T> columns = ~m;
+	for(int i = 0; i < count; i++)
+	{
+		Vec4T<T> temp = in[i];
+		Mat4T<T>::combine_rows(temp.components, columns, out[i].components);
+	}
+}
+
+template<typename T>
+static void transform_matrices(const Mat4T<T>& m, const Mat4T<T>* in, Mat4T<T>* out, int count)
+{
+	for(int n = 0; n < count; n++)
+	{
+		Mat4T<T> temp = in[n];
+		for(int i = 0; i < 4; i++)
+			Mat4T<T>::combine_rows(m.data[i], temp, out[n].data[i]);
+	}
+}
+
+void transform(const Mat4& m, const Vec4* in, Vec4* out, int count)
+{
+	transform_vectors(m, in, out, count);
+}
+
+void transform(const Mat4f& m, const Vec4f* in, Vec4f* out, int count)
 {
-	double dp = a * b;
-	if(chord)
-		*chord = acos(dp);
-	b = (b - dp * a).normalize();
+	transform_vectors(m, in, out, count);
+}
 
-	Vec4 temp1;
-	do {
-		temp1 = rand_s3();
-	}while((temp1 - a).mag2() < 0.2 || (temp1 - b).mag2() < 0.2);
-	temp1 = (temp1 - a * (a * temp1) - b * (b * temp1)).normalize();
+void transform(const Mat4& m, const Mat4* in, Mat4* out, int count)
+{
+	#if defined(S3_AVX2)
+		__m256d coefficients[4][4];
+		for(int i = 0; i < 4; i++)
+			for(int k = 0; k < 4; k++)
+				coefficients[i][k] = _mm256_set1_pd(m.data[i][k]);
 
-	Vec4 temp2;
-	do {
-		temp2 = rand_s3();
-	}while((temp2 - a).mag2() < 0.2 || (temp2 - b).mag2() < 0.2 || (temp2 - temp1).mag2() < 0.2);
-	temp2 = (temp2 - a * (a * temp2) - b * (b * temp2) - temp1 * (temp1 * temp2)).normalize();
+		for(int n = 0; n < count; n++)
+		{
+			__m256d rows[4];
+			for(int k = 0; k < 4; k++)
+				rows[k] = _mm256_loadu_pd(in[n].data[k]);
+			for(int i = 0; i < 4; i++)
+			{
+				__m256d acc = _mm256_mul_pd(coefficients[i][0], rows[0]);
+				acc = _mm256_add_pd(acc, _mm256_mul_pd(coefficients[i][1], rows[1]));
+				acc = _mm256_add_pd(acc, _mm256_mul_pd(coefficients[i][2], rows[2]));
+				acc = _mm256_add_pd(acc, _mm256_mul_pd(coefficients[i][3], rows[3]));
+				_mm256_storeu_pd(out[n].data[i], acc);
+			}
+		}
+	#else
+		transform_matrices(m, in, out, count);
+	#endif
+}
 
-	Mat4 ret = Mat4::from_columns(temp1, temp2, b, a);
+void transform(const Mat4f& m, const Mat4f* in, Mat4f* out, int count)
+{
+	#if defined(S3_SSE_FLOAT)
+		__m128 coefficients[4][4];
+		for(int i = 0; i < 4; i++)
+			for(int k = 0; k < 4; k++)
+				coefficients[i][k] = _mm_set1_ps(m.data[i][k]);
 
-	if(ret.determinant() < 0)
-		ret.set_column(0, -temp1);
+		for(int n = 0; n < count; n++)
+		{
+			__m128 rows[4];
+			for(int k = 0; k < 4; k++)
+				rows[k] = _mm_loadu_ps(in[n].data[k]);
+			for(int i = 0; i < 4; i++)
+			{
+				__m128 acc = _mm_mul_ps(coefficients[i][0], rows[0]);
+				acc = _mm_add_ps(acc, _mm_mul_ps(coefficients[i][1], rows[1]));
+				acc = _mm_add_ps(acc, _mm_mul_ps(coefficients[i][2], rows[2]));
+				acc = _mm_add_ps(acc, _mm_mul_ps(coefficients[i][3], rows[3]));
+				_mm_storeu_ps(out[n].data[i], acc);
+			}
+		}
+	#else
+		transform_matrices(m, in, out, count);
+	#endif
+}
 
-	return ret;
+void transpose_to_floats(const Mat4* in, float* out, int count)
+{
+	for(int n = 0; n < count; n++)
+	{
+		Mat4 temp = ~in[n];
+		for(int i = 0; i < 16; i++)
+			out[16 * n + i] = (float)temp.data[i >> 2][i & 3];
+	}
 }
 
-void print_vector(const Vec4& v, FILE* fout)
+template<typename T>
+void print_vector(const Vec4T<T>& v, FILE* fout)
 {
 	for(int i = 0; i < 4; i++)
-		fprintf(fout, "% 0.4f ", v[i]);
+		fprintf(fout, "% 0.4f ", (double)v[i]);
 	fprintf(fout, "\n");
 }
 
-void print_vector(const Vec3& v, FILE* fout)
+template<typename T>
+void print_vector(const Vec3T<T>& v, FILE* fout)
 {
 	for(int i = 0; i < 3; i++)
-		fprintf(fout, "% 0.4f ", v[i]);
+		fprintf(fout, "% 0.4f ", (double)v[i]);
 	fprintf(fout, "\n");
 }
 
-void print_matrix(const Mat4& m, FILE* fout)
+template<typename T>
+void print_matrix(const Mat4T<T>& m, FILE* fout)
 {
 	for(int i = 0; i < 4; i++)
 	{
 		for(int j = 0; j < 4; j++)
-			fprintf(fout, "% 0.4f ", m.data[i][j]);
+			fprintf(fout, "% 0.4f ", (double)m.data[i][j]);
 		fprintf(fout, "\n");
 	}
-}
\ No newline at end of file
+}
+
+template void print_vector(const Vec4& v, FILE* fout);
+template void print_vector(const Vec4f& v, FILE* fout);
+template void print_vector(const Vec3& v, FILE* fout);
+template void print_vector(const Vec3f& v, FILE* fout);
+template void print_matrix(const Mat4& m, FILE* fout);
+template void print_matrix(const Mat4f& m, FILE* fout);
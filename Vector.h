@@ -2,6 +2,26 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <type_traits>
+#include <stddef.h>
+
+/*
+	Mat4 and Vec4 have hand-written SIMD kernels. S3_AVX2 is used when the compiler is allowed
+	to emit AVX2 (/arch:AVX2 on the x64 configurations), otherwise S3_SSE2 (which every x64 CPU
+	has). If neither is available, the plain loops are used.
+*/
+#if defined(__AVX2__)
+	#define S3_AVX2
+	#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define S3_SSE2
+	#include <emmintrin.h>
+#endif
+
+//Both of the above include SSE, which is all the float kernels need.
+#if defined(S3_AVX2) || defined(S3_SSE2)
+	#define S3_SSE_FLOAT
+#endif
 
 
 #define _x (0)
@@ -22,85 +42,181 @@
 //% is used for the cross product of Vec3s.
 //~ is used for the transpose of a Mat4.
 
+/*
+	The vector and matrix types are templated on the scalar type. Vec3, Vec4 and Mat4 are the
+	double versions and are what the CPU side uses for anything that accumulates (the camera,
+	lights, anything that gets multiplied by itself frame after frame). Vec3f, Vec4f and Mat4f
+	are the float versions and are what Models store and what goes to the GPU, so they can be
+	uploaded without conversion. Converting between the two has to be done explicitly, e.g.
+	Mat4f(some_mat4).
+
+	Almost everything here is constexpr, so that fixed transforms and geometry can be worked out 
+	at compile time (see BakedTables.h and MakeModel.h). The SIMD kernels and the libm functions 
+	aren't constexpr, so the functions below check std::is_constant_evaluated() and use the plain 
+	loops and the cx_*() functions when they're being run by the compiler. A Vec's x, y, z, w and 
+	components[] share storage in a union, and the compiler only lets us use the member that was 
+	last written, so constexpr code has to go through x, y, z, w (which operator[] does).
+*/
+
+
+//Compile-time versions of the bits of math.h that we need. At run time these just call math.h.
+constexpr double cx_sqrt(double x)
+{
+	if(!std::is_constant_evaluated())
+		return sqrt(x);
+	if(x <= 0)
+		return 0;
+	//Newton's method from above converges monotonically, so stop when it stops decreasing.
+	double guess = x > 1 ? x : 1;
+	while(true)
+	{
+		double next = 0.5 * (guess + x / guess);
+		if(next >= guess)
+			return guess;
+		guess = next;
+	}
+}
+
+//Taylor series, good to double precision for |x| <= TAU / 8.
+constexpr double _cx_sin_reduced(double x)
+{
+	double x2 = x * x, term = x, sum = x;
+	for(int n = 1; n < 12; n++)
+	{
+		term *= -x2 / ((2 * n) * (2 * n + 1));
+		sum += term;
+	}
+	return sum;
+}
 
-struct Vec3
+constexpr double _cx_cos_reduced(double x)
+{
+	double x2 = x * x, term = 1, sum = 1;
+	for(int n = 1; n < 12; n++)
+	{
+		term *= -x2 / ((2 * n - 1) * (2 * n));
+		sum += term;
+	}
+	return sum;
+}
+
+//Reduce x to quadrant * TAU / 4 + remainder with |remainder| <= TAU / 8.
+constexpr void _cx_reduce_quarter_turns(double x, int& quadrant, double& remainder)
+{
+	double turns = x / (TAU / 4);
+	long long n = (long long)(turns + (turns >= 0 ? 0.5 : -0.5));
+	remainder = x - n * (TAU / 4);
+	quadrant = (int)(((n % 4) + 4) % 4);
+}
+
+constexpr double cx_sin(double x)
+{
+	if(!std::is_constant_evaluated())
+		return sin(x);
+	int quadrant = 0;
+	double r = 0;
+	_cx_reduce_quarter_turns(x, quadrant, r);
+	switch(quadrant)
+	{
+		case 0: return _cx_sin_reduced(r);
+		case 1: return _cx_cos_reduced(r);
+		case 2: return -_cx_sin_reduced(r);
+		default: return -_cx_cos_reduced(r);
+	}
+}
+
+constexpr double cx_cos(double x)
+{
+	if(!std::is_constant_evaluated())
+		return cos(x);
+	int quadrant = 0;
+	double r = 0;
+	_cx_reduce_quarter_turns(x, quadrant, r);
+	switch(quadrant)
+	{
+		case 0: return _cx_cos_reduced(r);
+		case 1: return -_cx_sin_reduced(r);
+		case 2: return -_cx_cos_reduced(r);
+		default: return _cx_sin_reduced(r);
+	}
+}
+
+
+template<typename T>
+struct Vec3T
 {
 	union
 	{
 		struct
 		{
-			double x, y, z;
+			T x, y, z;
 		};
-		double components[3];
+		T components[3];
 	};
 
-	Vec3() {}
-	Vec3(int index)
-	{
-		for(int i = 0; i < 3; i++)
-			components[i] = i == index ? 1 : 0;
-	}
-	Vec3(const Vec3& other)
-	{
-		for(int i = 0; i < 3; i++)
-			components[i] = other[i];
-	}
-	Vec3(double x, double y, double z = 0)
-	{
-		this->x = x;
-		this->y = y;
-		this->z = z;
+	Vec3T() = default;
+	constexpr Vec3T(int index)
+		: x(index == 0 ? 1 : 0), y(index == 1 ? 1 : 0), z(index == 2 ? 1 : 0) {}
+	constexpr Vec3T(T x, T y, T z = 0)
+		: x(x), y(y), z(z) {}
+	constexpr Vec3T(const T* components)
+		: x(components[0]), y(components[1]), z(components[2]) {}
+	template<typename U>
+	constexpr explicit Vec3T(const Vec3T<U>& other)
+		: x((T)other.x), y((T)other.y), z((T)other.z) {}
+
+	constexpr T operator[] (unsigned int index) const
+	{
+		if(std::is_constant_evaluated())
+			return index == 0 ? x : (index == 1 ? y : z);
+		return components[index];
 	}
-	Vec3(const double* components)
+	constexpr T& operator[] (unsigned int index)
 	{
-		for(int i = 0; i < 3; i++)
-			this->components[i] = components[i];
+		if(std::is_constant_evaluated())
+			return index == 0 ? x : (index == 1 ? y : z);
+		return components[index];
 	}
 
-	inline double operator[] (unsigned int index) const
-		{return components[index];}
-	inline double& operator[] (unsigned int index)
-		{return components[index];}
-
-	inline friend Vec3 operator+ (const Vec3& left, const Vec3& right)
-		{return Vec3(left.x + right.x, left.y + right.y, left.z + right.z);}
-	inline friend Vec3 operator- (const Vec3& left, const Vec3& right)
-		{return Vec3(left.x - right.x, left.y - right.y, left.z - right.z);}
-	inline friend Vec3 operator* (const Vec3& left, double right)
-		{return Vec3(left.x * right, left.y * right, left.z * right);}
-	inline friend Vec3 operator* (double left, const Vec3& right)
-		{return Vec3(right.x * left, right.y * left, right.z * left);}
-	inline friend Vec3 operator/ (const Vec3& left, double right)
-	{
-		double temp = 1.0 / right;
+	constexpr friend Vec3T operator+ (const Vec3T& left, const Vec3T& right)
+		{return Vec3T(left.x + right.x, left.y + right.y, left.z + right.z);}
+	constexpr friend Vec3T operator- (const Vec3T& left, const Vec3T& right)
+		{return Vec3T(left.x - right.x, left.y - right.y, left.z - right.z);}
+	constexpr friend Vec3T operator* (const Vec3T& left, T right)
+		{return Vec3T(left.x * right, left.y * right, left.z * right);}
+	constexpr friend Vec3T operator* (T left, const Vec3T& right)
+		{return Vec3T(right.x * left, right.y * left, right.z * left);}
+	constexpr friend Vec3T operator/ (const Vec3T& left, T right)
+	{
+		T temp = 1 / right;
 		return left * temp;
 	}
 
-	inline Vec3 operator- () const
-		{return Vec3(-x, -y, -z);}
+	constexpr Vec3T operator- () const
+		{return Vec3T(-x, -y, -z);}
 
 	//Yup, I'm using * and % for dot and cross product. Sue me.
-	inline friend double operator* (const Vec3& left, const Vec3& right)
+	constexpr friend T operator* (const Vec3T& left, const Vec3T& right)
 		{return left.x * right.x + left.y * right.y + left.z * right.z;}
-	inline friend Vec3 operator% (const Vec3& left, const Vec3& right)
+	constexpr friend Vec3T operator% (const Vec3T& left, const Vec3T& right)
 	{
-		return Vec3(
+		return Vec3T(
 			left.y * right.z - left.z * right.y,
 			left.z * right.x - left.x * right.z,
 			left.x * right.y - left.y * right.x
 		);
 	}
 
-	inline double mag2() const
+	constexpr T mag2() const
 		{return (*this) * (*this);}
-	inline double mag() const
-		{return sqrt(mag2());}
+	constexpr T mag() const
+		{return (T)cx_sqrt(mag2());}
 
-	inline Vec3 normalize() const
+	constexpr Vec3T normalize() const
 		{return (*this) / mag();}
-	inline void normalize_in_place()
+	constexpr void normalize_in_place()
 	{
-		double temp = 1.0 / mag();
+		T temp = 1 / mag();
 		x *= temp;
 		y *= temp;
 		z *= temp;
@@ -108,82 +224,75 @@ struct Vec3
 };
 
 
-struct Vec4
+//Vec4 and Mat4 are aligned so that a Vec4 or a row of a Mat4 is exactly one SIMD register (AVX for double, SSE for float).
+template<typename T>
+struct alignas(4 * sizeof(T)) Vec4T
 {
 	union
 	{
 		struct
 		{
-			double x, y, z, w;
+			T x, y, z, w;
 		};
-		double components[4];
+		T components[4];
 	};
 
-	Vec4() {}
-	Vec4(int index)
-	{
-		for(int i = 0; i < 4; i++)
-			components[i] = i == index ? 1 : 0;
+	Vec4T() = default;
+	constexpr Vec4T(int index)
+		: x(index == 0 ? 1 : 0), y(index == 1 ? 1 : 0), z(index == 2 ? 1 : 0), w(index == 3 ? 1 : 0) {}
+	constexpr Vec4T(const Vec3T<T>& other, T w = 0)
+		: x(other.x), y(other.y), z(other.z), w(w) {}
+	constexpr Vec4T(T x, T y, T z = 0, T w = 0)
+		: x(x), y(y), z(z), w(w) {}
+	constexpr Vec4T(const T* components)
+		: x(components[0]), y(components[1]), z(components[2]), w(components[3]) {}
+	template<typename U>
+	constexpr explicit Vec4T(const Vec4T<U>& other)
+		: x((T)other.x), y((T)other.y), z((T)other.z), w((T)other.w) {}
+
+	constexpr T operator[] (unsigned int index) const
+	{
+		if(std::is_constant_evaluated())
+			return index == 0 ? x : (index == 1 ? y : (index == 2 ? z : w));
+		return components[index];
 	}
-	Vec4(const Vec3& other, double w = 0)
+	constexpr T& operator[] (unsigned int index)
 	{
-		for(int i = 0; i < 3; i++)
-			components[i] = other[i];
-		this->w = w;
+		if(std::is_constant_evaluated())
+			return index == 0 ? x : (index == 1 ? y : (index == 2 ? z : w));
+		return components[index];
 	}
-	Vec4(const Vec4& other)
-	{
-		for(int i = 0; i < 4; i++)
-			components[i] = other[i];
-	}
-	Vec4(double x, double y, double z = 0, double w = 0)
-	{
-		this->x = x;
-		this->y = y;
-		this->z = z;
-		this->w = w;
-	}
-	Vec4(const double* components)
-	{
-		for(int i = 0; i < 4; i++)
-			this->components[i] = components[i];
-	}
-
-	inline double operator[] (unsigned int index) const
-		{return components[index];}
-	inline double& operator[] (unsigned int index)
-		{return components[index];}
 
-	inline friend Vec4 operator+ (const Vec4& left, const Vec4& right)
-		{return Vec4(left.x + right.x, left.y + right.y, left.z + right.z, left.w + right.w);}
-	inline friend Vec4 operator- (const Vec4& left, const Vec4& right)
-		{return Vec4(left.x - right.x, left.y - right.y, left.z - right.z, left.w - right.w);}
-	inline friend Vec4 operator* (const Vec4& left, double right)
-		{return Vec4(left.x * right, left.y * right, left.z * right, left.w * right);}
-	inline friend Vec4 operator* (double left, const Vec4& right)
-		{return Vec4(right.x * left, right.y * left, right.z * left, right.w * left);}
-	inline friend Vec4 operator/ (const Vec4& left, double right)
-	{
-		double temp = 1.0 / right;
+	constexpr friend Vec4T operator+ (const Vec4T& left, const Vec4T& right)
+		{return Vec4T(left.x + right.x, left.y + right.y, left.z + right.z, left.w + right.w);}
+	constexpr friend Vec4T operator- (const Vec4T& left, const Vec4T& right)
+		{return Vec4T(left.x - right.x, left.y - right.y, left.z - right.z, left.w - right.w);}
+	constexpr friend Vec4T operator* (const Vec4T& left, T right)
+		{return Vec4T(left.x * right, left.y * right, left.z * right, left.w * right);}
+	constexpr friend Vec4T operator* (T left, const Vec4T& right)
+		{return Vec4T(right.x * left, right.y * left, right.z * left, right.w * left);}
+	constexpr friend Vec4T operator/ (const Vec4T& left, T right)
+	{
+		T temp = 1 / right;
 		return left * temp;
 	}
 
-	inline Vec4 operator- () const
-		{return Vec4(-x, -y, -z, -w);}
+	constexpr Vec4T operator- () const
+		{return Vec4T(-x, -y, -z, -w);}
 
-	inline friend double operator* (const Vec4& left, const Vec4& right)
+	constexpr friend T operator* (const Vec4T& left, const Vec4T& right)
 		{return left.x * right.x + left.y * right.y + left.z * right.z + left.w * right.w;}
 
-	inline double mag2() const
+	constexpr T mag2() const
 		{return (*this) * (*this);}
-	inline double mag() const
-		{return sqrt(mag2());}
+	constexpr T mag() const
+		{return (T)cx_sqrt(mag2());}
 
-	inline Vec4 normalize() const
+	constexpr Vec4T normalize() const
 		{return (*this) / mag();}
-	inline void normalize_in_place()
+	constexpr void normalize_in_place()
 	{
-		double temp = 1.0 / mag();
+		T temp = 1 / mag();
 		x *= temp;
 		y *= temp;
 		z *= temp;
@@ -192,38 +301,37 @@ struct Vec4
 };
 
 
-struct Mat4
+/*
+	The SIMD paths below are picked with if constexpr on T, so a Mat4T of some other scalar type
+	just gets the plain loops. They're kept out of the constexpr functions themselves, which only 
+	call them when they're running for real.
+*/
+template<typename T>
+struct alignas(4 * sizeof(T)) Mat4T
 {
-	double data[4][4];		//element i, j is data[i][j]
+	T data[4][4];		//element i, j is data[i][j]
 
-	Mat4() {}
+	Mat4T() = default;
 
-	Mat4(double fill)
+	constexpr Mat4T(T fill)
 	{
 		for(int i = 0; i < 4; i++)
 			for(int j = 0; j < 4; j++)
 				data[i][j] = fill;
 	}
 
-	Mat4(const Mat4& other)
-	{
-		for(int i = 0; i < 4; i++)
-			for(int j = 0; j < 4; j++)
-				data[i][j] = other.data[i][j];
-	}
-
-	Mat4(const double *components)
+	constexpr Mat4T(const T *components)
 	{
 		for(int i = 0; i < 4; i++)
 			for(int j = 0; j < 4; j++)
 				data[i][j] = components[(i<<2) + j];
 	}
 
-	Mat4(
-		double xx, double xy, double xz, double xw,
-		double yx, double yy, double yz, double yw,
-		double zx, double zy, double zz, double zw,
-		double wx, double wy, double wz, double ww
+	constexpr Mat4T(
+		T xx, T xy, T xz, T xw,
+		T yx, T yy, T yz, T yw,
+		T zx, T zy, T zz, T zw,
+		T wx, T wy, T wz, T ww
 	) {
 		data[_x][_x] = xx;
 		data[_x][_y] = xy;
@@ -235,97 +343,115 @@ struct Mat4
 		data[_y][_z] = yz;
 		data[_y][_w] = yw;
 
-		
+
 		data[_z][_x] = zx;
 		data[_z][_y] = zy;
 		data[_z][_z] = zz;
 		data[_z][_w] = zw;
-		
+
 		data[_w][_x] = wx;
 		data[_w][_y] = wy;
 		data[_w][_z] = wz;
 		data[_w][_w] = ww;
 	}
 
-	static Mat4 identity()
+	template<typename U>
+	constexpr explicit Mat4T(const Mat4T<U>& other)
 	{
-		Mat4 ret(0.0);
 		for(int i = 0; i < 4; i++)
-			ret.data[i][i] = 1;
-		return ret;
+			for(int j = 0; j < 4; j++)
+				data[i][j] = (T)other.data[i][j];
 	}
 
-	inline friend Vec4 operator* (const Mat4& left, const Vec4& right)
+	static constexpr Mat4T identity()
 	{
-		Vec4 ret(0, 0, 0, 0);
+		Mat4T ret(T(0));
 		for(int i = 0; i < 4; i++)
-			for(int j = 0; j < 4; j++)
-				ret[i] += left.data[i][j] * right[j];
+			ret.data[i][i] = 1;
 		return ret;
 	}
 
-	inline friend Vec4 operator* (const Vec4& left, const Mat4& right)
+	constexpr friend Vec4T<T> operator* (const Mat4T& left, const Vec4T<T>& right)
 	{
-		Vec4 ret(0, 0, 0, 0);
+		Vec4T<T> ret(0, 0, 0, 0);
+		if(!std::is_constant_evaluated() && simd_mul(left, right, ret))
+			return ret;
 		for(int i = 0; i < 4; i++)
-			for(int j = 0; j < 4; j++)
-				ret[j] += left[i] * right.data[i][j];
+			ret[i] = left.data[i][0] * right[0] + left.data[i][1] * right[1] + left.data[i][2] * right[2] + left.data[i][3] * right[3];
 		return ret;
 	}
 
-	inline friend Mat4 operator* (const Mat4& left, const Mat4& right)
+	//This is the same as ~right * left, but without the transpose.
+	constexpr friend Vec4T<T> operator* (const Vec4T<T>& left, const Mat4T& right)
 	{
-		Mat4 ret(0.0);
+		T coefficients[4] = {left.x, left.y, left.z, left.w};
+		T out[4] = {};
+		combine_rows(coefficients, right, out);
+		return Vec4T<T>(out);
+	}
+
+	constexpr friend Mat4T operator* (const Mat4T& left, const Mat4T& right)
+	{
+		Mat4T ret;
 		for(int i = 0; i < 4; i++)
-			for(int j = 0; j < 4; j++)
-				for(int k = 0; k < 4; k++)
-					ret.data[i][j] += left.data[i][k] * right.data[k][j];
+			combine_rows(left.data[i], right, ret.data[i]);
 		return ret;
 	}
 
-	inline Mat4 operator~ () const
+	constexpr Mat4T operator~ () const
 	{
-		Mat4 ret;
+		Mat4T ret;
+		if(!std::is_constant_evaluated() && simd_transpose(*this, ret))
+			return ret;
 		for(int i = 0; i < 4; i++)
 			for(int j = 0; j < 4; j++)
 				ret.data[i][j] = data[j][i];
 		return ret;
 	}
 
-	inline void set_column(int col, const Vec4& v)
+	//out = coefficients[0] * row 0 of m + ... + coefficients[3] * row 3 of m. out must not alias m.
+	static constexpr void combine_rows(const T* coefficients, const Mat4T& m, T* out)
+	{
+		if(!std::is_constant_evaluated() && simd_combine_rows(coefficients, m, out))
+			return;
+		for(int j = 0; j < 4; j++)
+			out[j] = coefficients[0] * m.data[0][j] + coefficients[1] * m.data[1][j] + coefficients[2] * m.data[2][j] + coefficients[3] * m.data[3][j];
+	}
+
+	constexpr void set_column(int col, const Vec4T<T>& v)
 	{
 		for(int i = 0; i < 4; i++)
 			data[i][col] = v[i];
 	}
 
-	inline Vec4 get_column(int col) const
+	constexpr Vec4T<T> get_column(int col) const
 	{
-		return Vec4(data[0][col], data[1][col], data[2][col], data[3][col]);
+		return Vec4T<T>(data[0][col], data[1][col], data[2][col], data[3][col]);
 	}
 
-	inline void set_row(int row, const Vec4& v)
+	constexpr void set_row(int row, const Vec4T<T>& v)
 	{
 		for(int j = 0; j < 4; j++)
 			data[row][j] = v[j];
 	}
 
-	inline Vec4 get_row(int row) const
+	constexpr Vec4T<T> get_row(int row) const
 	{
-		return Vec4(data[row][0], data[row][1], data[row][2], data[row][3]);
+		return Vec4T<T>(data[row][0], data[row][1], data[row][2], data[row][3]);
 	}
 
 	//"Axial rotation" is a misnomer. Maybe should call it "cardinal rotation"?
-	static Mat4 axial_rotation(int ix1, int ix2, double theta)
+	static constexpr Mat4T axial_rotation(int ix1, int ix2, double theta)
 	{
-		Mat4 ret = identity();
-		ret.data[ix1][ix1] = ret.data[ix2][ix2] = cos(theta);
-		ret.data[ix1][ix2] = -(ret.data[ix2][ix1] = sin(theta));
+		Mat4T ret = identity();
+		ret.data[ix1][ix1] = ret.data[ix2][ix2] = (T)cx_cos(theta);
+		ret.data[ix1][ix2] = -(ret.data[ix2][ix1] = (T)cx_sin(theta));
 		return ret;
 	}
 
-	static Mat4 from_rows(const Vec4 right, const Vec4 down, const Vec4 fwd, const Vec4 pos)
+	static constexpr Mat4T from_rows(const Vec4T<T>& right, const Vec4T<T>& down, const Vec4T<T>& fwd, const Vec4T<T>& pos)
 	{
-		Mat4 ret;
+		Mat4T ret;
 		for(int j = 0; j < 4; j++)
 		{
 			ret.data[_right][j] = right[j];
@@ -336,9 +462,9 @@ struct Mat4
 		return ret;
 	}
 
-	static Mat4 from_columns(const Vec4 right, const Vec4 down, const Vec4 fwd, const Vec4 pos)
+	static constexpr Mat4T from_columns(const Vec4T<T>& right, const Vec4T<T>& down, const Vec4T<T>& fwd, const Vec4T<T>& pos)
 	{
-		Mat4 ret;
+		Mat4T ret;
 		for(int i = 0; i < 4; i++)
 		{
 			ret.data[i][_right] = right[i];
@@ -349,7 +475,7 @@ struct Mat4
 		return ret;
 	}
 
-	inline double determinant() const
+	constexpr T determinant() const
 	{
 		return	data[0][3] * data[1][2] * data[2][1] * data[3][0] - data[0][2] * data[1][3] * data[2][1] * data[3][0] -
 				data[0][3] * data[1][1] * data[2][2] * data[3][0] + data[0][1] * data[1][3] * data[2][2] * data[3][0] +
@@ -364,15 +490,230 @@ struct Mat4
 				data[0][2] * data[1][0] * data[2][1] * data[3][3] - data[0][0] * data[1][2] * data[2][1] * data[3][3] -
 				data[0][1] * data[1][0] * data[2][2] * data[3][3] + data[0][0] * data[1][1] * data[2][2] * data[3][3];
 	}
+
+private:
+	//The SIMD kernels. Each returns false if there isn't one for T on this target.
+	static inline bool simd_mul(const Mat4T& left, const Vec4T<T>& right, Vec4T<T>& ret)
+	{
+		#if defined(S3_SSE_FLOAT)
+			if constexpr(std::is_same<T, float>::value)
+			{
+				__m128 v = _mm_loadu_ps(right.components);
+				__m128 r0 = _mm_mul_ps(_mm_loadu_ps(left.data[0]), v);
+				__m128 r1 = _mm_mul_ps(_mm_loadu_ps(left.data[1]), v);
+				__m128 r2 = _mm_mul_ps(_mm_loadu_ps(left.data[2]), v);
+				__m128 r3 = _mm_mul_ps(_mm_loadu_ps(left.data[3]), v);
+				_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+				_mm_storeu_ps(ret.components, _mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3)));
+				return true;
+			}
+		#endif
+		#if defined(S3_AVX2)
+			if constexpr(std::is_same<T, double>::value)
+			{
+				__m256d v = _mm256_loadu_pd(right.components);
+				__m256d r0 = _mm256_mul_pd(_mm256_loadu_pd(left.data[0]), v);
+				__m256d r1 = _mm256_mul_pd(_mm256_loadu_pd(left.data[1]), v);
+				__m256d r2 = _mm256_mul_pd(_mm256_loadu_pd(left.data[2]), v);
+				__m256d r3 = _mm256_mul_pd(_mm256_loadu_pd(left.data[3]), v);
+				//hadd leaves the pairwise sums interleaved by 128-bit lane, so the lanes have to be swapped back.
+				__m256d t0 = _mm256_hadd_pd(r0, r1), t1 = _mm256_hadd_pd(r2, r3);
+				_mm256_storeu_pd(
+					ret.components,
+					_mm256_add_pd(_mm256_permute2f128_pd(t0, t1, 0x20), _mm256_permute2f128_pd(t0, t1, 0x31))
+				);
+				return true;
+			}
+		#elif defined(S3_SSE2)
+			if constexpr(std::is_same<T, double>::value)
+			{
+				__m128d v01 = _mm_loadu_pd(right.components), v23 = _mm_loadu_pd(right.components + 2);
+				__m128d r[4];
+				for(int i = 0; i < 4; i++)
+					r[i] = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(left.data[i]), v01), _mm_mul_pd(_mm_loadu_pd(left.data[i] + 2), v23));
+				_mm_storeu_pd(ret.components, _mm_add_pd(_mm_unpacklo_pd(r[0], r[1]), _mm_unpackhi_pd(r[0], r[1])));
+				_mm_storeu_pd(ret.components + 2, _mm_add_pd(_mm_unpacklo_pd(r[2], r[3]), _mm_unpackhi_pd(r[2], r[3])));
+				return true;
+			}
+		#endif
+		return false;
+	}
+
+	static inline bool simd_transpose(const Mat4T& m, Mat4T& ret)
+	{
+		#if defined(S3_SSE_FLOAT)
+			if constexpr(std::is_same<T, float>::value)
+			{
+				__m128 r0 = _mm_loadu_ps(m.data[0]), r1 = _mm_loadu_ps(m.data[1]), r2 = _mm_loadu_ps(m.data[2]), r3 = _mm_loadu_ps(m.data[3]);
+				_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+				_mm_storeu_ps(ret.data[0], r0);
+				_mm_storeu_ps(ret.data[1], r1);
+				_mm_storeu_ps(ret.data[2], r2);
+				_mm_storeu_ps(ret.data[3], r3);
+				return true;
+			}
+		#endif
+		#if defined(S3_AVX2)
+			if constexpr(std::is_same<T, double>::value)
+			{
+				__m256d r0 = _mm256_loadu_pd(m.data[0]), r1 = _mm256_loadu_pd(m.data[1]), r2 = _mm256_loadu_pd(m.data[2]), r3 = _mm256_loadu_pd(m.data[3]);
+				__m256d t0 = _mm256_unpacklo_pd(r0, r1), t1 = _mm256_unpackhi_pd(r0, r1);
+				__m256d t2 = _mm256_unpacklo_pd(r2, r3), t3 = _mm256_unpackhi_pd(r2, r3);
+				_mm256_storeu_pd(ret.data[0], _mm256_permute2f128_pd(t0, t2, 0x20));
+				_mm256_storeu_pd(ret.data[1], _mm256_permute2f128_pd(t1, t3, 0x20));
+				_mm256_storeu_pd(ret.data[2], _mm256_permute2f128_pd(t0, t2, 0x31));
+				_mm256_storeu_pd(ret.data[3], _mm256_permute2f128_pd(t1, t3, 0x31));
+				return true;
+			}
+		#elif defined(S3_SSE2)
+			if constexpr(std::is_same<T, double>::value)
+			{
+				//Transpose each 2x2 block and swap the off-diagonal blocks.
+				for(int j = 0; j < 4; j += 2)
+					for(int i = 0; i < 4; i += 2)
+					{
+						__m128d a = _mm_loadu_pd(m.data[i] + j), b = _mm_loadu_pd(m.data[i + 1] + j);
+						_mm_storeu_pd(ret.data[j] + i, _mm_unpacklo_pd(a, b));
+						_mm_storeu_pd(ret.data[j + 1] + i, _mm_unpackhi_pd(a, b));
+					}
+				return true;
+			}
+		#endif
+		return false;
+	}
+
+	static inline bool simd_combine_rows(const T* coefficients, const Mat4T& m, T* out)
+	{
+		#if defined(S3_SSE_FLOAT)
+			if constexpr(std::is_same<T, float>::value)
+			{
+				__m128 acc = _mm_mul_ps(_mm_set1_ps(coefficients[0]), _mm_loadu_ps(m.data[0]));
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(coefficients[1]), _mm_loadu_ps(m.data[1])));
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(coefficients[2]), _mm_loadu_ps(m.data[2])));
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(coefficients[3]), _mm_loadu_ps(m.data[3])));
+				_mm_storeu_ps(out, acc);
+				return true;
+			}
+		#endif
+		#if defined(S3_AVX2)
+			if constexpr(std::is_same<T, double>::value)
+			{
+				__m256d acc = _mm256_mul_pd(_mm256_broadcast_sd(coefficients), _mm256_loadu_pd(m.data[0]));
+				acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_broadcast_sd(coefficients + 1), _mm256_loadu_pd(m.data[1])));
+				acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_broadcast_sd(coefficients + 2), _mm256_loadu_pd(m.data[2])));
+				acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_broadcast_sd(coefficients + 3), _mm256_loadu_pd(m.data[3])));
+				_mm256_storeu_pd(out, acc);
+				return true;
+			}
+		#elif defined(S3_SSE2)
+			if constexpr(std::is_same<T, double>::value)
+			{
+				__m128d lo = _mm_setzero_pd(), hi = _mm_setzero_pd();
+				for(int k = 0; k < 4; k++)
+				{
+					__m128d c = _mm_set1_pd(coefficients[k]);
+					lo = _mm_add_pd(lo, _mm_mul_pd(c, _mm_loadu_pd(m.data[k])));
+					hi = _mm_add_pd(hi, _mm_mul_pd(c, _mm_loadu_pd(m.data[k] + 2)));
+				}
+				_mm_storeu_pd(out, lo);
+				_mm_storeu_pd(out + 2, hi);
+				return true;
+			}
+		#endif
+		return false;
+	}
 };
 
 
+typedef Vec3T<double> Vec3;
+typedef Vec4T<double> Vec4;
+typedef Mat4T<double> Mat4;
+
+typedef Vec3T<float> Vec3f;
+typedef Vec4T<float> Vec4f;
+typedef Mat4T<float> Mat4f;
+
+
+static_assert(std::is_trivially_copyable<Vec3>::value, "Vec3 should be memcpy-able.");
+static_assert(std::is_trivially_copyable<Vec4>::value, "Vec4 should be memcpy-able.");
+static_assert(std::is_trivially_copyable<Mat4>::value, "Mat4 should be memcpy-able.");
+static_assert(sizeof(Vec4f) == 4 * sizeof(float) && std::is_trivially_copyable<Vec4f>::value, "Vec4f should be uploadable as 4 GL_FLOATs.");
+static_assert(sizeof(Mat4f) == 16 * sizeof(float) && std::is_trivially_copyable<Mat4f>::value, "Mat4f should be uploadable as 16 GL_FLOATs.");
+
+
+/*
+	Batched versions of m * in[i] for when the same matrix is applied to lots of vectors or
+	matrices (e.g. ~cam_mat * model_xform for every instance of a model). m is only loaded
+	once. in and out may be the same array.
+*/
+void transform(const Mat4& m, const Vec4* in, Vec4* out, int count);
+void transform(const Mat4& m, const Mat4* in, Mat4* out, int count);
+void transform(const Mat4f& m, const Vec4f* in, Vec4f* out, int count);
+void transform(const Mat4f& m, const Mat4f* in, Mat4f* out, int count);
+
+//Write count matrices as column-major floats (16 per matrix), the way glUniformMatrix4fv() and mat4 attributes want them.
+void transpose_to_floats(const Mat4* in, float* out, int count);
+
+
 //extern const Vec4 xhat, yhat, zhat, what;
 
-//a and b are assumed to be normalized but not necessarily orthogonal.
-//If chord is non-NULL, it will be filled in with the distance between a and b.
-Mat4 basis_around(Vec4 a, Vec4 b, double *chord = NULL);
+/*
+	The 4D "cross product" of three vectors: the vector x with x * d = det(a, b, c, d) for every d 
+	(treating a, b, c, d as columns). It's perpendicular to a, b and c, its length is the volume 
+	of the parallelepiped they span, and det(a, b, c, x) > 0 unless it's zero. If a, b and c 
+	are orthonormal, it's the unit vector that completes them to a right-handed basis.
+*/
+template<typename T>
+constexpr Vec4T<T> cross(const Vec4T<T>& a, const Vec4T<T>& b, const Vec4T<T>& c)
+{
+	//2x2 minors of a and b
+	T xy = a.x * b.y - a.y * b.x, xz = a.x * b.z - a.z * b.x, xw = a.x * b.w - a.w * b.x;
+	T yz = a.y * b.z - a.z * b.y, yw = a.y * b.w - a.w * b.y, zw = a.z * b.w - a.w * b.z;
+	return Vec4T<T>(
+		-(c.w * yz - c.z * yw + c.y * zw),
+		c.w * xz - c.z * xw + c.x * zw,
+		-(c.w * xy - c.y * xw + c.x * yw),
+		c.z * xy - c.y * xz + c.x * yz
+	);
+}
+
+/*
+	Make an SO(4) matrix whose fwd column is the direction from a towards b and whose pos column is a. 
+	(So the great circle through a and b is the circle through pos in the fwd direction.) The right 
+	column is the standard axis least aligned with a and b, orthonormalized, and the down column 
+	completes the frame, so the result is always the same for the same a and b.
+	a and b are assumed to be normalized but not necessarily orthogonal.
+	If chord is non-NULL, it will be filled in with the distance between a and b.
+*/
+constexpr Mat4 basis_around(const Vec4& a, const Vec4& other, double *chord = NULL)
+{
+	double dp = a * other;
+	if(chord)
+		*chord = acos(dp);
+	Vec4 b = (other - dp * a).normalize();
+
+	//Pick the standard axis that sticks out furthest from the a-b plane.
+	int axis = 0;
+	double least_overlap = 2;
+	for(int i = 0; i < 4; i++)
+	{
+		double overlap = a[i] * a[i] + b[i] * b[i];
+		if(overlap < least_overlap)
+		{
+			least_overlap = overlap;
+			axis = i;
+		}
+	}
+
+	Vec4 right = Vec4(axis);
+	right = (right - a * (a * right) - b * (b * right)).normalize();
+
+	//det(right, down, b, a) = det(right, b, a, down), so this makes the frame right-handed.
+	Vec4 down = cross(right, b, a);
+
+	return Mat4::from_columns(right, down, b, a);
+}
 
-void print_vector(const Vec4& v, FILE* fout = stdout);
-void print_vector(const Vec3& v, FILE* fout = stdout);
-void print_matrix(const Mat4& m, FILE* fout = stdout);
+template<typename T> void print_vector(const Vec4T<T>& v, FILE* fout = stdout);
+template<typename T> void print_vector(const Vec3T<T>& v, FILE* fout = stdout);
+template<typename T> void print_matrix(const Mat4T<T>& m, FILE* fout = stdout);